@@ -0,0 +1,44 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+#include <chrono>
+#include <cstdio>
+#include <stddef.h>
+
+// Minimal micro-benchmark harness: runs fn in batches for about half a second
+// and prints the average time per call.
+template <typename Fn>
+double benchmark(const char* name, Fn&& fn)
+{
+	typedef std::chrono::steady_clock Clock;
+	const auto budget = std::chrono::milliseconds(500);
+	size_t iterations = 0, batch = 1;
+	const Clock::time_point start = Clock::now();
+	Clock::duration elapsed;
+
+	// Warm up caches and the branch predictor
+	for (int i = 0; i < 100; i++)
+		fn();
+
+	do
+	{
+		for (size_t i = 0; i < batch; i++)
+			fn();
+		iterations += batch;
+		batch *= 2;
+		elapsed = Clock::now() - start;
+	}
+	while (elapsed < budget);
+
+	const double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+	std::printf("%-40s %12.1f ns/op\n", name, ns);
+	return ns;
+}
+
+// Keeps the compiler from optimizing away a computed value
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,326 @@
+// Throughput of splitting G-code into lines and parameters, byte at a time as
+// MappedGCodeSource and the analyzer did before versus the vectorised scanner.
+// Runs over generated files in the style of PrusaSlicer, Cura and Simplify3D,
+// or over the .gcode files given on the command line.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <ctype.h>
+#include "Bench.h"
+#include "GCodeSource.h"
+#include "wasm/gcode-analyzer/GCodeScanner.h"
+#include "wasm/gcode-analyzer/GCodeAnalyzer.h"
+
+static const int LAYERS = 150, MOVES_PER_LAYER = 2000;
+
+enum class Slicer { PrusaSlicer, Cura, Simplify3D };
+
+// PrusaSlicer drops leading zeros and puts the feedrate on lines of its own
+static std::string prusaMove(double x, double y, double e)
+{
+	char buf[64];
+	std::snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f E%.5f\n", x, y, e);
+
+	std::string line(buf);
+	size_t pos = line.find("E0.");
+	if (pos != std::string::npos)
+		line.erase(pos + 1, 1);
+	return line;
+}
+
+static std::string makeCorpus(Slicer slicer)
+{
+	std::string gcode;
+	char buf[128];
+
+	gcode += "; generated G-code\nM107\nM104 S215\nM140 S60\nM190 S60\nM109 S215\nG28\nG90\nM83\n";
+
+	for (int layer = 0; layer < LAYERS; layer++)
+	{
+		const double z = 0.2 + layer * 0.2;
+
+		switch (slicer)
+		{
+			case Slicer::PrusaSlicer:
+				std::snprintf(buf, sizeof(buf), ";LAYER_CHANGE\n;Z:%.1f\n;HEIGHT:0.2\nG1 Z%.3f F10800\n;TYPE:Perimeter\n;WIDTH:0.45\nG1 F1200\n", z, z);
+				break;
+			case Slicer::Cura:
+				std::snprintf(buf, sizeof(buf), ";LAYER:%d\nG0 F3600 X100 Y100 Z%.1f\n;TYPE:WALL-INNER\n", layer, z);
+				break;
+			case Slicer::Simplify3D:
+				std::snprintf(buf, sizeof(buf), "; layer %d, Z = %.3f\n; feature outer perimeter\n; tool H0.200 W0.480\nG1 Z%.3f F1000\n", layer + 1, z, z);
+				break;
+		}
+		gcode += buf;
+
+		for (int i = 0; i < MOVES_PER_LAYER; i++)
+		{
+			const double a = i * 0.0031;
+			const double x = 100 + 40 * std::cos(a) + (i % 7) * 0.113, y = 100 + 40 * std::sin(a) - (i % 5) * 0.071;
+			const double e = 0.01 + (i % 13) * 0.0021;
+
+			if (i % 400 == 399)
+			{
+				// Retract and travel
+				switch (slicer)
+				{
+					case Slicer::PrusaSlicer:
+						std::snprintf(buf, sizeof(buf), "G1 E-.8 F2100\nG1 X%.3f Y%.3f F10800\nG1 E.8 F2100\n;TYPE:Solid infill\nG1 F1500\n", x, y);
+						break;
+					case Slicer::Cura:
+						std::snprintf(buf, sizeof(buf), "G1 F2700 E-0.8\nG0 F3600 X%.3f Y%.3f\nG1 F2700 E0.8\n;TYPE:SKIN\n", x, y);
+						break;
+					case Slicer::Simplify3D:
+						std::snprintf(buf, sizeof(buf), "G1 E-0.8000 F2400\nG1 X%.3f Y%.3f F7200\nG1 E0.8000 F2400\n; feature solid layer\n", x, y);
+						break;
+				}
+				gcode += buf;
+				continue;
+			}
+
+			switch (slicer)
+			{
+				case Slicer::PrusaSlicer:
+					gcode += prusaMove(x, y, e);
+					break;
+				case Slicer::Cura:
+					std::snprintf(buf, sizeof(buf), (i % 50 == 0) ? "G1 F1800 X%.3f Y%.3f E%.5f\n" : "G1 X%.3f Y%.3f E%.5f\n", x, y, e);
+					gcode += buf;
+					break;
+				case Slicer::Simplify3D:
+					std::snprintf(buf, sizeof(buf), (i % 50 == 0) ? "G1 X%.3f Y%.3f E%.4f F1800\n" : "G1 X%.3f Y%.3f E%.4f\n", x, y, e);
+					gcode += buf;
+					break;
+			}
+		}
+	}
+
+	gcode += "M104 S0\nM140 S0\nG28 X0\nM84\n";
+	return gcode;
+}
+
+// What MappedGCodeSource::nextLine() did before
+struct LegacyLineSplitter
+{
+	std::string_view data;
+	size_t pos = 0;
+
+	bool nextLine(std::string_view& line)
+	{
+		while (pos < data.length())
+		{
+			const char* start = data.data() + pos;
+			const char* end = static_cast<const char*>(std::memchr(start, '\n', data.length() - pos));
+
+			if (end)
+				pos = end - data.data() + 1;
+			else
+			{
+				end = data.data() + data.length();
+				pos = data.length();
+			}
+
+			line = std::string_view(start, end - start);
+			auto comment = line.find(';');
+			if (comment != std::string_view::npos)
+				line.remove_suffix(line.length() - comment);
+			while (!line.empty() && ::isspace(line.front()))
+				line.remove_prefix(1);
+			while (!line.empty() && ::isspace(line.back()))
+				line.remove_suffix(1);
+
+			if (!line.empty())
+				return true;
+		}
+
+		return false;
+	}
+};
+
+// The analyzer's word splitting and number parsing before
+static std::string_view legacyNextWord(std::string_view& text)
+{
+	size_t end = 0;
+
+	while (!text.empty() && ::isspace(text[0]))
+		text.remove_prefix(1);
+	while (end < text.length() && !::isspace(text[end]))
+		end++;
+
+	std::string_view rv = text.substr(0, end);
+	text.remove_prefix(end);
+	return rv;
+}
+
+static float legacyStof(std::string_view s)
+{
+	float rez = 0, fact = 1;
+	size_t i = 0;
+
+	if (!s.empty() && s[0] == '-')
+	{
+		i++;
+		fact = -1;
+	}
+	for (bool pointSeen = false; i < s.length(); i++)
+	{
+		if (s[i] == '.')
+		{
+			pointSeen = true;
+			continue;
+		}
+		int d = s[i] - '0';
+		if (d >= 0 && d <= 9)
+		{
+			if (pointSeen)
+				fact /= 10.0f;
+			rez = rez * 10.0f + (float)d;
+		}
+	}
+	return rez * fact;
+}
+
+static void run(const std::string& name, const std::string& gcode)
+{
+	char tempfile[] = "/tmp/GCodeScanBenchXXXXXX";
+	int fd = mkstemp(tempfile);
+
+	if (write(fd, gcode.data(), gcode.length()) != ssize_t(gcode.length()))
+	{
+		std::fprintf(stderr, "Cannot write %s\n", tempfile);
+		return;
+	}
+	close(fd);
+
+	MappedGCodeSource source(tempfile);
+	unlink(tempfile);
+
+	// Same lines both ways
+	LegacyLineSplitter legacy { gcode };
+	std::vector<std::string_view> lines;
+	std::string_view line, expected;
+
+	while (source.nextLine(line))
+	{
+		if (!legacy.nextLine(expected) || line != expected)
+		{
+			std::fprintf(stderr, "Mismatch on line %zu\n", lines.size());
+			return;
+		}
+		lines.push_back(line);
+	}
+
+	// The raw lines, comments included
+	std::vector<std::string_view> rawLines;
+	for (size_t pos = 0; pos < gcode.length(); )
+	{
+		size_t end = gcode.find('\n', pos);
+		end = (end == std::string::npos) ? gcode.length() : end + 1;
+		rawLines.push_back(std::string_view(gcode).substr(pos, end - pos));
+		pos = end;
+	}
+
+	// Costs are per line, throughput is over the whole file
+	const double bytesPerLine = double(gcode.length()) / rawLines.size();
+	const double bytesPerCommand = double(gcode.length()) / lines.size();
+	size_t i = 0;
+
+	std::printf("%s: %.1f MB, %zu lines, %zu commands\n", name.c_str(), gcode.length() / 1e6, rawLines.size(), lines.size());
+
+	const double legacySplit = benchmark("  lines, byte at a time", [&]() {
+		if (!legacy.nextLine(line))
+		{
+			legacy.pos = 0;
+			legacy.nextLine(line);
+		}
+		doNotOptimize(line.data());
+	});
+	const double split = benchmark("  lines, MappedGCodeSource", [&]() {
+		if (!source.nextLine(line))
+		{
+			source.seek(0);
+			source.nextLine(line);
+		}
+		doNotOptimize(line.data());
+	});
+
+	i = 0;
+	const double legacyParse = benchmark("  parameters, byte at a time", [&]() {
+		std::string_view text = lines[i++ % lines.size()];
+		float sum = 0;
+
+		legacyNextWord(text);
+		for (std::string_view word; !(word = legacyNextWord(text)).empty(); )
+			sum += legacyStof(word.substr(1));
+		doNotOptimize(sum);
+	});
+	i = 0;
+	benchmark("  parameters, std::from_chars", [&]() {
+		std::string_view text = lines[i++ % lines.size()];
+		double sum = 0;
+
+		legacyNextWord(text);
+		for (std::string_view word; !(word = legacyNextWord(text)).empty(); )
+		{
+			double value = 0;
+			std::from_chars(word.data() + 1, word.data() + word.length(), value);
+			sum += value;
+		}
+		doNotOptimize(sum);
+	});
+	i = 0;
+	const double parse = benchmark("  parameters, gcodescan", [&]() {
+		gcodescan::Words words(lines[i++ % lines.size()]);
+		std::string_view word;
+		double sum = 0, value;
+
+		words.next(word);
+		while (words.next(word))
+		{
+			if (gcodescan::parseNumber(word.substr(1), value))
+				sum += value;
+		}
+		doNotOptimize(sum);
+	});
+
+	GCodeAnalyzer analyzer;
+	i = 0;
+	const double analysis = benchmark("  GCodeAnalyzer", [&]() {
+		std::string_view raw = rawLines[i++ % rawLines.size()];
+		analyzer.feed(raw.data(), raw.length());
+	});
+	doNotOptimize(analyzer.finish().filament);
+
+	std::printf("  MB/s: lines %.0f -> %.0f, parameters %.0f -> %.0f, analyzer %.0f\n",
+		bytesPerCommand * 1e3 / legacySplit, bytesPerCommand * 1e3 / split,
+		bytesPerCommand * 1e3 / legacyParse, bytesPerCommand * 1e3 / parse, bytesPerLine * 1e3 / analysis);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::ifstream file(argv[i], std::ios_base::binary);
+			std::stringstream ss;
+
+			ss << file.rdbuf();
+			run(argv[i], ss.str());
+		}
+		return 0;
+	}
+
+	run("PrusaSlicer style", makeCorpus(Slicer::PrusaSlicer));
+	run("Cura style", makeCorpus(Slicer::Cura));
+	run("Simplify3D style", makeCorpus(Slicer::Simplify3D));
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Per-line cost of framing "N<n> <cmd> *<cs>\n" over a 1M-line print:
+// the std::stringstream based code Printer::doWrite() used before
+// versus LineFramer, with and without a precomputed body checksum.
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include "Bench.h"
+#include "LineFramer.h"
+
+static const size_t LINE_COUNT = 1000000;
+
+struct Line
+{
+	std::string text;
+	int checksum;
+};
+
+// Looks like sliced output: mostly extrusion moves
+static std::vector<Line> makeCorpus()
+{
+	std::vector<Line> lines;
+	char buf[64];
+
+	lines.reserve(LINE_COUNT);
+
+	for (size_t i = 0; i < LINE_COUNT; i++)
+	{
+		if (i % 50 == 0)
+			std::snprintf(buf, sizeof(buf), "G0 F7200 X%.3f Y%.3f", 10 + (i % 200) * 0.913, 10 + (i % 170) * 1.07);
+		else
+			std::snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f E%.5f", 10 + (i % 200) * 0.913, 10 + (i % 170) * 1.07, (i % 97) * 0.03311);
+
+		Line line { buf, 0 };
+		for (char c : line.text)
+			line.checksum ^= (unsigned char) c;
+		lines.push_back(std::move(line));
+	}
+
+	return lines;
+}
+
+static unsigned int legacyChecksum(std::string cmd)
+{
+	unsigned int cs = 0;
+
+	for (size_t i = 0; i < cmd.length() && cmd[i] != '*'; i++)
+		cs ^= unsigned(cmd[i]);
+
+	return cs & 0xff;
+}
+
+// What Printer::doWrite() did before, it checksummed the whole line every time
+static std::string legacyFrame(int lineNo, const std::string& command)
+{
+	std::stringstream ss;
+
+	ss << 'N' << lineNo << ' ' << command << ' ';
+
+	unsigned int cs = legacyChecksum(ss.str());
+	ss << '*' << cs << '\n';
+
+	return ss.str();
+}
+
+int main()
+{
+	const std::vector<Line> corpus = makeCorpus();
+	std::string buffer;
+	LineFramer framer;
+	size_t i;
+
+	// Same output both ways
+	for (i = 0; i < 1000; i++)
+	{
+		framer.frame(i + 1, corpus[i].text, -1);
+		if (framer.line() != legacyFrame(i + 1, corpus[i].text))
+		{
+			std::fprintf(stderr, "Mismatch on line %zu\n", i);
+			return 1;
+		}
+	}
+
+	std::printf("%zu lines, per-line cost\n", corpus.size());
+
+	// Appending to the write buffer is a part of both
+	i = 0;
+	const double legacy = benchmark("  stringstream", [&]() {
+		const Line& line = corpus[i++ % LINE_COUNT];
+		buffer.clear();
+		buffer += legacyFrame(i, line.text);
+		doNotOptimize(buffer.data());
+	});
+
+	i = 0;
+	const double framed = benchmark("  LineFramer", [&]() {
+		const Line& line = corpus[i++ % LINE_COUNT];
+		framer.frame(i, line.text, line.checksum);
+		buffer.clear();
+		buffer.append(framer.line());
+		doNotOptimize(buffer.data());
+	});
+
+	i = 0;
+	benchmark("  LineFramer, unknown checksum", [&]() {
+		const Line& line = corpus[i++ % LINE_COUNT];
+		framer.frame(i, line.text, -1);
+		buffer.clear();
+		buffer.append(framer.line());
+		doNotOptimize(buffer.data());
+	});
+
+	std::printf("  speedup: %.1fx\n", legacy / framed);
+	return 0;
+}
@@ -0,0 +1,141 @@
+// Cost of finding the handler for a request: trying each route's boost::regex in turn,
+// as WebRouter did before, versus the segment trie of RouteTable.
+// Uses the routes dashprint registers under /api/v1/, in the same order.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <boost/regex.hpp>
+#include "Bench.h"
+#include "web/RouteTable.h"
+
+typedef boost::beast::http::verb verb;
+
+struct RouteDef
+{
+	verb method;
+	const char* pattern;
+};
+
+static const RouteDef ROUTES[] = {
+	{ verb::post, "printers/discover" },
+	{ verb::get, "printers" },
+	{ verb::post, "printers" },
+	{ verb::put, "printers/([^/]+)" },
+	{ verb::get, "printers/([^/]+)" },
+	{ verb::post, "printers/([^/]+)/reset" },
+	{ verb::delete_, "printers/([^/]+)" },
+	{ verb::post, "printers/([^/]+)/job" },
+	{ verb::put, "printers/([^/]+)/job" },
+	{ verb::get, "printers/([^/]+)/job" },
+	{ verb::get, "printers/([^/]+)/recovery" },
+	{ verb::delete_, "printers/([^/]+)/recovery" },
+	{ verb::get, "printers/([^/]+)/gcode" },
+	{ verb::post, "printers/([^/]+)/gcode" },
+	{ verb::put, "printers/([^/]+)/temperatures" },
+	{ verb::get, "printers/([^/]+)/temperatures" },
+	{ verb::get, "printers/([^/]+)/stats" },
+	{ verb::post, "files/([^/]+)" },
+	{ verb::get, "files/([^/]+)" },
+	{ verb::get, "files/([^/]+)/analysis" },
+	{ verb::delete_, "files/([^/]+)" },
+	{ verb::get, "files" },
+	{ verb::post, "auth/login" },
+	{ verb::post, "auth/refreshToken" },
+	{ verb::get, "auth/user/(.+)" },
+};
+
+struct Request
+{
+	verb method;
+	const char* url;
+};
+
+// Weighted towards what the web client polls
+static const Request REQUESTS[] = {
+	{ verb::get, "printers" },
+	{ verb::get, "printers/prusa-mk3s/temperatures" },
+	{ verb::get, "printers/prusa-mk3s/job" },
+	{ verb::get, "printers/prusa-mk3s/stats" },
+	{ verb::get, "printers/prusa-mk3s/temperatures" },
+	{ verb::get, "printers/prusa-mk3s/job" },
+	{ verb::post, "printers/prusa-mk3s/gcode" },
+	{ verb::get, "files" },
+	{ verb::get, "files/benchy.gcode/analysis" },
+	{ verb::post, "auth/refreshToken" },
+	{ verb::get, "auth/user/admin" },
+	{ verb::get, "printers/prusa-mk3s/unknown" },
+};
+
+struct RegexRoute
+{
+	boost::regex re;
+	verb method;
+};
+
+static int regexFind(const std::vector<RegexRoute>& routes, std::string_view url, verb method, boost::cmatch& m)
+{
+	for (size_t i = 0; i < routes.size(); i++)
+	{
+		if (routes[i].method == method && boost::regex_match(url.begin(), url.end(), m, routes[i].re))
+			return int(i);
+	}
+	return -1;
+}
+
+int main()
+{
+	std::vector<RegexRoute> regexRoutes;
+	RouteTable table;
+
+	for (const RouteDef& def : ROUTES)
+	{
+		regexRoutes.push_back(RegexRoute{ boost::regex(def.pattern), def.method });
+		table.add(def.pattern, def.method);
+	}
+
+	// Both have to agree before their speed means anything
+	for (const Request& request : REQUESTS)
+	{
+		boost::cmatch m;
+		RouteTable::Match match;
+		const int expected = regexFind(regexRoutes, request.url, request.method, m);
+		const bool found = table.find(request.url, request.method, match);
+
+		if (found != (expected >= 0) || (found && (match.id != size_t(expected) || match.captureCount != int(m.size()))))
+		{
+			std::fprintf(stderr, "Mismatch for %s\n", request.url);
+			return 1;
+		}
+
+		for (int i = 0; found && i < match.captureCount; i++)
+		{
+			if (match.captures[i] != std::string_view(m[i].first, m[i].length()))
+			{
+				std::fprintf(stderr, "Capture mismatch for %s\n", request.url);
+				return 1;
+			}
+		}
+	}
+
+	const size_t count = sizeof(REQUESTS) / sizeof(REQUESTS[0]);
+
+	std::printf("%zu routes, %zu requests per op\n", regexRoutes.size(), count);
+
+	const double legacy = benchmark("  boost::regex, in order", [&]() {
+		boost::cmatch m;
+		for (const Request& request : REQUESTS)
+			doNotOptimize(regexFind(regexRoutes, request.url, request.method, m));
+	});
+
+	const double trie = benchmark("  RouteTable", [&]() {
+		RouteTable::Match match;
+		for (const Request& request : REQUESTS)
+			doNotOptimize(table.find(request.url, request.method, match));
+	});
+
+	std::printf("  per request: %.1f ns -> %.1f ns (%.1fx)\n", legacy / count, trie / count, legacy / trie);
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+// Compares the allocation-free temperature report parser with the
+// kvParse()/std::stof() based code Printer used before.
+
+#include <string>
+#include <map>
+#include <vector>
+#include "Bench.h"
+#include "Printer.h"
+#include "TemperatureParser.h"
+
+// Replies as sent by real firmware
+static const std::vector<std::string> MARLIN = {
+	"ok T:23.36 /0.00 B:22.97 /0.00 @:0 B@:0",
+	"ok T:210.00 /210.00 B:60.02 /60.00 @:57 B@:21",
+	"ok T:214.47 /215.00 (3754.12) B:59.98 /60.00 (3965.88) @:64 B@:0",
+	"ok T0:201.5 /205.0 T1:24.1 /0.0 B:60.0 /60.0 C:32.4 /0.0 @0:78 @1:0 B@:15 C@:0",
+	" T:180.52 E:0 W:?",
+	" T:195.07 E:0 W:3",
+};
+static const std::vector<std::string> PRUSA = {
+	"ok T:215.0 /215.0 B:60.0 /60.0 T0:215.0 /215.0 @:32 B@:43 P:35.3 A:36.2",
+	"T:214.9 /215.0 B:60.1 /60.0 T0:214.9 /215.0 @:38 B@:39 P:35.4 A:36.1",
+	"T:169.3 E:0 B:59.5",
+};
+static const std::vector<std::string> KLIPPER = {
+	"ok B:59.9 /60.0 T0:209.8 /210.0",
+	"ok B:22.1 /0.0 T0:22.8 /0.0 T1:23.0 /0.0",
+	"B:60.0 /60.0 T0:210.1 /210.0",
+};
+
+// What Printer::parseTemperatures() did before
+static size_t legacyParse(const std::string& line)
+{
+	std::map<std::string, std::string> values;
+	std::map<std::string, float> changes;
+
+	Printer::kvParse(line, values);
+
+	for (auto it : values)
+	{
+		if (it.first != "T" && it.first != "B")
+			continue;
+
+		try
+		{
+			size_t slash = it.second.find('/');
+
+			changes.emplace(it.first + ".current", std::stof(it.second));
+			if (slash != std::string::npos)
+				changes.emplace(it.first + ".target", std::stof(it.second.substr(slash + 1)));
+		}
+		catch (const std::exception& e)
+		{
+		}
+	}
+
+	return changes.size();
+}
+
+static void run(const char* name, const std::vector<std::string>& corpus)
+{
+	std::printf("%s corpus (%zu lines)\n", name, corpus.size());
+
+	const double legacy = benchmark("  kvParse + stof", [&]() {
+		for (const std::string& line : corpus)
+			doNotOptimize(legacyParse(line));
+	});
+	const double parser = benchmark("  parseTemperatureReport", [&]() {
+		TemperatureReading readings[16];
+		for (const std::string& line : corpus)
+			doNotOptimize(parseTemperatureReport(line, readings, 16));
+	});
+
+	std::printf("  speedup: %.1fx\n", legacy / parser);
+}
+
+int main()
+{
+	run("Marlin", MARLIN);
+	run("Prusa", PRUSA);
+	run("Klipper", KLIPPER);
+	return 0;
+}
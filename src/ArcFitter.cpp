@@ -0,0 +1,326 @@
+#include "ArcFitter.h"
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+ArcFitStage::ArcFitStage(double tolerance)
+: m_tolerance(tolerance)
+{
+}
+
+void ArcFitStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena)
+{
+	m_output = &out;
+	m_arena = &arena;
+
+	restoreRun();
+	for (const GCodeLine& line : in)
+		process(line);
+}
+
+void ArcFitStage::flush(std::vector<GCodeLine>& out, TextArena& arena)
+{
+	m_output = &out;
+	m_arena = &arena;
+
+	flushRun();
+}
+
+void ArcFitStage::reset(size_t, size_t)
+{
+	m_run.clear();
+
+	// Unknown until the next absolute move
+	m_absolute = m_absoluteE = true;
+	m_positionKnown = false;
+}
+
+void ArcFitStage::restoreRun()
+{
+	for (Segment& segment : m_run)
+	{
+		const std::string_view text = m_arena->store(segment.line.text);
+
+		if (!segment.feedrate.empty())
+			segment.feedrate = text.substr(segment.feedrate.data() - segment.line.text.data(), segment.feedrate.length());
+		segment.line.text = text;
+	}
+}
+
+void ArcFitStage::process(const Line& line)
+{
+	Segment segment;
+
+	if (!parseSegment(line, segment))
+	{
+		flushRun();
+		track(line.text);
+		m_output->push_back(line);
+		return;
+	}
+
+	// The feedrate applies to the whole arc
+	if (!segment.feedrate.empty() && !m_run.empty())
+		flushRun();
+
+	if (m_run.empty())
+	{
+		m_runX = m_x;
+		m_runY = m_y;
+	}
+
+	m_run.push_back(segment);
+	m_x = segment.x;
+	m_y = segment.y;
+	m_e = m_absoluteE ? m_e + segment.e : 0;
+
+	while (!fits(m_run.size()))
+	{
+		// Everything but the new segment formed an arc
+		if (m_run.size() - 1 >= MIN_SEGMENTS)
+			emitArc(m_run.size() - 1);
+		else
+			emitLines(1);
+	}
+}
+
+bool ArcFitStage::parseSegment(const Line& line, Segment& segment) const
+{
+	if (!isGCodeCommand(line.text, "G1") || !m_absolute || !m_positionKnown)
+		return false;
+
+	bool hasXY = false;
+
+	segment.line = line;
+	segment.x = m_x;
+	segment.y = m_y;
+	segment.e = 0;
+	segment.hasE = false;
+	segment.feedrate = std::string_view();
+
+	const bool ok = forEachGCodeParam(line.text, [&](char letter, double value, std::string_view text) {
+		switch (letter)
+		{
+			case 'X':
+				segment.x = value;
+				hasXY = true;
+				return true;
+			case 'Y':
+				segment.y = value;
+				hasXY = true;
+				return true;
+			case 'E':
+				segment.e = m_absoluteE ? value - m_e : value;
+				segment.hasE = true;
+				return true;
+			case 'F':
+				segment.feedrate = text;
+				return true;
+			default:
+				// Z moves and anything else end the run
+				return false;
+		}
+	});
+
+	// Zero length moves would make the circle degenerate
+	return ok && hasXY && (segment.x != m_x || segment.y != m_y);
+}
+
+void ArcFitStage::track(std::string_view text)
+{
+	if (isGCodeCommand(text, "G90"))
+		m_absolute = true;
+	else if (isGCodeCommand(text, "G91"))
+		m_absolute = false;
+	else if (isGCodeCommand(text, "M82"))
+		m_absoluteE = true;
+	else if (isGCodeCommand(text, "M83"))
+		m_absoluteE = false;
+	else if (isGCodeCommand(text, "G28"))
+		m_positionKnown = false;
+	else if (isGCodeCommand(text, "G92"))
+	{
+		forEachGCodeParam(text, [&](char letter, double value, std::string_view) {
+			if (letter == 'E')
+				m_e = value;
+			else if (letter == 'X' || letter == 'Y')
+				m_positionKnown = false;
+			return true;
+		});
+	}
+	else if (isGCodeCommand(text, "G0") || isGCodeCommand(text, "G1") || isGCodeCommand(text, "G2") || isGCodeCommand(text, "G3"))
+	{
+		bool hasX = false, hasY = false;
+
+		const bool ok = forEachGCodeParam(text, [&](char letter, double value, std::string_view) {
+			switch (letter)
+			{
+				case 'X':
+					m_x = m_absolute ? value : m_x + value;
+					hasX = true;
+					break;
+				case 'Y':
+					m_y = m_absolute ? value : m_y + value;
+					hasY = true;
+					break;
+				case 'E':
+					if (m_absoluteE)
+						m_e = value;
+					break;
+			}
+			return true;
+		});
+
+		if (!ok)
+			m_positionKnown = false;
+		// The first absolute move with both coordinates tells where we are
+		else if (m_absolute && hasX && hasY)
+			m_positionKnown = true;
+	}
+}
+
+bool ArcFitStage::circle(size_t count, double& cx, double& cy, double& r) const
+{
+	// Through the start, middle and end point
+	const double ax = m_runX, ay = m_runY;
+	const double bx = m_run[count/2 - 1 + (count % 2)].x, by = m_run[count/2 - 1 + (count % 2)].y;
+	const double ex = m_run[count-1].x, ey = m_run[count-1].y;
+
+	const double d = 2 * (ax * (by - ey) + bx * (ey - ay) + ex * (ay - by));
+	if (std::abs(d) < 1e-9)
+		return false;
+
+	const double a2 = ax*ax + ay*ay, b2 = bx*bx + by*by, e2 = ex*ex + ey*ey;
+
+	cx = (a2 * (by - ey) + b2 * (ey - ay) + e2 * (ay - by)) / d;
+	cy = (a2 * (ex - bx) + b2 * (ax - ex) + e2 * (bx - ax)) / d;
+	r = std::hypot(ax - cx, ay - cy);
+
+	return r <= MAX_RADIUS;
+}
+
+bool ArcFitStage::fits(size_t count) const
+{
+	if (count < 2)
+		return true;
+
+	const bool hasE = m_run[0].hasE;
+	double cx, cy, r;
+
+	if (!circle(count, cx, cy, r))
+		return false;
+
+	double px = m_runX, py = m_runY;
+	double sweep = 0, length = 0, extruded = 0;
+	int direction = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const Segment& s = m_run[i];
+
+		if (s.hasE != hasE)
+			return false;
+
+		// Both the points and the middles of the chords have to be close to the arc
+		const double mx = (px + s.x) / 2, my = (py + s.y) / 2;
+		if (std::abs(std::hypot(s.x - cx, s.y - cy) - r) > m_tolerance || std::abs(std::hypot(mx - cx, my - cy) - r) > m_tolerance)
+			return false;
+
+		const double cross = (px - cx) * (s.y - cy) - (py - cy) * (s.x - cx);
+		const double dot = (px - cx) * (s.x - cx) + (py - cy) * (s.y - cy);
+		const int dir = (cross > 0) ? 1 : -1;
+
+		if (direction != 0 && dir != direction)
+			return false;
+		direction = dir;
+
+		sweep += std::abs(std::atan2(cross, dot));
+		length += std::hypot(s.x - px, s.y - py);
+		extruded += s.e;
+
+		px = s.x;
+		py = s.y;
+	}
+
+	// A full circle would be ambiguous
+	if (sweep >= 2 * M_PI - 0.01)
+		return false;
+
+	if (hasE)
+	{
+		// The extrusion has to be spread evenly along the path
+		const double rate = extruded / length;
+		px = m_runX;
+		py = m_runY;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const Segment& s = m_run[i];
+			const double expected = rate * std::hypot(s.x - px, s.y - py);
+
+			if (std::abs(s.e - expected) > std::max(1e-5, std::abs(expected) * 0.05))
+				return false;
+
+			px = s.x;
+			py = s.y;
+		}
+	}
+
+	return true;
+}
+
+void ArcFitStage::emitArc(size_t count)
+{
+	double cx, cy, r;
+	circle(count, cx, cy, r);
+
+	const Segment& last = m_run[count-1];
+	const Segment& first = m_run[0];
+	const double cross = (m_runX - cx) * (first.y - cy) - (m_runY - cy) * (first.x - cx);
+
+	double e = 0;
+	for (size_t i = 0; i < count; i++)
+		e += m_run[i].e;
+
+	// The absolute E after the last segment
+	if (m_absoluteE)
+	{
+		e = m_e;
+		for (size_t i = count; i < m_run.size(); i++)
+			e -= m_run[i].e;
+	}
+
+	char buf[128];
+	int len = std::snprintf(buf, sizeof(buf), "%s X%.3f Y%.3f I%.3f J%.3f", (cross < 0) ? "G2" : "G3",
+		last.x, last.y, cx - m_runX, cy - m_runY);
+
+	if (first.hasE)
+		len += std::snprintf(buf + len, sizeof(buf) - len, " E%.5f", e);
+	if (!first.feedrate.empty())
+		len += std::snprintf(buf + len, sizeof(buf) - len, " %.*s", int(first.feedrate.length()), first.feedrate.data());
+
+	m_output->push_back({ m_arena->store(std::string_view(buf, std::min<size_t>(len, sizeof(buf) - 1))), -1, last.line.position });
+
+	m_runX = last.x;
+	m_runY = last.y;
+	m_run.erase(m_run.begin(), m_run.begin() + count);
+}
+
+void ArcFitStage::emitLines(size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		m_output->push_back(m_run[i].line);
+
+	m_runX = m_run[count-1].x;
+	m_runY = m_run[count-1].y;
+	m_run.erase(m_run.begin(), m_run.begin() + count);
+}
+
+void ArcFitStage::flushRun()
+{
+	if (m_run.size() >= MIN_SEGMENTS)
+		emitArc(m_run.size());
+	else if (!m_run.empty())
+		emitLines(m_run.size());
+}
+
@@ -0,0 +1,67 @@
+#ifndef _ARCFITTER_H
+#define _ARCFITTER_H
+#include <string_view>
+#include <vector>
+#include "GCodePipeline.h"
+
+// Replaces runs of consecutive G1 moves lying on a circle with a single G2/G3,
+// for firmware that announces Cap:ARCS:1. Slicers approximate curves with many tiny
+// segments, each of them costing a round trip to the printer.
+// Other lines are passed through as they are.
+class ArcFitStage : public GCodeStage
+{
+public:
+	// tolerance is the max distance in mm of the original path from the arc
+	ArcFitStage(double tolerance);
+
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	void flush(std::vector<GCodeLine>& out, TextArena& arena) override;
+	void reset(size_t offset, size_t sourceSize) override;
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<ArcFitStage>(m_tolerance); }
+
+	// Shorter runs aren't worth an arc
+	static constexpr size_t MIN_SEGMENTS = 3;
+	// Flatter curves are left alone, the firmware's arc math gets imprecise there
+	static constexpr double MAX_RADIUS = 1000;
+private:
+	typedef GCodeLine Line;
+	// A G1 move that may become a part of an arc
+	struct Segment
+	{
+		Line line;
+		double x, y;
+		double e; // Extruded length, relative
+		bool hasE;
+		std::string_view feedrate; // F parameter, only allowed on the first segment of a run
+	};
+
+	void process(const Line& line);
+	// The run held back from the previous call moves to where the arena keeps this call's lines
+	void restoreRun();
+	bool parseSegment(const Line& line, Segment& segment) const;
+	// Keeps m_x/m_y/m_e up to date for lines that are passed through
+	void track(std::string_view text);
+
+	// Whether the first count segments of the run fit an arc
+	bool fits(size_t count) const;
+	bool circle(size_t count, double& cx, double& cy, double& r) const;
+	void emitArc(size_t count);
+	void emitLines(size_t count);
+	void flushRun();
+private:
+	const double m_tolerance;
+
+	// Where lines go while process() or flush() runs
+	std::vector<GCodeLine>* m_output = nullptr;
+	TextArena* m_arena = nullptr;
+
+	// Run start and its segments
+	double m_runX = 0, m_runY = 0;
+	std::vector<Segment> m_run;
+
+	// Machine state at the end of the run
+	bool m_absolute = true, m_absoluteE = true, m_positionKnown = false;
+	double m_x = 0, m_y = 0, m_e = 0;
+};
+
+#endif
@@ -1,16 +1,285 @@
 #include "FileManager.h"
+#include "GCodeSource.h"
+#include "PrintTimeEstimator.h"
+#include "wasm/gcode-analyzer/GCodeAnalyzer.h"
 #include <fstream>
+#include <algorithm>
+#include <cstdio>
 #include <stdexcept>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-FileManager::FileManager(std::string_view directory)
+// Bumped whenever cached analyses lack something that's now expected
+static constexpr int ANALYSIS_VERSION = 3;
+// Slicers put thumbnails into the header, no need to look further
+static constexpr size_t THUMBNAIL_SCAN_LENGTH = 4*1024*1024;
+
+static nlohmann::json stateToJson(const GCodeAnalysis::State& state)
+{
+	return nlohmann::json {
+		{ "relative", state.relative },
+		{ "relative_e", state.relativeE },
+		{ "position", { state.position[0], state.position[1], state.position[2] } },
+		{ "e", state.e },
+		{ "feedrate", state.feedrate },
+		{ "hotend", state.hotend },
+		{ "bed", state.bed },
+		{ "fan", state.fan }
+	};
+}
+
+static GCodeAnalysis::State stateFromJson(const nlohmann::json& json)
+{
+	GCodeAnalysis::State state;
+
+	state.relative = json.at("relative").get<bool>();
+	state.relativeE = json.at("relative_e").get<bool>();
+	for (int i = 0; i < 3; i++)
+		state.position[i] = json.at("position").at(i).get<float>();
+	state.e = json.at("e").get<double>();
+	state.feedrate = json.at("feedrate").get<float>();
+	state.hotend = json.at("hotend").get<float>();
+	state.bed = json.at("bed").get<float>();
+	state.fan = json.at("fan").get<int>();
+
+	return state;
+}
+
+// FNV-1a, good enough to tell files apart
+static std::string contentHash(const char* data, size_t length)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ uint8_t(data[i])) * 1099511628211ull;
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+	return hex;
+}
+
+// Skips anything that's not base64, such as the comment markers
+static std::string base64Decode(std::string_view text)
+{
+	std::string rv;
+	uint32_t bits = 0;
+	int count = 0;
+
+	for (char c : text)
+	{
+		int value;
+
+		if (c >= 'A' && c <= 'Z')
+			value = c - 'A';
+		else if (c >= 'a' && c <= 'z')
+			value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9')
+			value = c - '0' + 52;
+		else if (c == '+')
+			value = 62;
+		else if (c == '/')
+			value = 63;
+		else if (c == '=')
+			break;
+		else
+			continue;
+
+		bits = (bits << 6) | value;
+		count += 6;
+
+		if (count >= 8)
+		{
+			count -= 8;
+			rv.push_back(char((bits >> count) & 0xff));
+		}
+	}
+
+	return rv;
+}
+
+// Writes the largest PNG in "; thumbnail begin WxH length" blocks to pngPath.
+// Returns its size, null if there's none.
+static nlohmann::json extractThumbnail(std::string_view data, const std::string& pngPath)
+{
+	std::string_view best;
+	int bestWidth = 0, bestHeight = 0;
+	size_t pos = 0;
+
+	data = data.substr(0, THUMBNAIL_SCAN_LENGTH);
+
+	while ((pos = data.find("; thumbnail", pos)) != std::string_view::npos)
+	{
+		const size_t eol = std::min(data.find('\n', pos), data.length());
+		const std::string line(data.substr(pos, eol - pos));
+		const char* end = nullptr;
+		int width, height;
+
+		if (std::sscanf(line.c_str(), "; thumbnail begin %dx%d", &width, &height) == 2)
+			end = "; thumbnail end";
+		else if (std::sscanf(line.c_str(), "; thumbnail_PNG begin %dx%d", &width, &height) == 2)
+			end = "; thumbnail_PNG end";
+
+		pos = eol;
+		if (!end)
+			continue;
+
+		const size_t endPos = data.find(end, pos);
+		if (endPos == std::string_view::npos)
+			break;
+
+		if (width * height > bestWidth * bestHeight)
+		{
+			best = data.substr(pos, endPos - pos);
+			bestWidth = width;
+			bestHeight = height;
+		}
+		pos = endPos;
+	}
+
+	boost::system::error_code ec;
+
+	if (best.empty())
+	{
+		boost::filesystem::remove(pngPath, ec);
+		return nullptr;
+	}
+
+	const std::string png = base64Decode(best);
+	if (png.compare(0, 4, "\x89PNG") != 0)
+		return nullptr;
+
+	const boost::filesystem::path tempPath = boost::filesystem::unique_path(pngPath + ".%%%%%%");
+	{
+		std::ofstream file(tempPath.string(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		file << png;
+
+		if (!file)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Cannot write " << pngPath;
+			return nullptr;
+		}
+	}
+
+	boost::filesystem::rename(tempPath, pngPath, ec);
+	if (ec)
+	{
+		boost::filesystem::remove(tempPath, ec);
+		return nullptr;
+	}
+
+	return nlohmann::json { { "width", bestWidth }, { "height", bestHeight } };
+}
+
+// What file lists show of the analysis
+static nlohmann::json summarize(const nlohmann::json& analysis)
+{
+	return nlohmann::json {
+		{ "layers", analysis.at("layers").size() },
+		{ "min", analysis.at("min") },
+		{ "max", analysis.at("max") },
+		{ "filament", analysis.at("filament") },
+		{ "estimated_time", analysis.at("estimated_time") },
+		{ "hash", analysis.at("hash") },
+		{ "thumbnail", analysis.at("thumbnail") }
+	};
+}
+
+FileManager::FileManager(std::string_view directory, int analysisThreads)
 : m_path(std::string(directory))
 {
+	boost::system::error_code ec;
+
 	boost::filesystem::create_directories(m_path);
+
+	// Leftovers of uploads interrupted by a restart
+	boost::filesystem::remove_all(uploadDirectory(), ec);
+	boost::filesystem::create_directories(uploadDirectory());
+
+	// Queues the files stored before, their cached analyses make this quick
+	listFiles();
+
+	for (int i = 0; i < analysisThreads; i++)
+		m_workers.emplace_back(&FileManager::analysisWorker, this);
+}
+
+FileManager::~FileManager()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stopping = true;
+	lock.unlock();
+
+	m_cv.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+std::string FileManager::uploadDirectory() const
+{
+	return (m_path / ".uploads").generic_string();
+}
+
+static void writeAll(int fd, const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		const ssize_t written = ::write(fd, data, length);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Cannot write file");
+		}
+
+		data += written;
+		length -= written;
+	}
 }
 
 std::string FileManager::saveFile(std::string_view name, const void* contents, size_t length)
+{
+	std::string tempPath = uploadDirectory() + "/saveXXXXXX";
+	int fd = ::mkstemp(&tempPath[0]);
+
+	if (fd == -1)
+		throw std::runtime_error("Cannot open file for writing");
+
+	try
+	{
+		writeAll(fd, static_cast<const char*>(contents), length);
+	}
+	catch (...)
+	{
+		::close(fd);
+		::unlink(tempPath.c_str());
+		throw;
+	}
+
+	::close(fd);
+	return commitFile(name, tempPath);
+}
+
+std::string FileManager::saveFile(std::string_view name, std::string_view otherfile)
+{
+	boost::system::error_code ec;
+
+	// Request bodies spooled next to the storage only need moving into place
+	if (boost::filesystem::equivalent(boost::filesystem::path(std::string(otherfile)).parent_path(), uploadDirectory(), ec))
+		return commitFile(name, std::string(otherfile));
+
+	boost::iostreams::mapped_file mapping(std::string(otherfile), std::ios_base::in);
+	if (!mapping.is_open())
+		throw std::runtime_error("Cannot read file");
+
+	return saveFile(name, mapping.const_data(), mapping.size());
+}
+
+std::string FileManager::commitFile(std::string_view name, const std::string& tempPath)
 {
 	boost::system::error_code ec;
 	std::string safeName = std::string(name);
@@ -22,31 +291,162 @@ std::string FileManager::saveFile(std::string_view name, const void* contents, s
 	});
 	std::string path = getFilePath(safeName.c_str());
 
-	// Remove the file first so that ongoing prints aren't disrupted.
-	// This doesn't work on crappy OSes such as Windows.
-	boost::filesystem::remove(path, ec);
-
-	std::ofstream file(path, std::ios_base::out | std::ios_base::binary);
-	if (!file.is_open())
-		throw std::runtime_error("Cannot open file for writing");
+	// The contents must be on disk before the rename makes them visible,
+	// otherwise a power loss could leave an empty file under the final name.
+	// mkstemp() creates files only their owner can read.
+	int fd = ::open(tempPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || ::fchmod(fd, 0644) != 0 || ::fsync(fd) != 0)
+	{
+		if (fd != -1)
+			::close(fd);
+		::unlink(tempPath.c_str());
+		throw std::runtime_error("Cannot write file");
+	}
+	::close(fd);
 
-	file.write(static_cast<const char*>(contents), length);
+	removeSidecars(path);
 
-	file.flush();
-	if (file.bad())
+	// Replaces any older file in one step. Ongoing prints keep reading the old one.
+	if (::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		::unlink(tempPath.c_str());
 		throw std::runtime_error("Cannot write file");
+	}
+
+	fd = ::open(m_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1)
+	{
+		::fsync(fd);
+		::close(fd);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_metadata.erase(safeName);
+		enqueueAnalysis(safeName);
+	}
 
 	m_fileListChangedSignal();
 	return safeName;
 }
 
-std::string FileManager::saveFile(std::string_view name, std::string_view otherfile)
+void FileManager::enqueueAnalysis(const std::string& name, bool urgent)
 {
-	boost::iostreams::mapped_file mapping(std::string(otherfile), std::ios_base::in);
-	if (!mapping.is_open())
-		throw std::runtime_error("Cannot read file");
+	if (!m_analysisPending.insert(name).second)
+	{
+		if (!urgent)
+			return;
 
-	return saveFile(name, mapping.const_data(), mapping.size());
+		// Still queued rather than being analyzed?
+		auto it = std::find(m_analysisQueue.begin(), m_analysisQueue.end(), name);
+		if (it == m_analysisQueue.end())
+			return;
+		m_analysisQueue.erase(it);
+	}
+
+	if (urgent)
+		m_analysisQueue.push_front(name);
+	else
+		m_analysisQueue.push_back(name);
+	m_cv.notify_one();
+}
+
+void FileManager::analysisWorker()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_cv.wait(lock, [&]() {
+			return m_stopping || !m_tasks.empty() || !m_analysisQueue.empty();
+		});
+
+		if (m_stopping)
+			break;
+
+		// Someone's waiting for these
+		if (!m_tasks.empty())
+		{
+			std::function<void()> task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+			lock.unlock();
+
+			task();
+
+			lock.lock();
+			continue;
+		}
+
+		const std::string name = std::move(m_analysisQueue.front());
+		m_analysisQueue.pop_front();
+		lock.unlock();
+
+		std::optional<Metadata> metadata = processFile(name);
+
+		lock.lock();
+		m_analysisPending.erase(name);
+
+		if (metadata)
+		{
+			m_metadata[name] = std::move(*metadata);
+
+			lock.unlock();
+			m_fileListChangedSignal();
+			lock.lock();
+		}
+	}
+}
+
+std::optional<FileManager::Metadata> FileManager::processFile(const std::string& name)
+{
+	const std::string path = getFilePath(name);
+	boost::system::error_code ec;
+	Metadata metadata;
+
+	// The file may be replaced meanwhile, and the upload doesn't queue it again while this is pending
+	while (true)
+	{
+		metadata.size = boost::filesystem::file_size(path, ec);
+		if (!ec)
+			metadata.mtime = boost::filesystem::last_write_time(path, ec);
+		if (ec)
+		{
+			// Deleted meanwhile, don't leave anything derived behind
+			removeSidecars(path);
+			return std::nullopt;
+		}
+
+		try
+		{
+			SlicedGCodeSource sliced(path.c_str());
+		}
+		catch (const std::exception&)
+		{
+			try
+			{
+				SlicedGCodeSource::build(path.c_str());
+			}
+			catch (const std::exception& e)
+			{
+				// Print jobs will read the .gcode file directly
+				BOOST_LOG_TRIVIAL(warning) << "Failed to pre-slice " << path << ": " << e.what();
+			}
+		}
+
+		try
+		{
+			metadata.summary = summarize(loadAnalysis(path));
+		}
+		catch (const std::exception& e)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Failed to analyze " << path << ": " << e.what();
+			metadata.summary = nlohmann::json { { "error", e.what() } };
+		}
+
+		const uint64_t size = boost::filesystem::file_size(path, ec);
+		if (!ec && size == metadata.size && uint64_t(boost::filesystem::last_write_time(path, ec)) == metadata.mtime && !ec)
+			return metadata;
+	}
 }
 
 std::string FileManager::getFilePath(std::string_view name)
@@ -74,6 +474,23 @@ std::vector<FileManager::FileInfo> FileManager::listFiles()
 		}
 	}
 
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (FileInfo& fi : rv)
+		{
+			auto it = m_metadata.find(fi.name);
+
+			if (it != m_metadata.end() && it->second.size == fi.length && it->second.mtime == uint64_t(fi.modifiedTime))
+				fi.metadata = it->second.summary;
+			else
+			{
+				// Put there by other means than an upload, or changed since
+				enqueueAnalysis(fi.name);
+			}
+		}
+	}
+
 	// Last modified first
 	std::sort(rv.begin(), rv.end(), [](const FileInfo& f1, const FileInfo& f2) {
 		return f1.modifiedTime > f2.modifiedTime;
@@ -91,7 +508,202 @@ bool FileManager::deleteFile(std::string_view name)
 	
 	if (!boost::filesystem::remove(path))
 		return false;
+
+	removeSidecars(path);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_metadata.erase(std::string(name));
+	}
 	
 	m_fileListChangedSignal();
 	return true;
 }
+
+void FileManager::removeSidecars(const std::string& path)
+{
+	boost::system::error_code ec;
+	boost::filesystem::remove(SlicedGCodeSource::sidecarPath(path), ec);
+	boost::filesystem::remove(analysisPath(path), ec);
+	boost::filesystem::remove(thumbnailPath(path), ec);
+}
+
+std::string FileManager::analysisPath(std::string_view gcodePath)
+{
+	return std::string(gcodePath) + ".analysis";
+}
+
+std::string FileManager::thumbnailPath(std::string_view gcodePath)
+{
+	return std::string(gcodePath) + ".thumbnail.png";
+}
+
+void FileManager::post(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+	}
+	m_cv.notify_one();
+}
+
+std::optional<nlohmann::json> FileManager::getAnalysis(std::string_view name)
+{
+	const std::string path = getFilePath(name);
+
+	if (std::optional<nlohmann::json> cached = cachedAnalysis(path))
+		return cached;
+
+	const std::string key(name);
+	const uint64_t size = boost::filesystem::file_size(path);
+	const uint64_t mtime = boost::filesystem::last_write_time(path);
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Analyzed as it is now, but without a cache to show for it
+	auto it = m_metadata.find(key);
+	if (it != m_metadata.end() && it->second.size == size && it->second.mtime == mtime && it->second.summary.contains("error"))
+		throw std::runtime_error(it->second.summary["error"].get<std::string>());
+
+	// Someone's waiting for this one
+	enqueueAnalysis(key, true);
+	return std::nullopt;
+}
+
+std::optional<nlohmann::json> FileManager::cachedAnalysis(const std::string& path)
+{
+	const uint64_t size = boost::filesystem::file_size(path);
+	const uint64_t mtime = boost::filesystem::last_write_time(path);
+
+	std::ifstream cache(analysisPath(path));
+	nlohmann::json cached = nlohmann::json::parse(cache, nullptr, false);
+
+	if (cached.is_object() && cached.value("version", 0) == ANALYSIS_VERSION
+		&& cached.value("source_size", uint64_t(0)) == size && cached.value("source_mtime", uint64_t(0)) == mtime)
+	{
+		return cached;
+	}
+
+	return std::nullopt;
+}
+
+nlohmann::json FileManager::loadAnalysis(const std::string& path)
+{
+	if (std::optional<nlohmann::json> cached = cachedAnalysis(path))
+		return std::move(*cached);
+
+	const std::string cachePath = analysisPath(path);
+	const uint64_t size = boost::filesystem::file_size(path);
+	const uint64_t mtime = boost::filesystem::last_write_time(path);
+
+	nlohmann::json result = analyze(path);
+	result["version"] = ANALYSIS_VERSION;
+	result["source_size"] = size;
+	result["source_mtime"] = mtime;
+
+	// The queue and start points may be writing the same cache
+	const boost::filesystem::path tempPath = boost::filesystem::unique_path(cachePath + ".%%%%%%");
+	{
+		std::ofstream cache(tempPath.string(), std::ios_base::out | std::ios_base::trunc);
+		cache << result;
+
+		if (!cache)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Cannot write " << cachePath;
+			return result;
+		}
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::rename(tempPath, cachePath, ec);
+	if (ec)
+		boost::filesystem::remove(tempPath, ec);
+
+	return result;
+}
+
+FileManager::StartPoint FileManager::layerStartPoint(std::string_view name, size_t layer)
+{
+	const nlohmann::json analysis = loadAnalysis(getFilePath(name));
+	const nlohmann::json& layers = analysis.at("layers");
+
+	if (layer >= layers.size())
+		throw std::out_of_range("No such layer");
+
+	return { layers[layer].at("offset").get<uint64_t>(), stateFromJson(layers[layer].at("state")) };
+}
+
+FileManager::StartPoint FileManager::offsetStartPoint(std::string_view name, uint64_t offset)
+{
+	const std::string path = getFilePath(name);
+
+	if (offset >= boost::filesystem::file_size(path))
+		throw std::out_of_range("Offset past the end of the file");
+
+	boost::iostreams::mapped_file_source mapping(path);
+	if (!mapping.is_open())
+		throw std::runtime_error("Cannot read file");
+
+	const char* data = mapping.data();
+	while (offset > 0 && data[offset - 1] != '\n')
+		offset--;
+
+	// Fast enough not to need an index of its own
+	GCodeAnalyzer analyzer;
+	analyzer.feed(data, offset);
+
+	return { offset, analyzer.state() };
+}
+
+nlohmann::json FileManager::analyze(const std::string& path)
+{
+	GCodeAnalyzer analyzer;
+	std::string hash = contentHash(nullptr, 0);
+	nlohmann::json thumbnail;
+
+	// Empty files cannot be mapped
+	if (boost::filesystem::file_size(path) > 0)
+	{
+		boost::iostreams::mapped_file_source mapping(path);
+		if (!mapping.is_open())
+			throw std::runtime_error("Cannot read file");
+
+		analyzer.feed(mapping.data(), mapping.size());
+		hash = contentHash(mapping.data(), mapping.size());
+		thumbnail = extractThumbnail(std::string_view(mapping.data(), mapping.size()), thumbnailPath(path));
+	}
+
+	// The printer's own limits are only known once it prints the file, see PrintJob
+	nlohmann::json estimatedTime;
+	PrintTimeEstimator estimator { MotionLimits() };
+	std::shared_ptr<GCodeSource> source = GCodeSource::open(path.c_str());
+
+	if (estimator.build(*source))
+		estimatedTime = estimator.totalTime();
+
+	const GCodeAnalysis& analysis = analyzer.finish();
+	nlohmann::json layers = nlohmann::json::array();
+
+	for (const GCodeAnalysis::Layer& layer : analysis.layers)
+	{
+		layers.push_back({
+			{ "z", layer.z },
+			{ "offset", layer.offset },
+			{ "moves", layer.moves },
+			{ "filament", layer.filament },
+			{ "state", stateToJson(layer.state) }
+		});
+	}
+
+	return nlohmann::json {
+		{ "layers", layers },
+		{ "min", { analysis.min[0], analysis.min[1], analysis.min[2] } },
+		{ "max", { analysis.max[0], analysis.max[1], analysis.max[2] } },
+		{ "filament", analysis.filament },
+		{ "extrusion_moves", analysis.extrusionMoves },
+		{ "travel_moves", analysis.travelMoves },
+		{ "lines", analysis.lines },
+		{ "estimated_time", estimatedTime },
+		{ "hash", hash },
+		{ "thumbnail", thumbnail }
+	};
+}
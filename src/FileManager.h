@@ -6,17 +6,61 @@
 #include <string_view>
 #include <ctime>
 #include <vector>
+#include <optional>
+#include <deque>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "nlohmann/json.hpp"
+#include "wasm/gcode-analyzer/GCodeAnalyzer.h"
 
 class FileManager
 {
 public:
-	FileManager(std::string_view directory);
+	// Files are analyzed on analysisThreads threads of the manager's own
+	FileManager(std::string_view directory, int analysisThreads = 1);
+	// Waits for the running analyses, queued ones are redone on the next start
+	~FileManager();
 
+	FileManager(const FileManager&) = delete;
+	FileManager& operator=(const FileManager&) = delete;
+
+	// Files are written next to the storage first, synced and then renamed into place
 	std::string saveFile(std::string_view, const void* contents, size_t length);
+	// otherfile is moved into place if it's in uploadDirectory(), copied otherwise
 	std::string saveFile(std::string_view, std::string_view otherfile);
+	// Where request bodies should be spooled so that saving them doesn't copy them
+	std::string uploadDirectory() const;
 	std::string getFilePath(std::string_view name);
 	bool deleteFile(std::string_view name);
 
+	// Layers, extents, filament use, estimated time and hash of the file, cached next to it.
+	// Files are analyzed in the background, this is empty until that's happened and moves the file
+	// to the front of the queue then. Throws if the file cannot be read or analyzed.
+	std::optional<nlohmann::json> getAnalysis(std::string_view name);
+	static std::string analysisPath(std::string_view gcodePath);
+	// The largest PNG thumbnail embedded by the slicer, if there was one
+	static std::string thumbnailPath(std::string_view gcodePath);
+
+	// Where a print of the file can start other than at its beginning, see PrintJob::setStartPoint().
+	// These read and may analyze the file, call them on the analysis threads through post().
+	// Throws std::out_of_range if there's no such layer or offset.
+	struct StartPoint
+	{
+		uint64_t offset; // Start of a line
+		GCodeAnalysis::State state; // What the lines before it leave the printer in
+	};
+	// Per the layer index in the analysis
+	StartPoint layerStartPoint(std::string_view name, size_t layer);
+	// Offsets within a line are moved back to its start
+	StartPoint offsetStartPoint(std::string_view name, uint64_t offset);
+
+	// Runs task on an analysis thread ahead of the queued analyses. Dropped if the manager is destroyed first.
+	void post(std::function<void()> task);
+
 	boost::signals2::signal<void()>& fileListChangedSignal() { return m_fileListChangedSignal; }
 
 	struct FileInfo
@@ -24,11 +68,45 @@ public:
 		std::string name;
 		size_t length;
 		time_t modifiedTime;
+		nlohmann::json metadata; // Summary of the analysis, null until it's done
 	};
 	std::vector<FileInfo> listFiles();
+private:
+	// Syncs the file at tempPath and renames it over the file called name
+	std::string commitFile(std::string_view name, const std::string& tempPath);
+	static nlohmann::json analyze(const std::string& path);
+	// Empty unless the cached analysis is of the file as it is now
+	static std::optional<nlohmann::json> cachedAnalysis(const std::string& path);
+	// The cached analysis, or a new one that's cached then
+	static nlohmann::json loadAnalysis(const std::string& path);
+	// Removes what's been derived from the file
+	static void removeSidecars(const std::string& path);
+
+	// Queues the file for analysis unless it's already being analyzed, m_mutex must be held.
+	// Urgent ones go to the front of the queue, even if they've been queued before.
+	void enqueueAnalysis(const std::string& name, bool urgent = false);
+	void analysisWorker();
+	struct Metadata
+	{
+		uint64_t size, mtime; // Of the file analyzed
+		nlohmann::json summary;
+	};
+	// Pre-slices and analyzes the file. Empty if the file is gone.
+	std::optional<Metadata> processFile(const std::string& name);
 private:
 	boost::filesystem::path m_path;
 	boost::signals2::signal<void()> m_fileListChangedSignal;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::string> m_analysisQueue;
+	std::deque<std::function<void()>> m_tasks;
+	// Queued or being analyzed
+	std::set<std::string> m_analysisPending;
+	// Per file name
+	std::map<std::string, Metadata> m_metadata;
+	bool m_stopping = false;
+	std::vector<std::thread> m_workers;
 };
 
 #endif
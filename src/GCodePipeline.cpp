@@ -0,0 +1,468 @@
+#include "GCodePipeline.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <boost/log/trivial.hpp>
+
+std::string_view TextArena::store(std::string_view text)
+{
+	if (m_blocks.empty() || m_used + text.length() > m_blocks.back().size)
+	{
+		// Oversized blocks for the odd long line aren't kept for reuse
+		if (!m_spare.empty() && text.length() <= BLOCK_SIZE)
+		{
+			m_blocks.push_back(std::move(m_spare.back()));
+			m_spare.pop_back();
+		}
+		else
+		{
+			const size_t size = std::max(BLOCK_SIZE, text.length());
+			m_blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size, NOT_EMITTED });
+		}
+		m_used = 0;
+	}
+
+	Block& block = m_blocks.back();
+	char* p = block.data.get() + m_used;
+
+	std::memcpy(p, text.data(), text.length());
+	m_used += text.length();
+	block.lastLine = NOT_EMITTED;
+
+	return std::string_view(p, text.length());
+}
+
+void TextArena::emitted(size_t lines)
+{
+	// Blocks written since the last call are the last ones
+	for (auto it = m_blocks.rbegin(); it != m_blocks.rend() && it->lastLine == NOT_EMITTED; ++it)
+		it->lastLine = lines;
+}
+
+void TextArena::release(size_t consumed, size_t retain)
+{
+	// The last block is still being filled
+	while (m_blocks.size() > 1)
+	{
+		Block& block = m_blocks.front();
+
+		if (block.lastLine == NOT_EMITTED || consumed < block.lastLine || consumed - block.lastLine < retain)
+			break;
+
+		if (block.size == BLOCK_SIZE)
+			m_spare.push_back(std::move(block));
+		m_blocks.pop_front();
+	}
+}
+
+size_t TextArena::allocated() const
+{
+	size_t rv = 0;
+
+	for (const Block& block : m_blocks)
+		rv += block.size;
+	for (const Block& block : m_spare)
+		rv += block.size;
+
+	return rv;
+}
+
+static std::string_view trim(std::string_view line)
+{
+	while (!line.empty() && line.front() == ' ')
+		line.remove_prefix(1);
+	while (!line.empty() && line.back() == ' ')
+		line.remove_suffix(1);
+	return line;
+}
+
+// Up to 5 decimals, without trailing zeros
+static std::string_view formatNumber(char (&buf)[32], double value)
+{
+	int len = std::snprintf(buf, sizeof(buf), "%.5f", value);
+
+	while (len > 0 && buf[len-1] == '0')
+		len--;
+	if (len > 0 && buf[len-1] == '.')
+		len--;
+
+	// Avoid "-0"
+	if (len == 2 && buf[0] == '-' && buf[1] == '0')
+		return std::string_view("0");
+
+	return std::string_view(buf, len);
+}
+
+// line with the parameter text (a view into line) replaced by letter + value
+static std::string_view replaceParam(std::string_view line, std::string_view param, double value, std::string& scratch, TextArena& arena)
+{
+	char buf[32];
+	const size_t offset = param.data() - line.data();
+
+	scratch.assign(line.data(), offset);
+	scratch += param[0];
+	scratch.append(formatNumber(buf, value));
+	scratch.append(line.substr(offset + param.length()));
+
+	return arena.store(scratch);
+}
+
+static bool isMove(std::string_view line)
+{
+	return isGCodeCommand(line, "G0") || isGCodeCommand(line, "G1") || isGCodeCommand(line, "G2") || isGCodeCommand(line, "G3");
+}
+
+void StripCommentsStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena)
+{
+	for (const GCodeLine& line : in)
+	{
+		if (line.text.find('(') == std::string_view::npos)
+		{
+			out.push_back(line);
+			continue;
+		}
+
+		m_scratch.clear();
+
+		bool inComment = false;
+		for (char c : line.text)
+		{
+			if (c == '(')
+				inComment = true;
+			else if (c == ')' && inComment)
+				inComment = false;
+			else if (!inComment)
+				m_scratch += c;
+		}
+
+		std::string_view text = trim(m_scratch);
+		if (!text.empty())
+			out.push_back({ arena.store(text), -1, line.position });
+	}
+}
+
+void StripLineNumbersStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena&)
+{
+	for (GCodeLine line : in)
+	{
+		std::string_view text = line.text;
+
+		if (!text.empty() && text[0] == 'N')
+		{
+			size_t i = 1;
+			while (i < text.length() && text[i] >= '0' && text[i] <= '9')
+				i++;
+			if (i > 1 && (i == text.length() || text[i] == ' '))
+				text.remove_prefix(i);
+		}
+
+		const size_t star = text.rfind('*');
+		if (star != std::string_view::npos && text.find_first_not_of("0123456789", star + 1) == std::string_view::npos)
+			text.remove_suffix(text.length() - star);
+
+		text = trim(text);
+
+		if (text.length() != line.text.length())
+		{
+			line.text = text;
+			line.checksum = -1;
+		}
+
+		// Lines carrying just a number are gone now
+		if (!text.empty())
+			out.push_back(line);
+	}
+}
+
+ProgressStage::ProgressStage()
+{
+	for (int i = 0; i <= 100; i++)
+		m_commands.push_back("M73 P" + std::to_string(i));
+}
+
+void ProgressStage::reset(size_t offset, size_t sourceSize)
+{
+	m_size = sourceSize;
+	m_lastPosition = offset;
+	m_percent = -1;
+}
+
+void ProgressStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena&)
+{
+	for (const GCodeLine& line : in)
+	{
+		// Reported before the line that was reached
+		const int percent = m_size ? int(uint64_t(m_lastPosition) * 100 / m_size) : 0;
+
+		if (percent > m_percent)
+		{
+			m_percent = percent;
+			out.push_back({ m_commands[percent], -1, m_lastPosition });
+		}
+
+		out.push_back(line);
+		m_lastPosition = line.position;
+	}
+}
+
+ScaleParamStage::ScaleParamStage(char param, double factor)
+: m_param(param), m_factor(factor)
+{
+}
+
+void ScaleParamStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena)
+{
+	for (GCodeLine line : in)
+	{
+		// Flow changes have to apply to E resets too
+		if (isMove(line.text) || (m_param == 'E' && isGCodeCommand(line.text, "G92")))
+		{
+			std::string_view param;
+			double value = 0;
+
+			forEachGCodeParam(line.text, [&](char letter, double v, std::string_view text) {
+				if (letter == m_param)
+				{
+					param = text;
+					value = v;
+				}
+				return true;
+			});
+
+			if (!param.empty())
+			{
+				line.text = replaceParam(line.text, param, value * m_factor, m_scratch, arena);
+				line.checksum = -1;
+			}
+		}
+		else if (m_param == 'F' && isGCodeCommand(line.text, "M73"))
+		{
+			std::string_view param;
+			double value = 0;
+
+			forEachGCodeParam(line.text, [&](char letter, double v, std::string_view text) {
+				if (letter == 'R')
+				{
+					param = text;
+					value = v;
+				}
+				return true;
+			});
+
+			// In whole minutes, like the slicer put it
+			if (!param.empty())
+			{
+				line.text = replaceParam(line.text, param, std::round(value / m_factor), m_scratch, arena);
+				line.checksum = -1;
+			}
+		}
+
+		out.push_back(line);
+	}
+}
+
+void ZOffsetStage::process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena)
+{
+	for (GCodeLine line : in)
+	{
+		if (isGCodeCommand(line.text, "G90"))
+			m_absolute = true;
+		else if (isGCodeCommand(line.text, "G91"))
+			m_absolute = false;
+		// G92 declares where the nozzle is in file coordinates, the offset applies there as well
+		else if ((m_absolute && isMove(line.text)) || isGCodeCommand(line.text, "G92"))
+		{
+			std::string_view param;
+			double value = 0;
+
+			forEachGCodeParam(line.text, [&](char letter, double v, std::string_view text) {
+				if (letter == 'Z')
+				{
+					param = text;
+					value = v;
+				}
+				return true;
+			});
+
+			if (!param.empty())
+			{
+				line.text = replaceParam(line.text, param, value + m_offset, m_scratch, arena);
+				line.checksum = -1;
+			}
+		}
+
+		out.push_back(line);
+	}
+}
+
+PipelineGCodeSource::PipelineGCodeSource(std::shared_ptr<GCodeSource> source, std::vector<std::unique_ptr<GCodeStage>> stages,
+	size_t retainLines)
+: m_source(std::move(source)), m_stages(std::move(stages)), m_retainLines(retainLines)
+{
+	m_position = m_source->position();
+}
+
+PipelineGCodeSource::~PipelineGCodeSource()
+{
+	stopWorker();
+}
+
+void PipelineGCodeSource::seek(size_t offset)
+{
+	stopWorker();
+
+	m_source->seek(offset);
+	m_position = m_source->position();
+
+	for (auto& stage : m_stages)
+		stage->reset(m_position, m_source->size());
+
+	startWorker();
+}
+
+void PipelineGCodeSource::startWorker()
+{
+	m_finished = m_stopping = false;
+	m_error = nullptr;
+	m_worker = std::thread(&PipelineGCodeSource::run, this);
+}
+
+void PipelineGCodeSource::stopWorker()
+{
+	if (!m_worker.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cond.notify_all();
+	m_worker.join();
+
+	// Whatever has been processed ahead is stale now
+	for (auto& batch : m_batches)
+		m_spare.push_back(std::move(batch));
+	m_batches.clear();
+
+	m_current.clear();
+	m_next = 0;
+}
+
+std::vector<GCodeLine> PipelineGCodeSource::spareBatch()
+{
+	std::vector<GCodeLine> batch;
+
+	if (!m_spare.empty())
+	{
+		batch = std::move(m_spare.front());
+		m_spare.pop_front();
+	}
+
+	batch.clear();
+	return batch;
+}
+
+bool PipelineGCodeSource::nextLine(std::string_view& line)
+{
+	if (!m_worker.joinable())
+		seek(m_position);
+
+	while (m_next >= m_current.size())
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_spare.push_back(std::move(m_current));
+		m_current.clear();
+		m_next = 0;
+		m_consumed = m_read;
+
+		m_cond.wait(lock, [this]() { return !m_batches.empty() || m_finished || m_error; });
+
+		if (m_error)
+			std::rethrow_exception(m_error);
+		if (m_batches.empty())
+			return false;
+
+		m_current = std::move(m_batches.front());
+		m_batches.pop_front();
+		m_cond.notify_all();
+	}
+
+	const GCodeLine& next = m_current[m_next++];
+
+	line = next.text;
+	m_checksum = next.checksum;
+	m_position = next.position;
+	m_read++;
+
+	return true;
+}
+
+void PipelineGCodeSource::run()
+{
+	std::vector<GCodeLine> batch, scratch;
+
+	try
+	{
+		bool eof = false;
+
+		while (!eof)
+		{
+			size_t consumed;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				batch = spareBatch();
+				scratch = spareBatch();
+				consumed = m_consumed;
+			}
+
+			// Lines discarded by seek() were never read, which only delays their blocks
+			m_arena.release(consumed, m_retainLines);
+
+			std::string_view text;
+			while (batch.size() < BATCH_SIZE)
+			{
+				if (!m_source->nextLine(text))
+				{
+					eof = true;
+					break;
+				}
+				batch.push_back({ text, m_source->lineChecksum(), m_source->position() });
+			}
+
+			for (auto& stage : m_stages)
+			{
+				scratch.clear();
+				stage->process(batch, scratch, m_arena);
+				if (eof)
+					stage->flush(scratch, m_arena);
+				std::swap(batch, scratch);
+			}
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_spare.push_back(std::move(scratch));
+			m_cond.wait(lock, [this]() { return m_batches.size() < MAX_BATCHES || m_stopping; });
+
+			if (m_stopping)
+				return;
+
+			m_emitted += batch.size();
+			m_arena.emitted(m_emitted);
+
+			if (!batch.empty())
+				m_batches.push_back(std::move(batch));
+			m_finished = eof;
+			m_cond.notify_all();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		BOOST_LOG_TRIVIAL(error) << "G-code pipeline failed: " << e.what();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_error = std::current_exception();
+		m_cond.notify_all();
+	}
+}
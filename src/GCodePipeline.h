@@ -0,0 +1,209 @@
+#ifndef _GCODEPIPELINE_H
+#define _GCODEPIPELINE_H
+#include <string_view>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "GCodeSource.h"
+#include "wasm/gcode-analyzer/GCodeScanner.h"
+
+// A line on its way from the .gcode file to the printer
+struct GCodeLine
+{
+	std::string_view text;
+	int checksum; // XOR of text, -1 if unknown
+	size_t position; // Just past the source line in the .gcode file
+};
+
+// Storage for lines generated by stages, in blocks that are reused once the lines stored
+// in them are far enough behind the pipeline's consumer.
+class TextArena
+{
+public:
+	std::string_view store(std::string_view text);
+	// What's been stored since the last call belongs to the lines numbered below lines
+	void emitted(size_t lines);
+	// Reuses the blocks of lines at least retain lines before the line numbered consumed
+	void release(size_t consumed, size_t retain);
+	// Bytes allocated, including the blocks waiting for reuse
+	size_t allocated() const;
+private:
+	static constexpr size_t BLOCK_SIZE = 64*1024;
+	static constexpr size_t NOT_EMITTED = size_t(-1);
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+		size_t lastLine; // The lines referring to it are numbered below
+	};
+	std::deque<Block> m_blocks, m_spare;
+	size_t m_used = 0;
+};
+
+// One step of a print job's G-code transformation.
+// Stages work on batches and may drop, change or insert lines.
+class GCodeStage
+{
+public:
+	virtual ~GCodeStage() {}
+
+	// out is empty on entry. Changed lines should be stored in arena.
+	// Lines held back for a later call have to be stored in arena again then, it only keeps
+	// what's stored for as long as the lines output by the same call need it.
+	virtual void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) = 0;
+	// End of the file, emit whatever has been held back
+	virtual void flush(std::vector<GCodeLine>& /*out*/, TextArena& /*arena*/) {}
+	// The job starts over from offset
+	virtual void reset(size_t /*offset*/, size_t /*sourceSize*/) {}
+	// A stage with the same settings, as it was before processing anything
+	virtual std::unique_ptr<GCodeStage> clone() const = 0;
+};
+
+// Strips "(...)" comments, ';' comments are already gone
+class StripCommentsStage : public GCodeStage
+{
+public:
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<StripCommentsStage>(); }
+private:
+	std::string m_scratch;
+};
+
+// Strips line numbers and checksums present in the file, the printer adds its own
+class StripLineNumbersStage : public GCodeStage
+{
+public:
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<StripLineNumbersStage>(); }
+};
+
+// Inserts "M73 P<percent>" whenever the progress through the file reaches the next percent
+class ProgressStage : public GCodeStage
+{
+public:
+	ProgressStage();
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	void reset(size_t offset, size_t sourceSize) override;
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<ProgressStage>(); }
+private:
+	std::vector<std::string> m_commands;
+	size_t m_size = 0, m_lastPosition = 0;
+	int m_percent = -1;
+};
+
+// Multiplies a parameter of the given commands, e.g. F for feedrate or E for flow.
+// Feedrate changes divide the slicer's M73 R remaining time as well.
+class ScaleParamStage : public GCodeStage
+{
+public:
+	ScaleParamStage(char param, double factor);
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<ScaleParamStage>(m_param, m_factor); }
+private:
+	const char m_param;
+	const double m_factor;
+	std::string m_scratch;
+};
+
+// Shifts absolute Z coordinates
+class ZOffsetStage : public GCodeStage
+{
+public:
+	ZOffsetStage(double offset) : m_offset(offset) {}
+	void process(const std::vector<GCodeLine>& in, std::vector<GCodeLine>& out, TextArena& arena) override;
+	void reset(size_t /*offset*/, size_t /*sourceSize*/) override { m_absolute = true; }
+	std::unique_ptr<GCodeStage> clone() const override { return std::make_unique<ZOffsetStage>(m_offset); }
+private:
+	const double m_offset;
+	bool m_absolute = true;
+	std::string m_scratch;
+};
+
+// Runs the stages on a worker thread, a few batches ahead of the printer
+class PipelineGCodeSource : public GCodeSource
+{
+public:
+	// Lines changed by the stages stay valid until retainLines more lines have been read,
+	// such as the printer's resend history and the job feed
+	PipelineGCodeSource(std::shared_ptr<GCodeSource> source, std::vector<std::unique_ptr<GCodeStage>> stages,
+		size_t retainLines = RETAIN_ALL);
+	~PipelineGCodeSource();
+
+	// Waits for the worker if it's behind, rethrows its errors
+	bool nextLine(std::string_view& line) override;
+	int lineChecksum() const override { return m_checksum; }
+	size_t position() const override { return m_position; }
+	void seek(size_t offset) override;
+	size_t size() const override { return m_source->size(); }
+
+	static constexpr size_t BATCH_SIZE = 256;
+	static constexpr size_t MAX_BATCHES = 8;
+	static constexpr size_t RETAIN_ALL = size_t(-1);
+private:
+	void startWorker();
+	void stopWorker();
+	void run();
+	std::vector<GCodeLine> spareBatch();
+private:
+	std::shared_ptr<GCodeSource> m_source;
+	std::vector<std::unique_ptr<GCodeStage>> m_stages;
+	// Only touched by the worker
+	TextArena m_arena;
+	const size_t m_retainLines;
+	size_t m_emitted = 0;
+
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	// Processed batches, and emptied ones for reuse
+	std::deque<std::vector<GCodeLine>> m_batches, m_spare;
+	bool m_finished = false, m_stopping = false;
+	// Lines read by the consumer up to its last batch
+	size_t m_consumed = 0;
+	std::exception_ptr m_error;
+
+	// Consumer side
+	std::vector<GCodeLine> m_current;
+	size_t m_next = 0;
+	int m_checksum = -1;
+	size_t m_position = 0;
+	size_t m_read = 0;
+};
+
+// Calls fn(letter, value, text) for every "X1.5" style parameter following the command code.
+// Returns false if a parameter isn't a letter followed by a number or fn returns false.
+template <typename Fn>
+bool forEachGCodeParam(std::string_view line, Fn&& fn)
+{
+	size_t pos = line.find(' ');
+
+	while (pos != std::string_view::npos)
+	{
+		const size_t start = pos + 1;
+		pos = line.find(' ', start);
+
+		std::string_view param = line.substr(start, (pos == std::string_view::npos) ? pos : pos - start);
+		if (param.empty())
+			continue;
+
+		double value;
+		if (!gcodescan::parseNumber(param.substr(1), value) || !fn(param[0], value, param))
+			return false;
+	}
+
+	return true;
+}
+
+// Whether line is the given command, e.g. "G1"
+inline bool isGCodeCommand(std::string_view line, std::string_view code)
+{
+	return line.length() >= code.length() && line.compare(0, code.length(), code) == 0
+		&& (line.length() == code.length() || line[code.length()] == ' ');
+}
+
+#endif
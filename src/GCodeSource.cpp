@@ -0,0 +1,329 @@
+#include "GCodeSource.h"
+#include "wasm/gcode-analyzer/GCodeScanner.h"
+#include <stdexcept>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <ctype.h>
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t mtimeNs(const struct stat& st)
+{
+	return uint64_t(st.st_mtim.tv_sec) * 1000000000 + uint64_t(st.st_mtim.tv_nsec);
+}
+
+MappedGCodeSource::MappedGCodeSource(const char* filePath)
+{
+	const int fd = ::open(filePath, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		throw std::runtime_error("Cannot open GCODE file");
+
+	// The identity comes from the descriptor that gets mapped, the path may be replaced meanwhile
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Cannot open GCODE file");
+	}
+
+	m_size = st.st_size;
+	m_inode = st.st_ino;
+	m_mtime = mtimeNs(st);
+
+	// Empty files cannot be mapped
+	if (m_size > 0)
+	{
+		void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			throw std::runtime_error("Cannot open GCODE file");
+		}
+		m_data = static_cast<const char*>(data);
+	}
+
+	::close(fd);
+}
+
+MappedGCodeSource::~MappedGCodeSource()
+{
+	if (m_data)
+		::munmap(const_cast<char*>(m_data), m_size);
+}
+
+std::string_view MappedGCodeSource::stripLine(std::string_view line)
+{
+	const char* comment = gcodescan::findEither(line.data(), line.data() + line.length(), ';', ';');
+	return gcodescan::trim(line.substr(0, comment - line.data()));
+}
+
+bool MappedGCodeSource::nextLine(std::string_view& line)
+{
+	const char* dataEnd = m_data + m_size;
+
+	while (m_position < m_size)
+	{
+		const char* start = m_data + m_position;
+		// One pass finds both the comment and the line end, unless there is a comment
+		const char* end = gcodescan::findEither(start, dataEnd, '\n', ';');
+		const char* next = end;
+
+		if (end != dataEnd && *end == ';')
+		{
+			next = static_cast<const char*>(std::memchr(end, '\n', dataEnd - end));
+			if (!next)
+				next = dataEnd;
+		}
+
+		m_position = (next == dataEnd) ? m_size : next - m_data + 1;
+
+		line = gcodescan::trim(std::string_view(start, end - start));
+		if (!line.empty())
+			return true;
+	}
+
+	return false;
+}
+
+void MappedGCodeSource::seek(size_t offset)
+{
+	m_position = std::min(offset, m_size);
+}
+
+static const char SLICED_MAGIC[8] = { 'D', 'P', 'S', 'L', 'I', 'C', 'E', 'D' };
+static constexpr uint32_t SLICED_VERSION = 2;
+static constexpr uint32_t SLICED_BLOCK_SIZE = 4096;
+
+std::shared_ptr<GCodeSource> GCodeSource::open(const char* filePath)
+{
+	try
+	{
+		return std::make_shared<SlicedGCodeSource>(filePath);
+	}
+	catch (const std::exception& e)
+	{
+		BOOST_LOG_TRIVIAL(debug) << "Not using pre-sliced G-code for " << filePath << ": " << e.what();
+	}
+
+	return std::make_shared<MappedGCodeSource>(filePath);
+}
+
+std::string SlicedGCodeSource::sidecarPath(std::string_view gcodePath)
+{
+	return std::string(gcodePath) + ".sliced";
+}
+
+static unsigned int xorChecksum(std::string_view text)
+{
+	unsigned int cs = 0;
+
+	for (char c : text)
+		cs ^= unsigned(c);
+
+	return cs & 0xff;
+}
+
+void SlicedGCodeSource::build(const char* gcodePath)
+{
+	const std::string path = sidecarPath(gcodePath);
+	const boost::filesystem::path tempPath = boost::filesystem::unique_path(path + ".%%%%%%");
+	boost::system::error_code ec;
+
+	try
+	{
+		write(gcodePath, tempPath.string());
+	}
+	catch (...)
+	{
+		boost::filesystem::remove(tempPath, ec);
+		throw;
+	}
+
+	boost::filesystem::rename(tempPath, path, ec);
+	if (ec)
+	{
+		boost::filesystem::remove(tempPath, ec);
+		throw std::runtime_error("Cannot write sidecar file");
+	}
+}
+
+void SlicedGCodeSource::write(const char* gcodePath, const std::string& path)
+{
+	MappedGCodeSource source(gcodePath);
+	std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+
+	if (!file.is_open())
+		throw std::runtime_error("Cannot open sidecar file for writing");
+
+	Header header = {};
+	std::memcpy(header.magic, SLICED_MAGIC, sizeof(header.magic));
+	header.version = SLICED_VERSION;
+	header.blockSize = SLICED_BLOCK_SIZE;
+	header.sourceSize = source.size();
+	header.sourceInode = source.inode();
+	header.sourceMtime = source.mtime();
+	header.blockCount = source.size() / SLICED_BLOCK_SIZE + 1;
+
+	// The line count is only known at the end
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// First pass: the line index
+	std::vector<uint64_t> blocks;
+	std::string_view line;
+	uint64_t textLength = 0;
+
+	blocks.reserve(header.blockCount);
+
+	while (source.nextLine(line))
+	{
+		Line entry = {};
+
+		if (line.length() > UINT16_MAX)
+			throw std::runtime_error("G-code line too long");
+		if (textLength + line.length() + 1 > UINT32_MAX)
+			throw std::runtime_error("G-code file too large");
+
+		entry.sourceEnd = source.position();
+		entry.textOffset = textLength;
+		entry.length = line.length();
+		entry.checksum = xorChecksum(line);
+
+		while (blocks.size() * SLICED_BLOCK_SIZE < entry.sourceEnd)
+			blocks.push_back(header.lineCount);
+
+		file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+		textLength += line.length() + 1;
+		header.lineCount++;
+	}
+
+	blocks.resize(header.blockCount, header.lineCount);
+	file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(uint64_t));
+
+	// Second pass: the lines themselves, newline-separated to aid debugging
+	header.textOffset = file.tellp();
+	source.seek(0);
+
+	while (source.nextLine(line))
+	{
+		file.write(line.data(), line.length());
+		file.put('\n');
+	}
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	file.flush();
+	if (file.bad())
+		throw std::runtime_error("Cannot write sidecar file");
+}
+
+SlicedGCodeSource::SlicedGCodeSource(const char* filePath)
+{
+	std::string path = sidecarPath(filePath);
+	boost::system::error_code ec;
+
+	if (!boost::filesystem::is_regular_file(path, ec))
+		throw std::runtime_error("No sidecar file");
+
+	m_mapping.open(path);
+
+	const char* data = m_mapping.data();
+	const size_t length = m_mapping.size();
+
+	if (length < sizeof(Header))
+		throw std::runtime_error("Truncated sidecar file");
+
+	m_header = reinterpret_cast<const Header*>(data);
+
+	if (std::memcmp(m_header->magic, SLICED_MAGIC, sizeof(SLICED_MAGIC)) != 0 || m_header->version != SLICED_VERSION)
+		throw std::runtime_error("Unsupported sidecar file");
+
+	// A whole second of mtime resolution would miss quick rewrites
+	struct stat st;
+	if (::stat(filePath, &st) != 0)
+		throw std::runtime_error("Cannot open GCODE file");
+
+	if (m_header->sourceSize != uint64_t(st.st_size) || m_header->sourceInode != uint64_t(st.st_ino)
+		|| m_header->sourceMtime != mtimeNs(st))
+	{
+		throw std::runtime_error("Outdated sidecar file");
+	}
+
+	const size_t indexEnd = sizeof(Header) + m_header->lineCount * sizeof(Line) + m_header->blockCount * sizeof(uint64_t);
+	if (indexEnd > m_header->textOffset || m_header->textOffset > length)
+		throw std::runtime_error("Truncated sidecar file");
+
+	m_lines = reinterpret_cast<const Line*>(data + sizeof(Header));
+	m_blocks = reinterpret_cast<const uint64_t*>(m_lines + m_header->lineCount);
+	m_text = data + m_header->textOffset;
+
+	if (m_header->lineCount > 0)
+	{
+		const Line& last = m_lines[m_header->lineCount - 1];
+		if (m_header->textOffset + last.textOffset + last.length > length)
+			throw std::runtime_error("Truncated sidecar file");
+	}
+}
+
+bool SlicedGCodeSource::nextLine(std::string_view& line)
+{
+	if (m_nextLine >= m_header->lineCount)
+		return false;
+
+	const Line& entry = m_lines[m_nextLine++];
+	line = std::string_view(m_text + entry.textOffset, entry.length);
+
+	return true;
+}
+
+int SlicedGCodeSource::lineChecksum() const
+{
+	if (m_nextLine == 0)
+		return -1;
+	return m_lines[m_nextLine - 1].checksum;
+}
+
+size_t SlicedGCodeSource::position() const
+{
+	if (m_nextLine == 0)
+		return 0;
+	return m_lines[m_nextLine - 1].sourceEnd;
+}
+
+size_t SlicedGCodeSource::size() const
+{
+	return m_header->sourceSize;
+}
+
+size_t SlicedGCodeSource::lineCount() const
+{
+	return m_header->lineCount;
+}
+
+void SlicedGCodeSource::seekLine(size_t line)
+{
+	m_nextLine = std::min<size_t>(line, m_header->lineCount);
+}
+
+void SlicedGCodeSource::seek(size_t offset)
+{
+	if (offset >= m_header->sourceSize)
+	{
+		m_nextLine = m_header->lineCount;
+		return;
+	}
+
+	// Start with the first line ending in this block and skip to the one containing offset
+	size_t line = m_blocks[offset / m_header->blockSize];
+	while (line < m_header->lineCount && m_lines[line].sourceEnd <= offset)
+		line++;
+
+	m_nextLine = line;
+}
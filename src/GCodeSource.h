@@ -0,0 +1,115 @@
+#ifndef _GCODESOURCE_H
+#define _GCODESOURCE_H
+#include <string>
+#include <string_view>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+// Where a PrintJob takes its G-code lines from.
+// Lines are returned stripped of comments and surrounding whitespace
+// and remain valid for as long as the source exists.
+class GCodeSource
+{
+public:
+	virtual ~GCodeSource() {}
+
+	// Uses the pre-sliced sidecar if there is an up-to-date one
+	static std::shared_ptr<GCodeSource> open(const char* filePath);
+
+	// Returns false at the end of the file
+	virtual bool nextLine(std::string_view& line) = 0;
+
+	// XOR of all characters of the last returned line, -1 if not precomputed
+	virtual int lineChecksum() const { return -1; }
+
+	// Byte offset in the original .gcode file just past the last returned line
+	virtual size_t position() const = 0;
+	virtual void seek(size_t offset) = 0;
+
+	// Size of the original .gcode file
+	virtual size_t size() const = 0;
+};
+
+// Reads a plain .gcode file mapped into memory
+class MappedGCodeSource : public GCodeSource
+{
+public:
+	MappedGCodeSource(const char* filePath);
+	~MappedGCodeSource();
+
+	MappedGCodeSource(const MappedGCodeSource&) = delete;
+	MappedGCodeSource& operator=(const MappedGCodeSource&) = delete;
+
+	bool nextLine(std::string_view& line) override;
+	size_t position() const override { return m_position; }
+	void seek(size_t offset) override;
+	size_t size() const override { return m_size; }
+
+	// Of the file that got mapped, even if the path has been replaced since
+	uint64_t inode() const { return m_inode; }
+	// Nanoseconds
+	uint64_t mtime() const { return m_mtime; }
+
+	// Removes the ';' comment and surrounding whitespace
+	static std::string_view stripLine(std::string_view line);
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0, m_position = 0;
+	uint64_t m_inode = 0, m_mtime = 0;
+};
+
+// Reads the compact sidecar file produced by build() at upload time.
+// It contains the comment-free lines along with a line index,
+// so that seeking by line or by source file offset takes constant time.
+class SlicedGCodeSource : public GCodeSource
+{
+public:
+	// Throws if the sidecar is missing or doesn't match the .gcode file
+	SlicedGCodeSource(const char* filePath);
+
+	bool nextLine(std::string_view& line) override;
+	int lineChecksum() const override;
+	size_t position() const override;
+	void seek(size_t offset) override;
+	size_t size() const override;
+
+	size_t lineCount() const;
+	void seekLine(size_t line);
+
+	static std::string sidecarPath(std::string_view gcodePath);
+	// Replaces the sidecar in one step, so that it may run while the file is being printed
+	static void build(const char* gcodePath);
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t blockSize;
+		uint64_t lineCount, blockCount;
+		uint64_t sourceSize, sourceInode, sourceMtime; // Modification time in nanoseconds
+		uint64_t textOffset;
+	};
+
+	struct Line
+	{
+		uint64_t sourceEnd; // Offset just past this line in the .gcode file
+		uint32_t textOffset; // Relative to Header::textOffset
+		uint16_t length;
+		uint8_t checksum;
+		uint8_t reserved;
+	};
+private:
+	static void write(const char* gcodePath, const std::string& path);
+private:
+	boost::iostreams::mapped_file_source m_mapping;
+	const Header* m_header;
+	const Line* m_lines;
+	// For each block of the .gcode file, the first line ending past the block start
+	const uint64_t* m_blocks;
+	const char* m_text;
+	size_t m_nextLine = 0;
+};
+
+#endif
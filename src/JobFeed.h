@@ -0,0 +1,42 @@
+#ifndef _JOBFEED_H
+#define _JOBFEED_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "SpscRing.h"
+
+// Lines a PrintJob hands over to the Printer ahead of time.
+// The job fills the ring, the printer's writer drains it whenever
+// there are no interactive commands waiting.
+class JobFeed
+{
+public:
+	struct Line
+	{
+		std::string_view text;
+		int checksum; // XOR of text, -1 if unknown
+		size_t position; // Just past this line in the .gcode file
+	};
+	typedef SpscRing<Line, 256> Ring;
+	typedef std::function<void(size_t position, const std::vector<std::string>& reply)> ConfirmCallback;
+
+	// owner keeps the memory the lines point to alive
+	JobFeed(std::shared_ptr<const void> owner, ConfirmCallback confirm)
+	: m_owner(std::move(owner)), m_confirm(std::move(confirm))
+	{
+	}
+
+	Ring& lines() { return m_lines; }
+	const std::shared_ptr<const void>& owner() const { return m_owner; }
+
+	// Called by the printer for every processed line, an empty reply indicates failure
+	void confirm(size_t position, const std::vector<std::string>& reply) { m_confirm(position, reply); }
+private:
+	Ring m_lines;
+	std::shared_ptr<const void> m_owner;
+	ConfirmCallback m_confirm;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "JobJournal.h"
+#include <cstring>
+#include <cstddef>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/log/trivial.hpp>
+
+static const char JOURNAL_MAGIC[8] = { 'D', 'P', 'J', 'O', 'U', 'R', 'N', 'L' };
+static constexpr uint32_t JOURNAL_VERSION = 1;
+
+namespace
+{
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t nameLength; // The name follows
+		uint64_t size;
+	};
+
+	struct Record
+	{
+		uint64_t offset;
+		int64_t when; // ms since the epoch
+		float hotend, bed;
+		uint8_t relative, relativeE;
+		uint8_t reserved[2];
+		uint32_t checksum; // Of the above, a torn record doesn't match
+	};
+	static_assert(sizeof(Record) == 32, "Unexpected Record padding");
+
+	uint32_t recordChecksum(const Record& record)
+	{
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(&record);
+		uint32_t hash = 2166136261u;
+
+		for (size_t i = 0; i < offsetof(Record, checksum); i++)
+			hash = (hash ^ p[i]) * 16777619u;
+
+		return hash;
+	}
+}
+
+JobJournal::JobJournal(std::string path, std::string_view name, uint64_t size, std::chrono::milliseconds interval)
+: m_path(std::move(path)), m_name(name), m_size(size), m_interval(interval)
+{
+	m_thread = std::thread(&JobJournal::run, this);
+}
+
+JobJournal::~JobJournal()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stopping = true;
+	lock.unlock();
+
+	m_cv.notify_one();
+	m_thread.join();
+}
+
+void JobJournal::record(const Entry& entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entry = entry;
+	m_dirty = true;
+}
+
+void JobJournal::discard()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_discarded = true;
+	lock.unlock();
+
+	m_cv.notify_one();
+}
+
+void JobJournal::run()
+{
+	// Opened on the first write, -2 after a failure
+	int fd = -1;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		const auto next = std::chrono::steady_clock::now() + m_interval;
+
+		m_cv.wait_until(lock, next, [&]() {
+			return m_stopping || m_discarded;
+		});
+
+		if (m_discarded)
+			break;
+
+		const bool stopping = m_stopping;
+
+		if (m_dirty && fd != -2)
+		{
+			const Entry entry = m_entry;
+			m_dirty = false;
+			lock.unlock();
+
+			if (fd == -1)
+			{
+				fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+
+				Header header = {};
+				std::memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+				header.version = JOURNAL_VERSION;
+				header.nameLength = m_name.length();
+				header.size = m_size;
+
+				std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+				data += m_name;
+
+				if (fd == -1 || ::write(fd, data.data(), data.length()) != ssize_t(data.length()))
+				{
+					BOOST_LOG_TRIVIAL(warning) << "Cannot write job journal " << m_path << ": " << ::strerror(errno);
+					if (fd != -1)
+						::close(fd);
+					fd = -2;
+				}
+			}
+
+			if (fd >= 0)
+				append(fd, entry);
+
+			lock.lock();
+		}
+
+		if (stopping)
+			break;
+	}
+
+	lock.unlock();
+
+	if (fd >= 0)
+		::close(fd);
+	if (m_discarded)
+		::unlink(m_path.c_str());
+}
+
+void JobJournal::append(int fd, const Entry& entry)
+{
+	Record record = {};
+
+	record.offset = entry.offset;
+	record.when = std::chrono::duration_cast<std::chrono::milliseconds>(entry.when.time_since_epoch()).count();
+	record.hotend = entry.hotend;
+	record.bed = entry.bed;
+	record.relative = entry.relative;
+	record.relativeE = entry.relativeE;
+	record.checksum = recordChecksum(record);
+
+	if (::write(fd, &record, sizeof(record)) != ssize_t(sizeof(record)) || ::fdatasync(fd) != 0)
+		BOOST_LOG_TRIVIAL(warning) << "Cannot write job journal " << m_path << ": " << ::strerror(errno);
+}
+
+std::optional<JobJournal::Contents> JobJournal::read(const std::string& path)
+{
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	Header header;
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return std::nullopt;
+	if (std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 || header.version != JOURNAL_VERSION || header.nameLength > 4096)
+		return std::nullopt;
+
+	Contents contents;
+	contents.name.resize(header.nameLength);
+	contents.size = header.size;
+
+	if (!file.read(&contents.name[0], header.nameLength))
+		return std::nullopt;
+
+	// The last intact record wins, a power loss may have torn the one after it
+	const std::streamoff start = file.tellg();
+	file.seekg(0, std::ios_base::end);
+	const std::streamoff end = file.tellg();
+
+	for (std::streamoff count = (end - start) / std::streamoff(sizeof(Record)); count > 0; count--)
+	{
+		Record record;
+
+		file.seekg(start + (count - 1) * std::streamoff(sizeof(Record)));
+		if (!file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+			return std::nullopt;
+		if (record.checksum != recordChecksum(record))
+			continue;
+
+		Entry& entry = contents.last;
+		entry.offset = record.offset;
+		entry.when = std::chrono::system_clock::time_point(std::chrono::milliseconds(record.when));
+		entry.hotend = record.hotend;
+		entry.bed = record.bed;
+		entry.relative = record.relative;
+		entry.relativeE = record.relativeE;
+
+		return contents;
+	}
+
+	return std::nullopt;
+}
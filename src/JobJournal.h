@@ -0,0 +1,62 @@
+#ifndef _JOBJOURNAL_H
+#define _JOBJOURNAL_H
+#include <string>
+#include <string_view>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+// Append-only record of how far a print job has got, so that it can be resumed after a power loss.
+// record() only copies the entry, a thread of the journal's own appends the latest one
+// and syncs it to disk once per interval. The serial path never waits for the disk.
+class JobJournal
+{
+public:
+	struct Entry
+	{
+		uint64_t offset = 0; // Confirmed by the printer
+		bool relative = false, relativeE = false;
+		float hotend = 0, bed = 0; // Target temperatures
+		std::chrono::system_clock::time_point when;
+	};
+
+	// The job prints the file called name of the given size
+	JobJournal(std::string path, std::string_view name, uint64_t size, std::chrono::milliseconds interval);
+	// Writes out the last entry unless discarded
+	~JobJournal();
+
+	JobJournal(const JobJournal&) = delete;
+	JobJournal& operator=(const JobJournal&) = delete;
+
+	void record(const Entry& entry);
+	// The job has ended, the journal gets deleted
+	void discard();
+
+	// What a journal left behind says
+	struct Contents
+	{
+		std::string name;
+		uint64_t size;
+		Entry last;
+	};
+	// Empty if there's no usable journal at path
+	static std::optional<Contents> read(const std::string& path);
+private:
+	void run();
+	void append(int fd, const Entry& entry);
+private:
+	const std::string m_path, m_name;
+	const uint64_t m_size;
+	const std::chrono::milliseconds m_interval;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	Entry m_entry;
+	bool m_dirty = false, m_stopping = false, m_discarded = false;
+	std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _LINEFRAMER_H
+#define _LINEFRAMER_H
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <stddef.h>
+
+// Formats "N<n> <cmd> *<cs>\n" in place, computing the checksum
+// while the line is being written. Never allocates.
+class LineFramer
+{
+public:
+	// Way above what any firmware accepts (Marlin's MAX_CMD_SIZE is 96)
+	static constexpr size_t CAPACITY = 256;
+
+	// bodyChecksum is the XOR of all characters in command, -1 if unknown.
+	// Returns false if the line doesn't fit.
+	bool frame(int lineNo, std::string_view command, int bodyChecksum)
+	{
+		char* p = m_data;
+		char* const end = m_data + CAPACITY;
+
+		*p++ = 'N';
+		p = std::to_chars(p, end, lineNo).ptr;
+		*p++ = ' ';
+
+		// " *255\n"
+		if (size_t(end - p) < command.length() + 6)
+			return false;
+
+		unsigned int cs = 0;
+		for (const char* c = m_data; c < p; c++)
+			cs ^= (unsigned char) *c;
+
+		if (bodyChecksum != -1)
+		{
+			std::memcpy(p, command.data(), command.length());
+			p += command.length();
+			cs ^= unsigned(bodyChecksum);
+		}
+		else
+		{
+			for (char c : command)
+			{
+				*p++ = c;
+				cs ^= (unsigned char) c;
+			}
+		}
+
+		*p++ = ' ';
+		cs ^= ' ';
+		*p++ = '*';
+		p = std::to_chars(p, end, cs & 0xff).ptr;
+		*p++ = '\n';
+
+		m_length = p - m_data;
+		return true;
+	}
+
+	// Without a line number and checksum
+	bool frame(std::string_view command)
+	{
+		if (command.length() + 1 > CAPACITY)
+			return false;
+
+		std::memcpy(m_data, command.data(), command.length());
+		m_data[command.length()] = '\n';
+		m_length = command.length() + 1;
+		return true;
+	}
+
+	// Including the trailing newline
+	std::string_view line() const { return std::string_view(m_data, m_length); }
+	std::string_view text() const { return std::string_view(m_data, m_length - 1); }
+	size_t length() const { return m_length; }
+private:
+	char m_data[CAPACITY];
+	size_t m_length = 0;
+};
+
+#endif
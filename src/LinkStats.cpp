@@ -0,0 +1,80 @@
+#include "LinkStats.h"
+#include <algorithm>
+
+int LinkStats::bucketIndex(uint64_t micros)
+{
+	if (micros < SUB_BUCKETS)
+		return micros;
+
+	micros = std::min<uint64_t>(micros, bucketLowerBound(BUCKETS - 1));
+
+	// SUB_BUCKETS is 2^3: keep the top 3 bits below the leading one
+	const int magnitude = 63 - __builtin_clzll(micros);
+	const int shift = magnitude - 3;
+
+	return (shift + 1) * SUB_BUCKETS + int(micros >> shift) - SUB_BUCKETS;
+}
+
+uint64_t LinkStats::bucketLowerBound(int index)
+{
+	if (index < SUB_BUCKETS)
+		return index;
+
+	const int shift = index / SUB_BUCKETS - 1;
+	return uint64_t(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t LinkStats::percentile(const Histogram& histogram, double fraction)
+{
+	uint64_t total = 0;
+	for (uint64_t count : histogram)
+		total += count;
+
+	if (total == 0)
+		return 0;
+
+	const uint64_t rank = std::max<uint64_t>(1, uint64_t(fraction * total + 0.5));
+	uint64_t seen = 0;
+
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if (seen >= rank)
+			return (i + 1 < BUCKETS) ? bucketLowerBound(i + 1) : bucketLowerBound(i);
+	}
+
+	return bucketLowerBound(BUCKETS - 1);
+}
+
+void LinkStats::okReceived(std::chrono::steady_clock::duration roundTrip)
+{
+	const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(roundTrip).count();
+
+	m_oks++;
+	m_latency[bucketIndex(std::max<int64_t>(micros, 0))]++;
+}
+
+void LinkStats::fillReport(Report& report, const Report& previous) const
+{
+	report.when = std::chrono::system_clock::now();
+
+	report.linesSent = m_linesSent;
+	report.linesReceived = m_linesReceived;
+	report.bytesSent = m_bytesSent;
+	report.bytesReceived = m_bytesReceived;
+	report.oks = m_oks;
+	report.resends = m_resends;
+	report.timeouts = m_timeouts;
+	report.latency = m_latency;
+
+	const double seconds = std::chrono::duration<double>(report.when - previous.when).count();
+
+	// Counters start over with every connection
+	if (seconds > 0 && previous.linesSent <= m_linesSent && previous.linesReceived <= m_linesReceived)
+	{
+		report.linesSentPerSec = (m_linesSent - previous.linesSent) / seconds;
+		report.linesReceivedPerSec = (m_linesReceived - previous.linesReceived) / seconds;
+		report.bytesSentPerSec = (m_bytesSent - previous.bytesSent) / seconds;
+		report.bytesReceivedPerSec = (m_bytesReceived - previous.bytesReceived) / seconds;
+	}
+}
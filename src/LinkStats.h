@@ -0,0 +1,65 @@
+#ifndef _LINKSTATS_H
+#define _LINKSTATS_H
+#include <array>
+#include <chrono>
+#include <stdint.h>
+#include <stddef.h>
+
+// Serial link counters of a Printer. Only touched on the printer's strand,
+// so recording a sample is just a couple of integer additions.
+class LinkStats
+{
+public:
+	// HDR-style histogram of "ok" round trip times in microseconds:
+	// every power of two is split into SUB_BUCKETS linear buckets,
+	// which keeps the relative error below 12.5% from 1 us up to ~8 minutes.
+	static constexpr int SUB_BUCKETS = 8;
+	static constexpr int BUCKETS = 27 * SUB_BUCKETS;
+	typedef std::array<uint64_t, BUCKETS> Histogram;
+
+	static int bucketIndex(uint64_t micros);
+	// Smallest value falling into the bucket
+	static uint64_t bucketLowerBound(int index);
+	// Value below which the given fraction (0..1) of the samples lies
+	static uint64_t percentile(const Histogram& histogram, double fraction);
+
+	void lineSent(size_t bytes)
+	{
+		m_linesSent++;
+		m_bytesSent += bytes;
+	}
+	void lineReceived(size_t bytes)
+	{
+		m_linesReceived++;
+		m_bytesReceived += bytes;
+	}
+	void okReceived(std::chrono::steady_clock::duration roundTrip);
+	void resendRequested() { m_resends++; }
+	void timedOut() { m_timeouts++; }
+
+	void clear() { *this = LinkStats(); }
+
+	// What gets published every second
+	struct Report
+	{
+		std::chrono::system_clock::time_point when;
+		// Over the last reporting period
+		double linesSentPerSec = 0, linesReceivedPerSec = 0;
+		double bytesSentPerSec = 0, bytesReceivedPerSec = 0;
+		// Since the connection has been established
+		uint64_t linesSent = 0, linesReceived = 0, bytesSent = 0, bytesReceived = 0;
+		uint64_t oks = 0, resends = 0, timeouts = 0;
+		Histogram latency {};
+		// Sampled at the time of the report
+		size_t queued = 0, jobQueued = 0, inflight = 0, inflightBytes = 0;
+	};
+
+	// Computes the rates against the previous report
+	void fillReport(Report& report, const Report& previous) const;
+private:
+	uint64_t m_linesSent = 0, m_linesReceived = 0, m_bytesSent = 0, m_bytesReceived = 0;
+	uint64_t m_oks = 0, m_resends = 0, m_timeouts = 0;
+	Histogram m_latency {};
+};
+
+#endif
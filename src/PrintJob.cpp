@@ -3,35 +3,209 @@
 //
 
 #include "PrintJob.h"
+#include "ArcFitter.h"
 #include <stdexcept>
-#include <boost/algorithm/string/trim.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/filesystem.hpp>
 
-PrintJob::PrintJob(std::shared_ptr<Printer> printer, std::string_view fileName, const char* filePath)
+PrintJob::PrintJob(std::shared_ptr<Printer> printer, std::string_view fileName, const char* filePath,
+	std::vector<std::unique_ptr<GCodeStage>> stages)
 : m_printer(printer), m_printerUniqueName(printer->uniqueName()), m_jobName(fileName)
 {
-	m_file.open(filePath);
+	m_source = GCodeSource::open(filePath);
+	m_size = m_source->size();
 
-	if (!m_file.is_open())
-		throw std::runtime_error("Cannot open GCODE file");
+	// The printer's arc fitting applies unless the job asks for its own
+	const double arcTolerance = printer->arcTolerance();
+	const bool hasArcFit = std::any_of(stages.begin(), stages.end(), [](const std::unique_ptr<GCodeStage>& stage) {
+		return dynamic_cast<ArcFitStage*>(stage.get()) != nullptr;
+	});
 
-	m_file.seekg(0, std::ios_base::end);
-	m_size = m_file.tellg();
+	if (arcTolerance > 0 && !hasArcFit && printer->hasCapability("ARCS"))
+		stages.push_back(std::make_unique<ArcFitStage>(arcTolerance));
+
+	// The estimate has to see what the printer gets, e.g. the scaled feedrates
+	std::vector<std::unique_ptr<GCodeStage>> estimatorStages;
+	for (const auto& stage : stages)
+		estimatorStages.push_back(stage->clone());
+
+	// Lines read from the pipeline wait in the job feed, then stay in the printer's resend history
+	if (!stages.empty())
+	{
+		const size_t retainLines = JobFeed::Ring::capacity() + size_t(std::max(printer->resendHistoryDepth(), 1));
+		m_source = std::make_shared<PipelineGCodeSource>(m_source, std::move(stages), retainLines);
+	}
+
+	// The file gets read once more, with a source of its own
+	m_estimator = std::make_shared<PrintTimeEstimator>(printer->motionLimits());
+	m_estimatorThread = std::thread([estimator = m_estimator, path = std::string(filePath), stages = std::move(estimatorStages)]() mutable {
+		try
+		{
+			std::shared_ptr<GCodeSource> source = GCodeSource::open(path.c_str());
+
+			// Each line is done with once parsed
+			if (!stages.empty())
+				source = std::make_shared<PipelineGCodeSource>(source, std::move(stages), 0);
+
+			estimator->build(*source);
+		}
+		catch (const std::exception& e)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Cannot estimate print time of " << path << ": " << e.what();
+		}
+	});
+}
+
+PrintJob::~PrintJob()
+{
+	m_estimator->cancel();
+	m_estimatorThread.join();
 }
 
 void PrintJob::start()
 {
+	runOnPrinterStrand(&PrintJob::doStart);
+}
+
+void PrintJob::stop()
+{
+	runOnPrinterStrand(&PrintJob::doStop);
+}
+
+void PrintJob::pause()
+{
+	runOnPrinterStrand(&PrintJob::doPause);
+}
+
+void PrintJob::setStartPoint(size_t offset, const GCodeAnalysis::State& state)
+{
+	m_startOffset = offset;
+	m_startState = state;
+}
+
+std::vector<std::string> PrintJob::startPreamble(const GCodeAnalysis::State& state)
+{
+	std::vector<std::string> commands;
+	char buf[80];
+
+	auto add = [&](const char* format, auto... args) {
+		std::snprintf(buf, sizeof(buf), format, args...);
+		commands.push_back(buf);
+	};
+
+	// Heat up both at once
+	if (state.bed > 0)
+		add("M140 S%.0f", state.bed);
+	if (state.hotend > 0)
+		add("M104 S%.0f", state.hotend);
+
+	// Homing Z would crash into the print. The nozzle is expected to be where the job left it,
+	// but reopening the port resets most boards, so the firmware is told that height.
+	// Lifted before waiting for the heaters, so that the hot nozzle doesn't melt into the print.
+	add("G90");
+	add("G92 Z%.3f", state.position[2]);
+	add("G0 Z%.3f F600", state.position[2] + 2);
+
+	if (state.bed > 0)
+		add("M190 S%.0f", state.bed);
+	if (state.hotend > 0)
+		add("M109 S%.0f", state.hotend);
+
+	// Approach the position from above
+	add("G28 X Y");
+	add("G0 X%.3f Y%.3f F3000", state.position[0], state.position[1]);
+	add("G0 Z%.3f F600", state.position[2]);
+
+	add("G92 E%.5f", state.e);
+	add(state.relativeE ? "M83" : "M82");
+	if (state.relative)
+		add("G91");
+	if (state.feedrate > 0)
+		add("G1 F%.0f", state.feedrate);
+
+	if (state.fan > 0)
+		add("M106 S%d", state.fan);
+	else
+		add("M107");
+
+	return commands;
+}
+
+// Applies a G90/G91/M82/M83 line the way Printer does, returns false for other lines
+static bool applyPositioning(std::string_view line, Printer::PositioningState& state)
+{
+	const std::string_view code = line.substr(0, line.find(' '));
+
+	if (code == "G90")
+		state = { false, false };
+	else if (code == "G91")
+		state = { true, true };
+	else if (code == "M82")
+		state.extruderRelativePositioning = false;
+	else if (code == "M83")
+		state.extruderRelativePositioning = true;
+	else
+		return false;
+
+	return true;
+}
+
+void PrintJob::runOnPrinterStrand(void (PrintJob::*method)())
+{
+	std::shared_ptr<Printer> printer = m_printer.lock();
+
+	if (!printer)
+	{
+		setError("The printer is gone");
+		return;
+	}
+
+	// The job feed has a single producer, so everything touching it runs where the printer consumes it
+	boost::asio::dispatch(printer->strand(), std::bind(method, shared_from_this()));
+}
+
+void PrintJob::doStart()
+{
+	std::shared_ptr<Printer> printer = m_printer.lock();
+
 	if (m_state != State::Paused)
 	{
-		m_timeElapsed = std::chrono::seconds::zero();
-		m_file.seekg(0, std::ios_base::beg);
+		m_source->seek(m_startOffset);
+		m_position = m_startOffset;
+
+		std::weak_ptr<PrintJob> weakSelf = shared_from_this();
+		const unsigned int generation = ++m_feedGeneration;
+
+		m_linesOutstanding = 0;
+		m_feed = std::make_shared<JobFeed>(m_source, [weakSelf, generation](size_t position, const std::vector<std::string>& resp) {
+			std::shared_ptr<PrintJob> self = weakSelf.lock();
+			if (self)
+				self->lineProcessed(generation, position, resp);
+		});
+
+		if (printer && m_startState)
+		{
+			for (const std::string& command : startPreamble(*m_startState))
+				printer->sendCommand(command.c_str(), nullptr);
+		}
+
+		// The preamble puts the printer in the start state, nothing of the job is in flight otherwise
+		if (m_startState)
+			m_pushedPositioning = { m_startState->relative, m_startState->relativeE };
+		else if (printer)
+			m_pushedPositioning = printer->positioningState();
+		else
+			m_pushedPositioning = { false, false };
+		m_positioningChanges.clear();
+
+		startJournal();
 	}
 	else
 	{
-		std::shared_ptr<Printer> printer = m_printer.lock();
-
 		if (printer)
 		{
 			// Move the extruder back
@@ -51,20 +225,55 @@ void PrintJob::start()
 		}
 	}
 
+	startClock(m_state != State::Paused);
 	setState(State::Running);
-	m_startTime = std::chrono::steady_clock::now();
+
+	// Job lines follow the commands above
+	if (printer)
+		printer->setJobFeed(m_feed);
 	printLine();
 }
 
-void PrintJob::stop()
+void PrintJob::startJournal()
+{
+	std::shared_ptr<Printer> printer = m_printer.lock();
+	m_journal.reset();
+
+	if (!printer || printer->journalInterval() <= 0 || printer->journalPath().empty())
+		return;
+
+	m_journal = std::make_unique<JobJournal>(printer->journalPath(), m_jobName, m_size, std::chrono::seconds(printer->journalInterval()));
+	m_journalEntry = JobJournal::Entry();
+	m_journalEntry.relative = m_pushedPositioning.relativePositioning;
+	m_journalEntry.relativeE = m_pushedPositioning.extruderRelativePositioning;
+
+	// Target temperatures come with reports and with the commands setting them, both on the printer's strand
+	std::weak_ptr<PrintJob> weakSelf = shared_from_this();
+	m_temperatureConnection = printer->temperatureChangeSignal().connect([weakSelf](const std::map<std::string, float>& changes) {
+		std::shared_ptr<PrintJob> self = weakSelf.lock();
+		if (!self)
+			return;
+
+		for (const auto& [key, value] : changes)
+		{
+			if (key == "T.target" || key == "T0.target")
+				self->m_journalEntry.hotend = value;
+			else if (key == "B.target")
+				self->m_journalEntry.bed = value;
+		}
+	});
+}
+
+void PrintJob::doStop()
 {
-	m_timeElapsed += std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_startTime);
 	setState(State::Stopped);
 
 	std::shared_ptr<Printer> printer = m_printer.lock();
 
 	if (printer)
 	{
+		printer->setJobFeed(nullptr);
+
 		// Disable steppers
 		printer->sendCommand("M18", nullptr);
 		// Fan off
@@ -80,18 +289,19 @@ void PrintJob::stop()
 	}
 }
 
-void PrintJob::pause()
+void PrintJob::doPause()
 {
 	if (m_state != State::Running)
 		return;
 
-	m_timeElapsed += std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_startTime);
-
 	setState(State::Paused);
 
 	std::shared_ptr<Printer> printer = m_printer.lock();
 	m_positioningBeforePause = printer->positioningState();
 
+	// Lines remaining in the feed wait for resume
+	printer->setJobFeed(nullptr);
+
 	// Pause sequence (move extruder away)
 	if (!m_positioningBeforePause.relativePositioning)
 		printer->sendCommand("G91", nullptr);
@@ -112,51 +322,46 @@ void PrintJob::setError(std::string_view error)
 	setState(State::Error);
 }
 
-std::string PrintJob::nextLine()
-{
-	std::string line;
-
-	do
-	{
-		std::getline(m_file, line);
-
-		std::string::size_type pos = line.find(';');
-		if (pos != std::string::npos)
-			line.resize(pos);
-
-		boost::algorithm::trim(line);
-	}
-	while (line.empty() && !m_file.eof() && !m_file.bad());
-
-	m_position = m_file.tellg();
-	if (m_file.eof())
-		m_position = m_size;
-	return line;
-}
-
 void PrintJob::printLine()
 {
 	std::shared_ptr<Printer> printer = m_printer.lock();
 
 	try
 	{
-		std::string line = nextLine();
-
 		if (!printer)
 			throw std::runtime_error("The printer is gone");
 		if (printer->state() != Printer::State::Connected)
 			throw std::runtime_error("The printer is not connected");
 
-		if (!line.empty())
+		JobFeed::Ring& ring = m_feed->lines();
+
+		// Top up the feed once it's half empty, so that the printer isn't woken up for every line.
+		// The lines point into m_source's memory, which the feed keeps alive.
+		if (ring.size() <= ring.capacity() / 2)
 		{
-			// Send another line to the printer
-			printer->sendCommand(line.c_str(), std::bind(&PrintJob::lineProcessed, this, std::placeholders::_1));
+			const bool wasEmpty = ring.empty();
+			std::string_view line;
+			size_t pushed = 0;
+
+			while (ring.size() < ring.capacity() && m_source->nextLine(line))
+			{
+				ring.push({ line, m_source->lineChecksum(), m_source->position() });
+				pushed++;
+
+				if (m_journal && applyPositioning(line, m_pushedPositioning))
+					m_positioningChanges.push_back({ m_source->position(), m_pushedPositioning });
+			}
+
+			m_linesOutstanding += pushed;
+
+			if (pushed > 0 && wasEmpty)
+				printer->jobFeedChanged();
 		}
-		else
+
+		if (m_linesOutstanding == 0)
 		{
 			// Print job done
-			m_timeElapsed += std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_startTime);
-
+			printer->setJobFeed(nullptr);
 			setState(State::Done);
 		}
 	}
@@ -167,11 +372,39 @@ void PrintJob::printLine()
 	}
 }
 
-void PrintJob::lineProcessed(const std::vector<std::string>& resp)
+void PrintJob::lineProcessed(unsigned int feedGeneration, size_t position, const std::vector<std::string>& resp)
 {
+	if (feedGeneration != m_feedGeneration)
+		return;
+
+	// The line was never confirmed: the connection dropped, the firmware restarted or the line couldn't be sent.
+	// The position and the journal stay at the last confirmed line, where a resumed print would start.
+	if (resp.empty())
+	{
+		if (inProgress())
+			setError("The printer did not confirm a line of the job");
+		return;
+	}
+
 	try
 	{
-		m_progressChangeSignal(m_position);
+		m_linesOutstanding--;
+		m_position = position;
+		m_progressChangeSignal(position);
+
+		if (m_journal)
+		{
+			while (!m_positioningChanges.empty() && m_positioningChanges.front().position <= position)
+			{
+				m_journalEntry.relative = m_positioningChanges.front().state.relativePositioning;
+				m_journalEntry.relativeE = m_positioningChanges.front().state.extruderRelativePositioning;
+				m_positioningChanges.pop_front();
+			}
+
+			m_journalEntry.offset = position;
+			m_journalEntry.when = std::chrono::system_clock::now();
+			m_journal->record(m_journalEntry);
+		}
 
 		if (m_state == State::Running)
 			printLine();
@@ -186,11 +419,42 @@ void PrintJob::setState(State state)
 {
 	if (state != m_state)
 	{
+		// Failed jobs keep their journal, so that they can be resumed
+		if (m_journal && (state == State::Done || state == State::Stopped))
+		{
+			m_journal->discard();
+			m_temperatureConnection.disconnect();
+		}
+
+		if (state != State::Running)
+			stopClock();
+
 		m_state = state;
 		m_stateChangeSignal(state, m_errorString);
 	}
 }
 
+void PrintJob::startClock(bool reset)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (reset)
+		m_timeElapsed = std::chrono::seconds::zero();
+	m_startTime = std::chrono::steady_clock::now();
+	m_clockRunning = true;
+}
+
+void PrintJob::stopClock()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_clockRunning)
+	{
+		m_timeElapsed += std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_startTime);
+		m_clockRunning = false;
+	}
+}
+
 std::string PrintJob::errorString() const
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
@@ -222,14 +486,32 @@ const char* PrintJob::stateString(State state)
 
 void PrintJob::progress(size_t& pos, size_t& total) const
 {
-	pos = (m_state == State::Done) ? m_size : m_position;
+	pos = (m_state == State::Done) ? m_size : m_position.load();
 	total = m_size;
 }
 
+int PrintJob::timeRemaining() const
+{
+	if (!m_estimator->ready())
+		return -1;
+	if (m_state == State::Done)
+		return 0;
+	return int(std::lround(m_estimator->remainingAt(m_position)));
+}
+
+int PrintJob::timeEstimated() const
+{
+	if (!m_estimator->ready())
+		return -1;
+	return int(std::lround(m_estimator->totalTime()));
+}
+
 std::chrono::seconds PrintJob::timeElapsed() const
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
 	auto s = m_timeElapsed;
-	if (m_state == State::Running)
+	if (m_clockRunning)
 		s += std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_startTime);
 	return s;
 }
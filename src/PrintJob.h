@@ -4,23 +4,42 @@
 
 #ifndef DASHPRINT_PRINTJOB_H
 #define DASHPRINT_PRINTJOB_H
-#include <fstream>
 #include <memory>
 #include <boost/signals2.hpp>
 #include <mutex>
 #include <chrono>
 #include <string_view>
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <deque>
 #include "Printer.h"
+#include "GCodeSource.h"
+#include "GCodePipeline.h"
+#include "JobJournal.h"
+#include "PrintTimeEstimator.h"
+#include "wasm/gcode-analyzer/GCodeAnalyzer.h"
 
 class PrintJob : public std::enable_shared_from_this<PrintJob>
 {
 public:
-	PrintJob(std::shared_ptr<Printer> printer, std::string_view fileName, const char* filePath);
+	// The G-code passes through stages on its way to the printer, if there are any
+	PrintJob(std::shared_ptr<Printer> printer, std::string_view fileName, const char* filePath,
+		std::vector<std::unique_ptr<GCodeStage>> stages = {});
+	~PrintJob();
 
+	// These are carried out asynchronously on the printer's strand
 	void start();
 	void stop();
 	void pause();
 
+	// Print from offset on instead of from the start of the file, e.g. to resume a failed print.
+	// The printer is first put in state, which the lines before offset would have left it in.
+	// To be called before start().
+	void setStartPoint(size_t offset, const GCodeAnalysis::State& state);
+	// The commands that restore state
+	static std::vector<std::string> startPreamble(const GCodeAnalysis::State& state);
+
 	enum class State
 	{
 		Stopped,
@@ -38,32 +57,69 @@ public:
 	inline bool inProgress() const { return m_state == State::Running || m_state == State::Paused; }
 
 	std::chrono::seconds timeElapsed() const;
+	// Per the print time estimate, which is computed in the background. -1 until it's ready.
+	int timeRemaining() const;
+	int timeEstimated() const;
 
 	boost::signals2::signal<void(State, std::string)>& stateChangeSignal() { return m_stateChangeSignal; }
 	boost::signals2::signal<void(size_t)>& progressChangeSignal() { return m_progressChangeSignal; }
 protected:
 	void setError(std::string_view error);
 private:
+	void runOnPrinterStrand(void (PrintJob::*method)());
+	void doStart();
+	void doStop();
+	void doPause();
 	void printLine();
-	void lineProcessed(const std::vector<std::string>& resp);
+	void startJournal();
+	void lineProcessed(unsigned int feedGeneration, size_t position, const std::vector<std::string>& resp);
 	void setState(State state);
-	std::string nextLine();
+	// Time spent running, measured from now on. Stopped by leaving State::Running.
+	void startClock(bool reset);
+	void stopClock();
 private:
-	std::ifstream m_file;
+	std::shared_ptr<GCodeSource> m_source;
+	std::shared_ptr<JobFeed> m_feed;
+	std::shared_ptr<PrintTimeEstimator> m_estimator;
+	std::thread m_estimatorThread;
+	// Confirmations from feeds of previous runs are ignored
+	unsigned int m_feedGeneration = 0;
 	const std::string m_printerUniqueName;
 	std::weak_ptr<Printer> m_printer;
-	State m_state = State::Stopped;
+	std::atomic<State> m_state { State::Stopped };
 
 	std::string m_errorString;
 	mutable std::mutex m_mutex;
 
 	boost::signals2::signal<void(State, std::string)> m_stateChangeSignal;
 	boost::signals2::signal<void(size_t)> m_progressChangeSignal;
-	size_t m_position = 0, m_size;
+	// Confirmed by the printer, m_source knows how far we've read. Read by web threads.
+	std::atomic<size_t> m_position { 0 };
+	size_t m_size;
+	// Lines pushed into m_feed and not processed by the printer yet
+	size_t m_linesOutstanding = 0;
+	size_t m_startOffset = 0;
+	std::optional<GCodeAnalysis::State> m_startState;
+
+	// Per the printer's journal settings at the time of start(), dropped once the job ends
+	std::unique_ptr<JobJournal> m_journal;
+	JobJournal::Entry m_journalEntry;
+	// The printer's positioning modes change once lines are written, ahead of the confirmed offset.
+	// The modes after the last line pushed into m_feed, and where pushed lines change them.
+	struct PositioningChange
+	{
+		size_t position;
+		Printer::PositioningState state;
+	};
+	Printer::PositioningState m_pushedPositioning;
+	std::deque<PositioningChange> m_positioningChanges;
+	boost::signals2::scoped_connection m_temperatureConnection;
 
 	const std::string m_jobName;
+	// Guarded by m_mutex, timeElapsed() is called by web threads
 	std::chrono::steady_clock::time_point m_startTime;
-	std::chrono::seconds m_timeElapsed;
+	std::chrono::seconds m_timeElapsed { 0 };
+	bool m_clockRunning = false;
 
 	Printer::PositioningState m_positioningBeforePause;
 
@@ -0,0 +1,419 @@
+#include "PrintTimeEstimator.h"
+#include "GCodePipeline.h"
+#include <cmath>
+#include <algorithm>
+
+enum { X, Y, Z, E };
+
+static int axisIndex(char letter)
+{
+	switch (letter)
+	{
+		case 'X': return X;
+		case 'Y': return Y;
+		case 'Z': return Z;
+		case 'E': return E;
+		default: return -1;
+	}
+}
+
+bool MotionLimits::parse(std::string_view line)
+{
+	if (line.compare(0, 5, "echo:") == 0)
+		line.remove_prefix(5);
+	line = MappedGCodeSource::stripLine(line);
+
+	if (isGCodeCommand(line, "M201"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (axisIndex(letter) != -1)
+				maxAcceleration[axisIndex(letter)] = value;
+			return true;
+		});
+	}
+	else if (isGCodeCommand(line, "M203"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (axisIndex(letter) != -1)
+				maxFeedrate[axisIndex(letter)] = value;
+			return true;
+		});
+	}
+	else if (isGCodeCommand(line, "M204"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (letter == 'P')
+				printAcceleration = value;
+			else if (letter == 'R')
+				retractAcceleration = value;
+			else if (letter == 'T')
+				travelAcceleration = value;
+			else if (letter == 'S') // Older firmware
+				printAcceleration = travelAcceleration = value;
+			return true;
+		});
+	}
+	else if (isGCodeCommand(line, "M205"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (axisIndex(letter) != -1)
+				jerk[axisIndex(letter)] = value;
+			else if (letter == 'J')
+				junctionDeviation = value;
+			else if (letter == 'S')
+				minFeedrate = value;
+			else if (letter == 'T')
+				minTravelFeedrate = value;
+			return true;
+		});
+	}
+	else
+		return false;
+
+	return true;
+}
+
+PrintTimeEstimator::PrintTimeEstimator(const MotionLimits& limits)
+: m_limits(limits)
+{
+}
+
+bool PrintTimeEstimator::build(GCodeSource& source)
+{
+	std::string_view line;
+	size_t count = 0;
+
+	m_size = source.size();
+	source.seek(0);
+
+	while (source.nextLine(line))
+	{
+		if (++count % 4096 == 0 && m_cancelled)
+			return false;
+
+		processLine(line, source.position());
+	}
+
+	flushMoves();
+	advance(m_size);
+	m_total = m_time;
+
+	applyFileRemaining();
+	m_ready = true;
+
+	return true;
+}
+
+void PrintTimeEstimator::processLine(std::string_view line, size_t position)
+{
+	const bool arc = isGCodeCommand(line, "G2") || isGCodeCommand(line, "G3");
+
+	if (arc || isGCodeCommand(line, "G0") || isGCodeCommand(line, "G1"))
+	{
+		double target[4] = { m_axes[X], m_axes[Y], m_axes[Z], m_axes[E] };
+		double i = 0, j = 0;
+
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			const int axis = axisIndex(letter);
+
+			if (axis == E)
+				target[E] = m_relativeE ? m_axes[E] + value : value;
+			else if (axis != -1)
+				target[axis] = m_relative ? m_axes[axis] + value : value;
+			else if (letter == 'F' && value > 0)
+				m_feedrate = value / 60;
+			else if (letter == 'I')
+				i = value;
+			else if (letter == 'J')
+				j = value;
+			return true;
+		});
+
+		double delta[4];
+		for (int a = 0; a < 4; a++)
+			delta[a] = target[a] - m_axes[a];
+
+		double pathLength = -1;
+		if (arc)
+		{
+			// Angle swept around the center, a full circle if the end is the start
+			const double cx = m_axes[X] + i, cy = m_axes[Y] + j;
+			const double a0 = std::atan2(m_axes[Y] - cy, m_axes[X] - cx);
+			const double a1 = std::atan2(target[Y] - cy, target[X] - cx);
+			double sweep = isGCodeCommand(line, "G3") ? a1 - a0 : a0 - a1;
+
+			if (sweep <= 1e-9)
+				sweep += 2 * M_PI;
+
+			pathLength = std::hypot(std::hypot(i, j) * sweep, delta[Z]);
+		}
+
+		std::copy(target, target + 4, m_axes);
+		addMove(delta, pathLength, position);
+	}
+	else if (isGCodeCommand(line, "G90"))
+		m_relative = m_relativeE = false;
+	else if (isGCodeCommand(line, "G91"))
+		m_relative = m_relativeE = true;
+	else if (isGCodeCommand(line, "M82"))
+		m_relativeE = false;
+	else if (isGCodeCommand(line, "M83"))
+		m_relativeE = true;
+	else if (isGCodeCommand(line, "G92"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (axisIndex(letter) != -1)
+				m_axes[axisIndex(letter)] = value;
+			return true;
+		});
+	}
+	else if (isGCodeCommand(line, "G28"))
+	{
+		// Homing time isn't known, the position is the origin
+		flushMoves();
+		m_axes[X] = m_axes[Y] = m_axes[Z] = 0;
+	}
+	else if (isGCodeCommand(line, "G4"))
+	{
+		flushMoves();
+
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (letter == 'P')
+				m_time += value / 1000;
+			else if (letter == 'S')
+				m_time += value;
+			return true;
+		});
+
+		advance(position);
+	}
+	else if (isGCodeCommand(line, "M400") || isGCodeCommand(line, "M109") || isGCodeCommand(line, "M190"))
+	{
+		// These wait for the moves to finish, heating time isn't known
+		flushMoves();
+	}
+	else if (isGCodeCommand(line, "M73"))
+	{
+		forEachGCodeParam(line, [&](char letter, double value, std::string_view) {
+			if (letter == 'R')
+				m_marks.push_back({ position, value * 60 });
+			return true;
+		});
+	}
+	else
+		m_limits.parse(line);
+}
+
+void PrintTimeEstimator::addMove(const double delta[4], double pathLength, size_t position)
+{
+	Move move;
+	const double xyz = std::sqrt(delta[X]*delta[X] + delta[Y]*delta[Y] + delta[Z]*delta[Z]);
+	const double chord = (xyz > 1e-6) ? xyz : std::abs(delta[E]);
+
+	move.position = position;
+	move.distance = (pathLength > 0) ? pathLength : chord;
+
+	if (move.distance < 1e-6)
+		return;
+
+	for (int a = 0; a < 4; a++)
+		move.unit[a] = (chord > 1e-6) ? delta[a] / chord : 0;
+	// A full circle, any direction will do for the junctions
+	if (chord <= 1e-6)
+		move.unit[X] = 1;
+
+	const bool extruding = delta[E] > 0;
+	double speed = std::max(m_feedrate, extruding ? m_limits.minFeedrate : m_limits.minTravelFeedrate);
+	double acceleration;
+
+	if (xyz <= 1e-6)
+		acceleration = m_limits.retractAcceleration;
+	else
+		acceleration = extruding ? m_limits.printAcceleration : m_limits.travelAcceleration;
+
+	for (int a = 0; a < 4; a++)
+	{
+		const double u = std::abs(move.unit[a]);
+		if (u > 1e-9)
+		{
+			speed = std::min(speed, m_limits.maxFeedrate[a] / u);
+			acceleration = std::min(acceleration, m_limits.maxAcceleration[a] / u);
+		}
+	}
+
+	move.nominalSpeed = speed;
+	move.acceleration = std::max(acceleration, 1.0);
+
+	if (m_hasPrevious)
+		move.maxEntrySpeed = junctionSpeed(m_previous, move);
+	else
+	{
+		// Starting from a standstill
+		Move stopped = move;
+		std::fill(stopped.unit, stopped.unit + 4, 0);
+		move.maxEntrySpeed = (m_limits.junctionDeviation > 0) ? 0 : junctionSpeed(stopped, move);
+	}
+
+	move.entrySpeed = m_planned.empty() ? move.maxEntrySpeed : 0;
+
+	m_planned.push_back(move);
+	m_previous = move;
+	m_hasPrevious = true;
+
+	if (m_planned.size() > LOOKAHEAD)
+		executeMove();
+}
+
+double PrintTimeEstimator::junctionSpeed(const Move& prev, const Move& next) const
+{
+	double speed = std::min(prev.nominalSpeed, next.nominalSpeed);
+
+	if (m_limits.junctionDeviation > 0)
+	{
+		double cosTheta = 0;
+		for (int a = 0; a < 4; a++)
+			cosTheta -= prev.unit[a] * next.unit[a];
+
+		// Straight on
+		if (cosTheta < -0.999999)
+			return speed;
+		// Reversal
+		if (cosTheta > 0.999999)
+			return 0;
+
+		const double sinHalfTheta = std::sqrt(0.5 * (1 - cosTheta));
+		const double v2 = next.acceleration * m_limits.junctionDeviation * sinHalfTheta / (1 - sinHalfTheta);
+
+		return std::min(speed, std::sqrt(v2));
+	}
+
+	// Classic jerk: the instant speed change of each axis is limited
+	for (int a = 0; a < 4; a++)
+	{
+		const double change = std::abs(next.unit[a] - prev.unit[a]);
+		if (change > 1e-9)
+			speed = std::min(speed, m_limits.jerk[a] / change);
+	}
+
+	return speed;
+}
+
+void PrintTimeEstimator::executeMove()
+{
+	Move& move = m_planned.front();
+
+	// The fastest entry into the next move that still allows to stop after the last planned one
+	double next = 0;
+	for (size_t i = m_planned.size() - 1; i >= 1; i--)
+	{
+		const Move& m = m_planned[i];
+		next = std::min(m.maxEntrySpeed, std::sqrt(next*next + 2 * m.acceleration * m.distance));
+	}
+
+	const double exit = std::min(next, std::sqrt(move.entrySpeed*move.entrySpeed + 2 * move.acceleration * move.distance));
+
+	m_time += trapezoidTime(move.distance, move.acceleration, move.entrySpeed, move.nominalSpeed, exit);
+	advance(move.position);
+
+	m_planned.pop_front();
+	if (!m_planned.empty())
+		m_planned.front().entrySpeed = exit;
+}
+
+void PrintTimeEstimator::flushMoves()
+{
+	while (!m_planned.empty())
+		executeMove();
+
+	m_hasPrevious = false;
+}
+
+void PrintTimeEstimator::advance(size_t position)
+{
+	// The block starts passed since the last call are interpolated
+	while (m_blocks.size() * BLOCK_SIZE < position)
+	{
+		const size_t offset = m_blocks.size() * BLOCK_SIZE;
+		const double time = m_lastTime + (m_time - m_lastTime) * double(offset - m_lastPosition) / double(position - m_lastPosition);
+
+		m_blocks.push_back({ time, -1 });
+	}
+
+	m_lastPosition = position;
+	m_lastTime = m_time;
+}
+
+double PrintTimeEstimator::trapezoidTime(double distance, double acceleration, double entry, double nominal, double exit)
+{
+	const double accelDistance = std::max(0.0, (nominal*nominal - entry*entry) / (2 * acceleration));
+	const double decelDistance = std::max(0.0, (nominal*nominal - exit*exit) / (2 * acceleration));
+
+	if (accelDistance + decelDistance <= distance)
+		return (nominal - entry) / acceleration + (nominal - exit) / acceleration + (distance - accelDistance - decelDistance) / nominal;
+
+	// Never reaches the nominal speed
+	double peak = std::sqrt((2 * acceleration * distance + entry*entry + exit*exit) / 2);
+	peak = std::max(peak, std::max(entry, exit));
+
+	return (peak - entry) / acceleration + (peak - exit) / acceleration;
+}
+
+void PrintTimeEstimator::applyFileRemaining()
+{
+	if (m_marks.empty())
+		return;
+
+	// How the slicer's idea of time relates to ours, heating and homing included
+	const Mark& first = m_marks.front();
+	const Mark& last = m_marks.back();
+	const double modelSpan = timeAt(last.position) - timeAt(first.position);
+
+	if (modelSpan > 1 && first.remaining > last.remaining)
+		m_scale = std::clamp((first.remaining - last.remaining) / modelSpan, 0.25, 4.0);
+
+	// Each block gets the last mark before its end, extrapolated back or forth with the scaled model
+	size_t mark = 0;
+
+	for (size_t i = 0; i < m_blocks.size(); i++)
+	{
+		while (mark < m_marks.size() && m_marks[mark].position < (i + 1) * BLOCK_SIZE)
+			mark++;
+
+		if (mark > 0)
+		{
+			const Mark& m = m_marks[mark - 1];
+			m_blocks[i].fileRemaining = std::max(0.0, m.remaining - (m_blocks[i].time - timeAt(m.position)) * m_scale);
+		}
+	}
+}
+
+double PrintTimeEstimator::totalTime() const
+{
+	return remainingAt(0);
+}
+
+double PrintTimeEstimator::timeAt(size_t position) const
+{
+	position = std::min(position, m_size);
+
+	const size_t block = position / BLOCK_SIZE;
+	if (block >= m_blocks.size())
+		return m_total;
+
+	const size_t start = block * BLOCK_SIZE;
+	const size_t end = std::min(start + BLOCK_SIZE, m_size);
+	const double t0 = m_blocks[block].time;
+	const double t1 = (block + 1 < m_blocks.size()) ? m_blocks[block + 1].time : m_total;
+
+	return t0 + (t1 - t0) * double(position - start) / double(end - start);
+}
+
+double PrintTimeEstimator::remainingAt(size_t position) const
+{
+	const size_t block = std::min(position, m_size) / BLOCK_SIZE;
+
+	if (block < m_blocks.size() && m_blocks[block].fileRemaining >= 0)
+		return std::max(0.0, m_blocks[block].fileRemaining - (timeAt(position) - m_blocks[block].time) * m_scale);
+
+	return std::max(0.0, m_total - timeAt(position));
+}
@@ -0,0 +1,105 @@
+#ifndef _PRINTTIMEESTIMATOR_H
+#define _PRINTTIMEESTIMATOR_H
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <stddef.h>
+#include "GCodeSource.h"
+
+// Kinematic limits of the printer, as reported by M503. Axes are X, Y, Z, E.
+struct MotionLimits
+{
+	double maxFeedrate[4] = { 300, 300, 5, 25 }; // mm/s, M203
+	double maxAcceleration[4] = { 3000, 3000, 100, 10000 }; // mm/s^2, M201
+	double printAcceleration = 3000, retractAcceleration = 3000, travelAcceleration = 3000; // M204 P R T
+	double jerk[4] = { 10, 10, 0.3, 5 }; // mm/s, M205 X Y Z E
+	double junctionDeviation = 0; // mm, M205 J, used instead of jerk if set
+	double minFeedrate = 0, minTravelFeedrate = 0; // mm/s, M205 S T
+
+	// Applies a M201/M203/M204/M205 line, e.g. "echo:  M203 X500.00 Y500.00 Z12.00 E120.00".
+	// Returns false if the line isn't one of them.
+	bool parse(std::string_view line);
+};
+
+// Simulates the firmware's motion planner over a whole .gcode file,
+// producing the time at which the printer gets past any byte offset.
+// M73 R<minutes> lines put in by the slicer take precedence over the model.
+class PrintTimeEstimator
+{
+public:
+	PrintTimeEstimator(const MotionLimits& limits);
+
+	// Parses the whole source, may be called from another thread.
+	// Returns false if cancelled.
+	bool build(GCodeSource& source);
+	void cancel() { m_cancelled = true; }
+	// build() has finished
+	bool ready() const { return m_ready; }
+
+	// Seconds, only valid once ready
+	double totalTime() const;
+	double timeAt(size_t position) const;
+	double remainingAt(size_t position) const;
+
+	// Granularity of the lookup table
+	static constexpr size_t BLOCK_SIZE = 4096;
+	// Moves the planner looks ahead, BLOCK_BUFFER_SIZE in Marlin
+	static constexpr size_t LOOKAHEAD = 16;
+private:
+	struct Move
+	{
+		size_t position;
+		double distance, acceleration;
+		double nominalSpeed, maxEntrySpeed, entrySpeed;
+		double unit[4]; // Direction, XYZE
+	};
+	struct Block
+	{
+		double time;
+		double fileRemaining; // Per the last M73 R before the block, -1 if none
+	};
+
+	void processLine(std::string_view line, size_t position);
+	// pathLength is given for arcs, whose delta is just the chord
+	void addMove(const double delta[4], double pathLength, size_t position);
+	double junctionSpeed(const Move& prev, const Move& next) const;
+	// Executes the oldest planned move, the last one being followed by a stop
+	void executeMove();
+	void flushMoves();
+	// The printer got to position at m_time
+	void advance(size_t position);
+
+	static double trapezoidTime(double distance, double acceleration, double entry, double nominal, double exit);
+	void applyFileRemaining();
+private:
+	MotionLimits m_limits;
+	std::atomic<bool> m_ready { false }, m_cancelled { false };
+
+	// Parser state
+	bool m_relative = false, m_relativeE = false;
+	double m_axes[4] = { 0, 0, 0, 0 };
+	double m_feedrate = 25; // mm/s
+
+	std::deque<Move> m_planned;
+	bool m_hasPrevious = false;
+	Move m_previous;
+
+	// Time of the moves executed so far, m_lastPosition was reached at m_lastTime
+	double m_time = 0, m_lastTime = 0, m_total = 0;
+	size_t m_lastPosition = 0;
+	std::vector<Block> m_blocks;
+
+	// M73 R values found in the file, in seconds
+	struct Mark
+	{
+		size_t position;
+		double remaining;
+	};
+	std::vector<Mark> m_marks;
+	// Slicer's time per model time
+	double m_scale = 1;
+	size_t m_size = 0;
+};
+
+#endif
@@ -13,10 +13,13 @@
 
 #include "Printer.h"
 #include "PrintJob.h"
+#include "TemperatureParser.h"
 #include <iostream>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/log/trivial.hpp>
@@ -26,11 +29,14 @@
 
 static const boost::posix_time::seconds RECONNECT_DELAY(5);
 static const std::chrono::minutes MAX_TEMPERATURE_HISTORY(30);
+// Enough for a sample every second
+static constexpr size_t MAX_TEMPERATURE_SAMPLES = 30*60;
 static constexpr int DATA_TIMEOUT = 5000;
 static constexpr int MAX_LINENO = 10000;
 
 Printer::Printer(boost::asio::io_service &io)
-		: m_io(io), m_serial(io), m_socket(io), m_reconnectTimer(io), m_timeoutTimer(io), m_temperatureTimer(io)
+		: m_io(io), m_strand(io.get_executor()), m_serial(io), m_socket(io), m_reconnectTimer(io), m_timeoutTimer(io), m_temperatureTimer(io), m_statsTimer(io),
+		  m_temperatures(MAX_TEMPERATURE_SAMPLES, MAX_TEMPERATURE_HISTORY)
 {
 }
 
@@ -47,6 +53,13 @@ void Printer::load(const boost::property_tree::ptree& tree)
 	m_printArea.width = tree.get<int>("width");
 	m_printArea.height = tree.get<int>("height");
 	m_printArea.depth = tree.get<int>("depth");
+	m_advanceSend = tree.get<bool>("advance_send", false);
+	m_rxBufferSize = tree.get<int>("rx_buffer_size", 127);
+	m_maxInflight = tree.get<int>("max_inflight", 4);
+	m_temperatureInterval = tree.get<int>("temperature_interval", 5);
+	m_resendHistoryDepth = tree.get<int>("resend_history_depth", 500);
+	m_arcTolerance = tree.get<double>("arc_tolerance", 0);
+	m_journalInterval = tree.get<int>("journal_interval", 2);
 
 	if (!tree.get<bool>("stopped"))
 		start();
@@ -54,13 +67,20 @@ void Printer::load(const boost::property_tree::ptree& tree)
 
 void Printer::save(boost::property_tree::ptree& tree)
 {
-	tree.put("device_path", m_devicePath);
-	tree.put("baud_rate", m_baudRate);
+	tree.put("device_path", devicePath());
+	tree.put("baud_rate", baudRate());
 	tree.put("name", m_name);
 	tree.put("stopped", m_state == State::Stopped);
 	tree.put("width", m_printArea.width);
 	tree.put("height", m_printArea.height);
 	tree.put("depth", m_printArea.depth);
+	tree.put("advance_send", m_advanceSend);
+	tree.put("rx_buffer_size", m_rxBufferSize);
+	tree.put("max_inflight", m_maxInflight);
+	tree.put("temperature_interval", m_temperatureInterval);
+	tree.put("resend_history_depth", m_resendHistoryDepth);
+	tree.put("arc_tolerance", double(m_arcTolerance));
+	tree.put("journal_interval", m_journalInterval);
 }
 
 const char* Printer::stateName(State state)
@@ -85,11 +105,32 @@ void Printer::setUniqueName(const char *name)
 	m_uniqueName = name;
 }
 
+std::string Printer::journalPath() const
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	return m_journalPath;
+}
+
+void Printer::setJournalPath(std::string path)
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	m_journalPath = std::move(path);
+}
+
+std::string Printer::devicePath() const
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	return m_devicePath;
+}
+
 void Printer::setDevicePath(const char *devicePath)
 {
+	std::unique_lock<std::mutex> lock(m_miscMutex);
+
 	if (m_devicePath != devicePath)
 	{
 		m_devicePath = devicePath;
+		lock.unlock();
 		deviceSettingsChanged();
 	}
 }
@@ -103,41 +144,56 @@ void Printer::setPrintArea(PrintArea area)
 	}
 }
 
+int Printer::baudRate() const
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	return m_baudRate;
+}
+
 void Printer::setBaudRate(int rate)
 {
+	std::unique_lock<std::mutex> lock(m_miscMutex);
+
 	if (m_baudRate != rate)
 	{
 		m_baudRate = rate;
+		lock.unlock();
 		deviceSettingsChanged();
 	}
 }
 
 void Printer::deviceSettingsChanged()
 {
-	if (m_state != State::Stopped)
-	{
-		// Reconnect
-		reset();
-		BOOST_LOG_TRIVIAL(trace) << "Reconnecting to " << m_uniqueName << " due to device settings change";
-		doConnect();
-	}
+	boost::asio::post(m_strand, [this]() {
+		if (m_state != State::Stopped)
+		{
+			// Reconnect
+			reset();
+			BOOST_LOG_TRIVIAL(trace) << "Reconnecting to " << m_uniqueName << " due to device settings change";
+			doConnect();
+		}
+	});
 }
 
 void Printer::start()
 {
-	if (m_state != State::Stopped)
-		return;
+	boost::asio::dispatch(m_strand, [this]() {
+		if (m_state != State::Stopped)
+			return;
 
-	BOOST_LOG_TRIVIAL(info) << "Printer " << m_uniqueName << " started";
-	setState(State::Disconnected);
-	doConnect();
+		BOOST_LOG_TRIVIAL(info) << "Printer " << m_uniqueName << " started";
+		setState(State::Disconnected);
+		doConnect();
+	});
 }
 
 void Printer::stop()
 {
-	BOOST_LOG_TRIVIAL(info) << "Printer " << m_uniqueName << " stopped";
-	setState(State::Stopped);
-	reset();
+	boost::asio::dispatch(m_strand, [this]() {
+		BOOST_LOG_TRIVIAL(info) << "Printer " << m_uniqueName << " stopped";
+		setState(State::Stopped);
+		reset();
+	});
 }
 
 void Printer::reset()
@@ -152,8 +208,14 @@ void Printer::reset()
 
 	m_reconnectTimer.cancel(ec);
 	m_timeoutTimer.cancel(ec);
-	m_executingCommand.clear();
+	m_temperatureTimer.cancel(ec);
+	m_statsTimer.cancel(ec);
+	m_writing = false;
+	m_autoReportTemp = false;
+
+	std::unique_lock<std::mutex> lock(m_temperaturesMutex);
 	m_temperatures.clear();
+	lock.unlock();
 
 	resetCommandQueue();
 }
@@ -161,14 +223,83 @@ void Printer::reset()
 void Printer::resetCommandQueue()
 {
 	m_replyLines.clear();
+	failInflightCommands();
 
 	while (!m_commandQueue.empty())
 	{
 		// m_replyLines is empty, which will indicate failure
-		if (m_commandQueue.front().callback)
-			m_commandQueue.front().callback(m_replyLines);
-		m_commandQueue.pop();
+		m_commandQueue.front().complete(m_replyLines);
+		m_commandQueue.pop_front();
+	}
+}
+
+void Printer::failInflightCommands()
+{
+	m_replyLines.clear();
+
+	// The job must not carry on once the connection is back
+	m_jobFeed.reset();
+
+	while (!m_inflight.empty())
+	{
+		// m_replyLines is empty, which will indicate failure
+		m_inflight.front().complete(m_replyLines);
+		m_inflight.pop_front();
+	}
+
+	m_inflightBytes = 0;
+	m_lastResendLine = -1;
+	m_resendSwallow = 0;
+
+	clearResendHistory();
+}
+
+void Printer::clearResendHistory()
+{
+	const int depth = std::max(int(m_resendHistoryDepth), 1);
+
+	if (m_resendHistory.size() != size_t(depth))
+	{
+		m_resendHistory.clear();
+		m_resendHistory.resize(depth);
+	}
+
+	// Drop references to job files
+	for (HistoryLine& h : m_resendHistory)
+	{
+		h.lineNo = -1;
+		h.owner.reset();
+	}
+}
+
+void Printer::setupTemperatureReporting()
+{
+	m_autoReportTemp = false;
+
+	if (!hasCapability("AUTOREPORT_TEMP"))
+	{
+		getTemperature();
+		return;
 	}
+
+	const std::string cmd = "M155 S" + std::to_string(m_temperatureInterval);
+
+	sendCommand(cmd.c_str(), [=](const std::vector<std::string>& reply) {
+		if (reply.empty())
+			return;
+
+		auto unknown = std::find_if(reply.begin(), reply.end(), [](const std::string& line) {
+			return line.find("Unknown command") != std::string::npos;
+		});
+
+		if (unknown == reply.end())
+		{
+			BOOST_LOG_TRIVIAL(debug) << "Using temperature auto-reporting on printer " << m_uniqueName;
+			m_autoReportTemp = true;
+		}
+		else
+			getTemperature();
+	});
 }
 
 void Printer::getTemperature()
@@ -177,86 +308,86 @@ void Printer::getTemperature()
 		return;
 
 	sendCommand("M105", [=](const std::vector<std::string>& response) {
-		if (!response.empty())
-		{
-			parseTemperatures(response[response.size()-1]);
-		}
+		// Connection lost, polling restarts once connected again
+		if (response.empty())
+			return;
 
-		m_temperatureTimer.expires_from_now(boost::posix_time::seconds(5));
-		m_temperatureTimer.async_wait([=](const boost::system::error_code& ec) {
+		parseTemperatures(response[response.size()-1]);
+
+		m_temperatureTimer.expires_from_now(boost::posix_time::seconds(int(m_temperatureInterval)));
+		m_temperatureTimer.async_wait(boost::asio::bind_executor(m_strand, [=](const boost::system::error_code& ec) {
 			if (!ec)
 				getTemperature();
-		});
+		}));
 	});
 }
 
-void Printer::parseTemperatures(const std::string& line)
+void Printer::parseTemperatures(std::string_view line)
 {
-	std::map<std::string, std::string> values;
-	std::map<std::string, float> changes;
-
-	kvParse(line, values);
+	TemperatureReading readings[TemperatureHistory::MAX_SENSORS];
+	const size_t count = parseTemperatureReport(line, readings, TemperatureHistory::MAX_SENSORS);
 
-	TemperaturePoint point;
-	TemperaturePoint* prevPoint = nullptr;
+	if (count == 0)
+		return;
 
-	point.when = std::chrono::system_clock::now();
+	// Previous values of each reading, for change notifications
+	float prevValues[TemperatureHistory::MAX_SENSORS][2];
+	bool hasPrev[TemperatureHistory::MAX_SENSORS];
+	int sensors[TemperatureHistory::MAX_SENSORS];
 
 	std::unique_lock<std::mutex> lock(m_temperaturesMutex);
-	if (!m_temperatures.empty())
-		prevPoint = &m_temperatures.back();
-
-	lock.unlock();
 
-	for (auto it : values)
+	for (size_t i = 0; i < count; i++)
 	{
-		// TODO: Multiple tools support
-		// TODO: Temp updates (e.g. during preheat) don't contain all the keys as M105 replies
-		if (it.first != "T" && it.first != "B")
-			continue;
+		sensors[i] = m_temperatures.sensorId(readings[i].sensor());
+		hasPrev[i] = false;
 
-		Temperature& temp = point.values[it.first];
-		Temperature* prevTemp = nullptr;
-		ssize_t slash;
+		if (sensors[i] == -1)
+			continue;
 
-		if (prevPoint != nullptr)
+		if (readings[i].kind == TemperatureReading::Kind::Temperature)
+			hasPrev[i] = m_temperatures.latest(sensors[i], prevValues[i][0], prevValues[i][1]);
+		else
 		{
-			auto it2 = prevPoint->values.find(it.first);
-			if (it2 != prevPoint->values.end())
-				prevTemp = &it2->second;
+			prevValues[i][0] = m_temperatures.latestPower(sensors[i]);
+			hasPrev[i] = !std::isnan(prevValues[i][0]);
 		}
+	}
 
-		try
-		{
-			float value;
+	m_temperatures.beginSample(std::chrono::system_clock::now());
 
-			slash = it.second.find('/');
-			value = std::stof(it.second);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (sensors[i] == -1)
+			continue;
 
-			if (!prevTemp || value != prevTemp->current)
-				changes.emplace(it.first + ".current", value);
-			temp.current = value;
+		if (readings[i].kind == TemperatureReading::Kind::Temperature)
+			m_temperatures.set(sensors[i], readings[i].current, readings[i].target);
+		else
+			m_temperatures.setPower(sensors[i], readings[i].current);
+	}
+	lock.unlock();
 
-			if (slash != std::string::npos)
-			{
-				value = std::stof(it.second.substr(slash + 1));
+	// Only changed values make it into the (allocating) signal
+	std::map<std::string, float> changes;
 
-				if (!prevTemp || value != prevTemp->target)
-					changes.emplace(it.first + ".target", value);
-				temp.target = value;
-			}
-		}
-		catch (const std::exception& e)
+	for (size_t i = 0; i < count; i++)
+	{
+		const TemperatureReading& r = readings[i];
+		const std::string_view sensor = r.sensor();
+
+		if (r.kind == TemperatureReading::Kind::Power)
 		{
-			BOOST_LOG_TRIVIAL(warning) << "Failed to parse temperatures on " << m_uniqueName << ": " << line;
+			if (!hasPrev[i] || r.current != prevValues[i][0])
+				changes.emplace(std::string(sensor).append(".power"), r.current);
+			continue;
 		}
-	}
 
-	lock.lock();
-	m_temperatures.push_back(point);
-	while (point.when - m_temperatures.front().when > MAX_TEMPERATURE_HISTORY)
-		m_temperatures.pop_front();
-	lock.unlock();
+		if (!hasPrev[i] || r.current != prevValues[i][0])
+			changes.emplace(std::string(sensor).append(".current"), r.current);
+		if (!std::isnan(r.target) && (!hasPrev[i] || r.target != prevValues[i][1]))
+			changes.emplace(std::string(sensor).append(".target"), r.target);
+	}
 
 	if (!changes.empty())
 	{
@@ -264,10 +395,19 @@ void Printer::parseTemperatures(const std::string& line)
 	}
 }
 
-std::list<Printer::TemperaturePoint> Printer::getTemperatureHistory() const
+bool Printer::isTemperatureReport(std::string_view line)
 {
-	std::unique_lock<std::mutex> lock(m_temperaturesMutex);
-	return m_temperatures;
+	while (!line.empty() && line[0] == ' ')
+		line.remove_prefix(1);
+
+	// " T:210.00 /210.00 B:60.00 /60.00 @:0 B@:0", Klipper starts with "B:"
+	return line.length() > 2 && (line[0] == 'T' || line[0] == 'B') && (line[1] == ':' || isdigit(line[1]));
+}
+
+TemperatureHistory::Slice Printer::getTemperatureHistory(std::chrono::system_clock::time_point since, std::chrono::system_clock::duration step) const
+{
+	std::lock_guard<std::mutex> lock(m_temperaturesMutex);
+	return m_temperatures.query(since, step);
 }
 
 void Printer::setState(State state)
@@ -294,33 +434,77 @@ void Printer::setState(State state)
 
 void Printer::sendCommand(const char* cmd, CommandCallback cb, const std::string& gcodeTag)
 {
-	std::string cmdCopy(cmd);
-	std::string tagCopy(gcodeTag);
+	PendingCommand pc;
+
+	pc.text = cmd;
+	pc.tag = gcodeTag;
+	pc.callback = std::move(cb);
+
+	boost::asio::post(m_strand, [this, pc = std::move(pc)]() mutable {
+		m_commandQueue.push_back(std::move(pc));
+		doWrite();
+	});
+}
+
+void Printer::sendCommand(std::string_view cmd, std::shared_ptr<const void> owner, CommandCallback cb, int checksum)
+{
+	PendingCommand pc;
+
+	pc.view = cmd;
+	pc.owner = std::move(owner);
+	pc.checksum = checksum;
+	pc.callback = std::move(cb);
+
+	boost::asio::post(m_strand, [this, pc = std::move(pc)]() mutable {
+		m_commandQueue.push_back(std::move(pc));
+		doWrite();
+	});
+}
 
-	m_io.post([=]() {
-		m_commandQueue.push({ std::move(cmdCopy), std::move(tagCopy), cb });
+void Printer::setJobFeed(std::shared_ptr<JobFeed> feed)
+{
+	boost::asio::post(m_strand, [this, feed]() {
+		m_jobFeed = feed;
 		doWrite();
 	});
 }
 
+void Printer::jobFeedChanged()
+{
+	boost::asio::post(m_strand, std::bind(&Printer::doWrite, this));
+}
+
+void Printer::CommandOrigin::complete(const std::vector<std::string>& reply)
+{
+	if (callback)
+		callback(reply);
+	else if (jobFeed)
+		jobFeed->confirm(jobPosition, reply);
+}
+
 void Printer::doConnect()
 {
 	if (m_state == State::Stopped)
 		return;
 
+	std::unique_lock<std::mutex> lock(m_miscMutex);
+	const std::string devicePath = m_devicePath;
+	const int baudRate = m_baudRate;
+	lock.unlock();
+
 	try
 	{
-		if (!boost::starts_with(m_devicePath, "tcp:"))
+		if (!boost::starts_with(devicePath, "tcp:"))
 		{
 			m_usingSocket = false;
-			BOOST_LOG_TRIVIAL(debug) << "Opening serial port " << m_devicePath;
+			BOOST_LOG_TRIVIAL(debug) << "Opening serial port " << devicePath;
 
-			m_serial.open(m_devicePath.c_str());
+			m_serial.open(devicePath.c_str());
 
 			::ioctl(m_serial.native_handle(), TIOCEXCL);
 			setNoResetOnReopen();
 
-			m_serial.set_option(boost::asio::serial_port_base::baud_rate(m_baudRate));
+			m_serial.set_option(boost::asio::serial_port_base::baud_rate(baudRate));
 			m_serial.set_option(boost::asio::serial_port_base::character_size(8));
 			m_serial.set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
 			m_serial.set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
@@ -330,22 +514,22 @@ void Printer::doConnect()
 		}
 		else
 		{
-			auto lpos = m_devicePath.rfind(':');
+			auto lpos = devicePath.rfind(':');
 			if (lpos == 3)
 			{
-				BOOST_LOG_TRIVIAL(error) << "Invalid address: " << m_devicePath;
+				BOOST_LOG_TRIVIAL(error) << "Invalid address: " << devicePath;
 				return;
 			}
 
-			std::string address = m_devicePath.substr(4, lpos-4);
-			int port = atoi(m_devicePath.c_str() + lpos + 1);
+			std::string address = devicePath.substr(4, lpos-4);
+			int port = atoi(devicePath.c_str() + lpos + 1);
 
 			m_usingSocket = true;
 			boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(address), port);
 
 			BOOST_LOG_TRIVIAL(debug) << "Opening TCP connection to " << endpoint;
 
-			m_socket.async_connect(endpoint, [=](boost::system::error_code ec) {
+			m_socket.async_connect(endpoint, boost::asio::bind_executor(m_strand, [=](boost::system::error_code ec) {
 				boost::system::error_code dummy;
 				m_timeoutTimer.cancel(dummy);
 
@@ -356,10 +540,10 @@ void Printer::doConnect()
 				}
 				else
 					connected();
-			});
+			}));
 
 			m_timeoutTimer.expires_from_now(boost::posix_time::seconds(5));
-			m_timeoutTimer.async_wait([=](boost::system::error_code ec) {
+			m_timeoutTimer.async_wait(boost::asio::bind_executor(m_strand, [=](boost::system::error_code ec) {
 				if (!ec)
 				{
 					BOOST_LOG_TRIVIAL(error) << "TCP connection timeout";
@@ -367,12 +551,12 @@ void Printer::doConnect()
 					m_socket.cancel(ec);
 					setupReconnect();
 				}
-			});
+			}));
 		}
 	}
 	catch (const std::exception &e)
 	{
-		BOOST_LOG_TRIVIAL(error) << "Failed to open printer port " << m_devicePath << ": " << e.what();
+		BOOST_LOG_TRIVIAL(error) << "Failed to open printer port " << devicePath << ": " << e.what();
 
 		setupReconnect();
 	}
@@ -382,10 +566,10 @@ void Printer::setupReconnect()
 {
 	// Retry in a short while
 	m_reconnectTimer.expires_from_now(RECONNECT_DELAY);
-	m_reconnectTimer.async_wait([=](const boost::system::error_code& ec) {
+	m_reconnectTimer.async_wait(boost::asio::bind_executor(m_strand, [=](const boost::system::error_code& ec) {
 		if (!ec)
 			doConnect();
-	});
+	}));
 }
 
 void Printer::connected()
@@ -397,8 +581,16 @@ void Printer::connected()
 	m_lastIncomingData = std::chrono::steady_clock::now();
 	setupTimeoutCheck();
 
+	m_linkStats.clear();
+	{
+		std::unique_lock<std::mutex> lock(m_linkStatsMutex);
+		m_linkStatsReport = LinkStats::Report();
+		m_linkStatsReport.when = std::chrono::system_clock::now();
+	}
+	setupStatsReport();
+
 	m_reconnectTimer.expires_from_now(boost::posix_time::seconds(1));
-	m_reconnectTimer.async_wait([=](const boost::system::error_code& ec) {
+	m_reconnectTimer.async_wait(boost::asio::bind_executor(m_strand, [=](const boost::system::error_code& ec) {
 		// This is a workaround that helps get rid of trash in the input buffer,
 		// but so far things work OK without it.
 		// ::usleep(10000);
@@ -410,29 +602,71 @@ void Printer::connected()
 		// sendCommand("G4 P0", nullptr);
 		sendCommand("M110 N0", nullptr);
 		m_nextLineNo = 1;
+		clearResendHistory();
 
 		// Get printer information
 		sendCommand("M115", [=](const std::vector<std::string>& reply) {
-			if (reply.size() >= 2)
-			{
-				kvParse(reply[reply.size() - 2], m_baseParameters);
-				for (auto it = m_baseParameters.begin(); it != m_baseParameters.end(); it++)
-					std::cout << it->first << " -> " << it->second << std::endl;
-			}
+			parseFirmwareInfo(reply);
 
 			if (!reply.empty())
 			{
 				setState(State::Connected);
 				showStartupMessage();
-				getTemperature();
+				setupTemperatureReporting();
 			}
 		});
 
+		// Motion limits for print time estimates
+		sendCommand("M503", [=](const std::vector<std::string>& reply) {
+			std::lock_guard<std::mutex> lock(m_miscMutex);
+
+			m_motionLimits = MotionLimits();
+			for (const std::string& line : reply)
+				m_motionLimits.parse(line);
+		});
+
 		doWrite();
-	});
+	}));
 	
 }
 
+void Printer::parseFirmwareInfo(const std::vector<std::string>& reply)
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+
+	m_baseParameters.clear();
+	m_capabilities.clear();
+
+	for (const std::string& line : reply)
+	{
+		if (boost::starts_with(line, "Cap:"))
+		{
+			// Cap:AUTOREPORT_TEMP:1
+			auto colon = line.rfind(':');
+			if (colon > 4 && line.compare(colon + 1, std::string::npos, "1") == 0)
+				m_capabilities.emplace(line.substr(4, colon - 4));
+		}
+		else if (m_baseParameters.empty() && line.find(':') != std::string::npos)
+		{
+			kvParse(line, m_baseParameters);
+			for (auto it = m_baseParameters.begin(); it != m_baseParameters.end(); it++)
+				std::cout << it->first << " -> " << it->second << std::endl;
+		}
+	}
+}
+
+bool Printer::hasCapability(std::string_view cap) const
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	return m_capabilities.find(cap) != m_capabilities.end();
+}
+
+MotionLimits Printer::motionLimits() const
+{
+	std::lock_guard<std::mutex> lock(m_miscMutex);
+	return m_motionLimits;
+}
+
 void Printer::showStartupMessage()
 {
 	sendCommand("M117 DashPrint connected", nullptr);
@@ -456,7 +690,7 @@ void Printer::setNoResetOnReopen()
 void Printer::setupTimeoutCheck()
 {
 	m_timeoutTimer.expires_from_now(boost::posix_time::seconds(1));
-	m_timeoutTimer.async_wait(std::bind(&Printer::timeoutCheck, this, std::placeholders::_1));
+	m_timeoutTimer.async_wait(boost::asio::bind_executor(m_strand, std::bind(&Printer::timeoutCheck, this, std::placeholders::_1)));
 }
 
 void Printer::timeoutCheck(const boost::system::error_code& ec)
@@ -464,12 +698,13 @@ void Printer::timeoutCheck(const boost::system::error_code& ec)
 	if (ec)
 		return;
 
-	if (!m_commandQueue.empty())
+	if (!m_commandQueue.empty() || !m_inflight.empty())
 	{
 		auto now = std::chrono::steady_clock::now();
 		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - m_lastIncomingData).count() > DATA_TIMEOUT)
 		{
 			BOOST_LOG_TRIVIAL(error) << "Comm timeout on printer " << m_uniqueName;
+			m_linkStats.timedOut();
 
 			setState(State::Disconnected);
 			reset();
@@ -481,6 +716,41 @@ void Printer::timeoutCheck(const boost::system::error_code& ec)
 	setupTimeoutCheck();
 }
 
+void Printer::setupStatsReport()
+{
+	m_statsTimer.expires_from_now(boost::posix_time::seconds(1));
+	m_statsTimer.async_wait(boost::asio::bind_executor(m_strand, std::bind(&Printer::statsReport, this, std::placeholders::_1)));
+}
+
+void Printer::statsReport(const boost::system::error_code& ec)
+{
+	if (ec)
+		return;
+
+	// m_linkStatsReport is only ever written on the strand
+	LinkStats::Report report;
+	m_linkStats.fillReport(report, m_linkStatsReport);
+
+	report.queued = m_commandQueue.size();
+	report.jobQueued = m_jobFeed ? m_jobFeed->lines().size() : 0;
+	report.inflight = m_inflight.size();
+	report.inflightBytes = m_inflightBytes;
+
+	{
+		std::unique_lock<std::mutex> lock(m_linkStatsMutex);
+		m_linkStatsReport = report;
+	}
+
+	m_linkStatsSignal(report);
+	setupStatsReport();
+}
+
+LinkStats::Report Printer::linkStats() const
+{
+	std::unique_lock<std::mutex> lock(m_linkStatsMutex);
+	return m_linkStatsReport;
+}
+
 void Printer::ioError(const boost::system::error_code& ec)
 {
 	if (ec != boost::system::errc::operation_canceled)
@@ -498,12 +768,12 @@ void Printer::doRead()
 	if (!m_usingSocket)
 	{
 		boost::asio::async_read_until(m_serial, m_streamBuf, '\n',
-			std::bind(&Printer::readDone, this, std::placeholders::_1));
+			boost::asio::bind_executor(m_strand, std::bind(&Printer::readDone, this, std::placeholders::_1)));
 	}
 	else
 	{
 		boost::asio::async_read_until(m_socket, m_streamBuf, '\n',
-			std::bind(&Printer::readDone, this, std::placeholders::_1));
+			boost::asio::bind_executor(m_strand, std::bind(&Printer::readDone, this, std::placeholders::_1)));
 	}
 }
 
@@ -569,25 +839,32 @@ void Printer::readDone(const boost::system::error_code& ec)
 	safeGetline(is, line);
 
 	m_lastIncomingData = std::chrono::steady_clock::now();
+	m_linkStats.lineReceived(line.length() + 1);
 
 	BOOST_LOG_TRIVIAL(debug) << "Read on printer " << m_uniqueName << ": " << line;
 
-	m_replyLines.push_back(line);
-
+	// Unsolicited M155 report, not a part of any command's reply.
+	// Reports interleaved with M109/M190 progress are handled with the command.
+	if (m_autoReportTemp && isTemperatureReport(line) && executingCommand() != "M109" && executingCommand() != "M190")
 	{
-		GCodeEvent event;
-		event.commandId = m_nextCommandId;
-		event.outgoing = false;
-		event.data = line;
-		event.tag = m_executingTag;
-		
-		raiseGCodeEvent(event);
+		parseTemperatures(line);
+		doRead();
+		return;
 	}
 
+	m_replyLines.push_back(line);
+
+	if (m_inflight.empty())
+		raiseGCodeEvent(m_nextCommandId, false, line, std::string_view());
+	else
+		raiseGCodeEvent(m_inflight.front().commandId, false, line, m_inflight.front().tag);
+
 	// This is the final line
 	if (boost::starts_with(line, "ok ") || line == "ok")
 	{
-		workaroundOverconfirmationBug(is);
+		// With several lines in flight, whatever follows belongs to the next command
+		if (!m_advanceSend)
+			workaroundOverconfirmationBug(is);
 
 		// Handle command re-sending
 		int resendLine = -1;
@@ -611,65 +888,57 @@ void Printer::readDone(const boost::system::error_code& ec)
 			}
 		}
 
-		// Indicates we've just executed an M110 command not present in the queue
-		if (m_nextLineNo == 0)
+		if (resendLine != -1)
 		{
-			m_nextLineNo = 1;
+			BOOST_LOG_TRIVIAL(warning) << "Handling resend for line " << resendLine;
+
+			handleResend(resendLine);
 		}
 		else
-		{
-			if (resendLine != -1)
-			{
-				BOOST_LOG_TRIVIAL(warning) << "Handling resend for line " << resendLine;
-					
-				handleResend(resendLine);
-			}
-			else
-			{
-				if (!m_commandQueue.empty())
-				{
-					auto cb = m_commandQueue.front().callback;
-					if (cb)
-						cb(m_replyLines);
-					m_commandQueue.pop();
-				}
-			}
-		}
+			commandAcknowledged();
 
 		m_replyLines.clear();
-		m_executingCommand.clear();
 
 		doWrite();
 	}
-	else if (m_executingCommand == "M190" || m_executingCommand == "M109")
+	else if (executingCommand() == "M190" || executingCommand() == "M109")
 	{
 		parseTemperatures(line);
 	}
 	else if (line == "start")
 	{
-		m_replyLines.clear();
-		m_executingCommand.clear();
+		if (m_state == State::Connected)
+		{
+			// Fail running print jobs
+			std::unique_lock<std::mutex> lock(m_printJobMutex);
+			if (m_printJob)
+				m_printJob->setError("Printer reset");
+		}
+
+		// Whatever was in flight got lost with the reset
+		failInflightCommands();
 
 		if (m_state == State::Connected || m_state == State::Error)
 		{
-			// The job should be failed already
-			if (m_state != State::Error)
-			{
-				// Fail running print jobs
-				std::unique_lock<std::mutex> lock(m_printJobMutex);
-				if (m_printJob)
-					m_printJob->setError("Printer reset");
-			}
 
 			// Reset line counter
 			m_nextLineNo = MAX_LINENO;
 			showStartupMessage();
+
+			// The reset turned auto-reporting off
+			if (m_autoReportTemp)
+				setupTemperatureReporting();
+
 			doWrite();
 		}
 	}
 	else if (boost::starts_with(line, "Error:"))
 	{
-		raiseError(std::string_view(line).substr(6));
+		// Line number and checksum errors are followed by a resend request
+		if (line.find("Last Line") != std::string::npos)
+			BOOST_LOG_TRIVIAL(warning) << "Transmission error on printer " << m_uniqueName << ": " << line;
+		else
+			raiseError(std::string_view(line).substr(6));
 	}
 
 	doRead();
@@ -703,152 +972,280 @@ std::string Printer::errorMessage() const
 
 void Printer::handleResend(int resendLine)
 {
-	auto resendStart = m_resendHistory.end();
-	for (auto it = m_resendHistory.begin(); it != m_resendHistory.end(); it++)
+	// Every line that was already in flight behind the broken one
+	// gets rejected by the firmware with the very same resend request
+	if (resendLine == m_lastResendLine && m_resendSwallow > 0)
 	{
-		if (std::get<0>(*it) == resendLine)
-		{
-			resendStart = it;
-			break;
-		}
+		m_resendSwallow--;
+		return;
 	}
 
-	if (resendStart == m_resendHistory.end())
+	m_linkStats.resendRequested();
+
+	const int depth = m_resendHistory.size();
+
+	if (resendLine >= m_nextLineNo || m_nextLineNo - resendLine > depth || m_resendHistory[resendLine % depth].lineNo != resendLine)
 	{
 		raiseError("Insufficient line history for resend");
+		return;
 	}
-	else
+
+	// Lines preceding the broken one are still waiting for their own "ok"
+	auto firstResent = std::find_if(m_inflight.begin(), m_inflight.end(), [=](const InflightCommand& ic) {
+		return ic.lineNo >= resendLine;
+	});
+
+	// Splice the rejected lines in front of the queue, the last one first
+	for (int lineNo = m_nextLineNo - 1; lineNo >= resendLine; lineNo--)
 	{
-		auto queueCopy = m_commandQueue;
-		auto it = resendStart;
+		PendingCommand pc;
+		static_cast<CommandText&>(pc) = m_resendHistory[lineNo % depth];
 
-		m_commandQueue = std::queue<PendingCommand>();
+		// Lines that haven't been confirmed yet keep their callbacks
+		auto itInflight = std::find_if(firstResent, m_inflight.end(), [=](const InflightCommand& ic) {
+			return ic.lineNo == lineNo;
+		});
+		if (itInflight != m_inflight.end())
+			static_cast<CommandOrigin&>(pc) = std::move(*itInflight);
 
-		// Omit the last item in resend history, because it is now in queueCopy
-		auto end = --m_resendHistory.end();
-		for (auto it = resendStart; it != end; it++)
-			m_commandQueue.push({ std::get<1>(*it), std::string(), nullptr });
-		while (!queueCopy.empty())
-		{
-			m_commandQueue.push(queueCopy.front());
-			queueCopy.pop();
-		}
+		m_commandQueue.push_front(std::move(pc));
+	}
+
+	m_lastResendLine = resendLine;
+	m_resendSwallow = 0;
+
+	for (auto it = firstResent; it != m_inflight.end(); it++)
+	{
+		if (it->lineNo > resendLine)
+			m_resendSwallow++;
+		m_inflightBytes -= it->length;
+	}
+	m_inflight.erase(firstResent, m_inflight.end());
 
-		m_resendHistory.erase(resendStart, m_resendHistory.end());
-		m_nextLineNo = resendLine;
+	m_nextLineNo = resendLine;
 
-		BOOST_LOG_TRIVIAL(debug) << "Queue size after resend handling: " << m_commandQueue.size();
+	BOOST_LOG_TRIVIAL(debug) << "Queue size after resend handling: " << m_commandQueue.size();
+}
+
+void Printer::commandAcknowledged()
+{
+	if (m_inflight.empty())
+	{
+		BOOST_LOG_TRIVIAL(debug) << "Unexpected ok on printer " << m_uniqueName;
+		return;
 	}
+
+	InflightCommand ic = std::move(m_inflight.front());
+
+	m_inflight.pop_front();
+	m_inflightBytes -= ic.length;
+
+	// The firmware has moved past any rejected lines
+	m_resendSwallow = 0;
+
+	m_linkStats.okReceived(std::chrono::steady_clock::now() - ic.sentAt);
+	ic.complete(m_replyLines);
 }
 
-static std::string extractCommandCode(const std::string& cmd)
+static std::string extractCommandCode(std::string_view cmd)
 {
 	auto pos = cmd.find(' ');
-	if (pos != std::string::npos)
-		return cmd.substr(0, pos);
-	return cmd;
+	if (pos != std::string_view::npos)
+		return std::string(cmd.substr(0, pos));
+	return std::string(cmd);
+}
+
+const std::string& Printer::executingCommand() const
+{
+	static const std::string none;
+
+	if (m_inflight.empty())
+		return none;
+	return m_inflight.front().code;
 }
 
-bool Printer::useLineNumberForExecutingCommand() const
+bool Printer::useLineNumber(const std::string& code)
 {
 	// Omit for the line-setting command
-	if (m_executingCommand == "M110")
+	if (code == "M110")
 		return false;
 
 	// Omit for printer reset
-	if (m_executingCommand == "M999")
+	if (code == "M999")
 		return false;
 	
 	return true;
 }
 
+bool Printer::canSend(size_t length) const
+{
+	if (m_inflight.empty())
+		return true;
+	if (!m_advanceSend)
+		return false;
+
+	// Commands without a line number are never pipelined
+	if (m_inflight.back().lineNo == -1)
+		return false;
+
+	if (m_inflight.size() >= size_t(m_maxInflight))
+		return false;
+
+	return m_inflightBytes + length <= size_t(m_rxBufferSize);
+}
+
 void Printer::doWrite()
 {
-	if (!m_executingCommand.empty() || m_commandQueue.empty())
+	// m_commandBuffer is still being written out
+	if (m_writing)
 		return;
 
-	m_replyLines.clear();
-	m_executingTag.clear();
+	m_commandBuffer.clear();
 
-	if (m_nextLineNo < MAX_LINENO)
+	while (true)
 	{
-		const PendingCommand &pc = m_commandQueue.front();
-		std::stringstream ss;
+		PendingCommand* pc = nullptr;
+		const JobFeed::Line* jobLine = nullptr;
+		std::string_view command;
+		int bodyChecksum;
+
+		// Commands from sendCommand() take priority over the print job
+		if (!m_commandQueue.empty())
+		{
+			pc = &m_commandQueue.front();
+			command = pc->command();
+			bodyChecksum = pc->checksum;
+		}
+		else if (m_jobFeed && (jobLine = m_jobFeed->lines().front()) != nullptr)
+		{
+			command = jobLine->text;
+			bodyChecksum = jobLine->checksum;
+		}
+		else
+			break;
 
-		m_executingCommand = extractCommandCode(pc.command);
-		processCommandEffects(pc.command);
+		InflightCommand ic;
 
-		const bool useLineNumber = useLineNumberForExecutingCommand();
-		if (useLineNumber)
+		if (m_nextLineNo < MAX_LINENO)
 		{
-			m_resendHistory.push_back({ m_nextLineNo, pc.command });
-			if (m_resendHistory.size() > MAX_RESEND_HISTORY)
-				m_resendHistory.pop_front();
+			std::string code = extractCommandCode(command);
 
-			// Prepend next line number
-			ss << 'N' << m_nextLineNo++ << ' ';
-		}
+			const bool lineNumber = useLineNumber(code);
+			if (!lineNumber && !m_inflight.empty())
+				break;
+
+			if (!(lineNumber ? m_framer.frame(m_nextLineNo, command, bodyChecksum) : m_framer.frame(command)))
+			{
+				BOOST_LOG_TRIVIAL(error) << "Command too long for printer " << m_uniqueName << ": " << command;
+
+				CommandOrigin origin;
+				if (pc)
+				{
+					origin = std::move(*pc);
+					m_commandQueue.pop_front();
+				}
+				else
+				{
+					origin.jobFeed = m_jobFeed;
+					origin.jobPosition = jobLine->position;
+					m_jobFeed->lines().pop();
+				}
+
+				origin.complete({});
+				continue;
+			}
+
+			if (!canSend(m_framer.length()))
+				break;
+
+			processCommandEffects(code, command);
 
-		ss << pc.command;
+			if (lineNumber)
+			{
+				HistoryLine& h = m_resendHistory[m_nextLineNo % m_resendHistory.size()];
+
+				// Reuses the string's buffer, job lines aren't copied at all
+				h.lineNo = m_nextLineNo;
+				h.checksum = bodyChecksum;
+				if (pc && !pc->owner)
+				{
+					h.text.assign(pc->text);
+					h.owner.reset();
+				}
+				else
+				{
+					h.view = command;
+					h.owner = pc ? pc->owner : m_jobFeed->owner();
+				}
+
+				ic.lineNo = m_nextLineNo++;
+			}
+			else
+				ic.lineNo = -1;
 
-		if (useLineNumber)
+			ic.code = std::move(code);
+
+			if (pc)
+			{
+				static_cast<CommandOrigin&>(ic) = std::move(*pc);
+				m_commandQueue.pop_front();
+			}
+			else
+			{
+				ic.jobFeed = m_jobFeed;
+				ic.jobPosition = jobLine->position;
+				m_jobFeed->lines().pop();
+			}
+		}
+		else
 		{
-			ss << ' ';
+			// Reset the line counter once everything sent so far is confirmed
+			if (!m_inflight.empty())
+				break;
+
+			m_framer.frame("M110 N0");
+			ic.lineNo = -1;
+			ic.code = "M110";
 
-			unsigned int cs = checksum(ss.str());
-			ss << '*' << cs;
+			m_nextLineNo = 1;
+			clearResendHistory();
 		}
 
-		ss << '\n';
+		ic.length = m_framer.length();
+		ic.commandId = ++m_nextCommandId;
 
-		m_commandBuffer = ss.str();
-		m_executingTag = pc.tag;
-	}
-	else
-	{
-		// Reset the line counter
-		m_commandBuffer = "M110 N0\n";
-		m_executingCommand = "M110";
-		m_nextLineNo = 0; // Will bump to 1 in readDone()
-	}
+		BOOST_LOG_TRIVIAL(debug) << "Write on printer " << m_uniqueName << ": " << m_framer.text();
 
-	BOOST_LOG_TRIVIAL(debug) << "Write on printer " << m_uniqueName << ": " << m_commandBuffer.substr(0, m_commandBuffer.length()-1);
+		raiseGCodeEvent(ic.commandId, true, m_framer.line(), ic.tag);
 
-	{
-		GCodeEvent event;
-		event.commandId = ++m_nextCommandId;
-		event.outgoing = true;
-		event.data = m_commandBuffer;
-		event.tag = m_executingTag;
+		m_linkStats.lineSent(ic.length);
+		ic.sentAt = std::chrono::steady_clock::now();
 
-		raiseGCodeEvent(event);
+		m_inflightBytes += ic.length;
+		m_inflight.push_back(std::move(ic));
+		m_commandBuffer.append(m_framer.line());
 	}
 
+	if (m_commandBuffer.empty())
+		return;
+
+	m_writing = true;
+
 	if (!m_usingSocket)
 	{
 		boost::asio::async_write(m_serial, boost::asio::buffer(m_commandBuffer.c_str(), m_commandBuffer.length()),
-			std::bind(&Printer::writeDone, this, std::placeholders::_1));
+			boost::asio::bind_executor(m_strand, std::bind(&Printer::writeDone, this, std::placeholders::_1)));
 	}
 	else
 	{
 		boost::asio::async_write(m_socket, boost::asio::buffer(m_commandBuffer.c_str(), m_commandBuffer.length()),
-			std::bind(&Printer::writeDone, this, std::placeholders::_1));
+			boost::asio::bind_executor(m_strand, std::bind(&Printer::writeDone, this, std::placeholders::_1)));
 	}
 
 	// Reset timeout calculation
 	m_lastIncomingData = std::chrono::steady_clock::now();
 }
 
-unsigned int Printer::checksum(std::string cmd)
-{
-	unsigned int cs = 0;
-
-	for (int i = 0; i < cmd.length() && cmd[i] != '*'; i++)
-		cs ^= unsigned(cmd[i]);
-
-	return cs & 0xff;
-}
-
 void Printer::writeDone(const boost::system::error_code& ec)
 {
 	if (ec)
@@ -857,50 +1254,58 @@ void Printer::writeDone(const boost::system::error_code& ec)
 		return;
 	}
 
-	// Now we wait for the reply to arrive.
-	// Only then we clear m_executingCommand.
+	m_writing = false;
+
+	// Replies are handled in readDone(),
+	// but there may be more room in the send window by now.
+	doWrite();
 }
 
-void Printer::processCommandEffects(const std::string& line)
+void Printer::processCommandEffects(const std::string& code, std::string_view line)
 {
-	if (m_executingCommand == "M104" || m_executingCommand == "M109")
+	if (code == "M104" || code == "M109")
 	{
 		// Extruder target temp change
 		if (line.length() > 6 && line[5] == 'S')
 			Printer::processTargetTempSetting("T", line);
 	}
-	else if (m_executingCommand == "M140" || m_executingCommand == "M190")
+	else if (code == "M140" || code == "M190")
 	{
 		// Heatbed target temp change
 		if (line.length() > 6 && line[5] == 'S')
 			Printer::processTargetTempSetting("B", line);
 	}
-	else if (m_executingCommand == "G91")
+	else if (code == "M201" || code == "M203" || code == "M204" || code == "M205")
+	{
+		std::lock_guard<std::mutex> lock(m_miscMutex);
+		m_motionLimits.parse(line);
+	}
+	else if (code == "G91")
 	{
 		m_positioningState = { true, true };
 	}
-	else if (m_executingCommand == "G90")
+	else if (code == "G90")
 	{
 		m_positioningState = { false, false };
 	}
-	else if (m_executingCommand == "M83")
+	else if (code == "M83")
 	{
 		m_positioningState.extruderRelativePositioning = true;
 	}
-	else if (m_executingCommand == "M82")
+	else if (code == "M82")
 	{
 		m_positioningState.extruderRelativePositioning = false;
 	}
 }
 
-void Printer::processTargetTempSetting(const char* elem, const std::string& line)
+void Printer::processTargetTempSetting(const char* elem, std::string_view line)
 {
 	// std::unique_lock<std::mutex> lock(m_temperaturesMutex);
 
 	try
 	{
 		Temperature temp = getTemperatures()[elem];
-		float value = std::stof(line.substr(6));
+		float value = std::stof(std::string(line.substr(6)));
 
 		if (value != temp.target)
 		{
@@ -970,11 +1375,17 @@ void Printer::regenerateApiKey()
 
 std::map<std::string, Printer::Temperature> Printer::getTemperatures() const
 {
+	std::map<std::string, Printer::Temperature> result;
 	std::lock_guard<std::mutex> lock(m_temperaturesMutex);
-	if (!m_temperatures.empty())
-		return m_temperatures.back().values;
-	else
-		return std::map<std::string, Printer::Temperature>();
+
+	for (int i = 0; i < m_temperatures.sensorCount(); i++)
+	{
+		Temperature temp;
+		if (m_temperatures.latest(i, temp.current, temp.target))
+			result.emplace(m_temperatures.sensorName(i), temp);
+	}
+
+	return result;
 }
 
 std::shared_ptr<PrintJob> Printer::printJob() const
@@ -1018,24 +1429,36 @@ std::list<Printer::GCodeEvent> Printer::gcodeHistory() const
 	return m_gcodeHistory;
 }
 
-void Printer::raiseGCodeEvent(const GCodeEvent& e)
+void Printer::raiseGCodeEvent(uint64_t commandId, bool outgoing, std::string_view data, std::string_view tag)
 {
 	std::lock_guard<std::mutex> lock(m_gcodeHistoryMutex);
 	if (m_gcodeHistory.size() >= MAX_GCODE_HISTORY)
 	{
-		auto first = m_gcodeHistory.front();
-		do
-		{
+		// Reuse the oldest entry, its strings keep their buffers
+		const uint64_t first = m_gcodeHistory.front().commandId;
+		m_gcodeHistory.splice(m_gcodeHistory.end(), m_gcodeHistory, m_gcodeHistory.begin());
+
+		while (m_gcodeHistory.size() > 1 && m_gcodeHistory.front().commandId == first)
 			m_gcodeHistory.pop_front();
-		}
-		while (m_gcodeHistory.front().commandId == first.commandId);
 	}
-	m_gcodeHistory.push_back(e);
-	m_gcodeSignal(e);
+	else
+		m_gcodeHistory.emplace_back();
+
+	GCodeEvent& e = m_gcodeHistory.back();
+	e.commandId = commandId;
+	e.outgoing = outgoing;
+	e.data.assign(data);
+	e.tag.assign(tag);
+
+	// Emitting copies the event
+	if (!m_gcodeSignal.empty())
+		m_gcodeSignal(e);
 }
 
 void Printer::resetPrinter()
 {
-	if (m_state == State::Error)
-		sendCommand("M999", nullptr);
+	boost::asio::dispatch(m_strand, [this]() {
+		if (m_state == State::Error)
+			sendCommand("M999", nullptr);
+	});
 }
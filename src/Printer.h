@@ -24,7 +24,14 @@
 #include <mutex>
 #include <list>
 #include <chrono>
-#include <list>
+#include <deque>
+#include <set>
+#include <atomic>
+#include "JobFeed.h"
+#include "TemperatureHistory.h"
+#include "LinkStats.h"
+#include "LineFramer.h"
+#include "PrintTimeEstimator.h"
 
 class PrintJob;
 
@@ -43,15 +50,60 @@ public:
 	const char* uniqueName() const { return m_uniqueName.c_str(); }
 	void setUniqueName(const char* name);
 	
-	const char* devicePath() const { return m_devicePath.c_str(); }
+	std::string devicePath() const;
 	void setDevicePath(const char* devicePath);
 	
-	int baudRate() const { return m_baudRate; }
+	int baudRate() const;
 	void setBaudRate(int rate);
 
 	const char* name() const { return m_name.c_str(); }
 	void setName(const char* name) { m_name = name; }
+
+	// "Advance send" keeps several numbered lines in flight instead of waiting for each "ok"
+	bool advanceSend() const { return m_advanceSend; }
+	void setAdvanceSend(bool enable) { m_advanceSend = enable; }
+
+	// How many sent lines are kept around for resend requests. Takes effect on the next connection.
+	int resendHistoryDepth() const { return m_resendHistoryDepth; }
+	void setResendHistoryDepth(int lines) { m_resendHistoryDepth = lines; }
+
+	// Free space in the firmware's serial RX buffer (RX_BUFFER_SIZE in Marlin)
+	int rxBufferSize() const { return m_rxBufferSize; }
+	void setRxBufferSize(int size) { m_rxBufferSize = size; }
+
+	// Max number of commands the firmware can buffer (BUFSIZE in Marlin)
+	int maxInflight() const { return m_maxInflight; }
+	void setMaxInflight(int count) { m_maxInflight = count; }
+
+	// Seconds between temperature updates. Uses M155 auto-reporting if the firmware supports it,
+	// M105 polling otherwise. Takes effect on the next connection.
+	int temperatureInterval() const { return m_temperatureInterval; }
+	void setTemperatureInterval(int seconds) { m_temperatureInterval = seconds; }
+
+	// Max deviation in mm when replacing short G1 moves of print jobs with G2/G3 arcs, 0 disables it.
+	// Only used if the firmware announces ARCS support.
+	double arcTolerance() const { return m_arcTolerance; }
+	void setArcTolerance(double mm) { m_arcTolerance = mm; }
+
+	// Seconds between syncs of the running job's power loss journal to disk, 0 disables the journal
+	int journalInterval() const { return m_journalInterval; }
+	void setJournalInterval(int seconds) { m_journalInterval = seconds; }
+
+	// Where print jobs keep their journal, no journal if empty
+	std::string journalPath() const;
+	void setJournalPath(std::string path);
+
+	// Firmware capabilities enabled in the "Cap:" lines of the M115 reply, e.g. AUTOREPORT_TEMP
+	bool hasCapability(std::string_view cap) const;
+
+	// As reported by M503 on connection and changed by M201-M205 commands since
+	MotionLimits motionLimits() const;
 	
+	// All I/O, timers and queued commands of this printer are serialized on this strand,
+	// so the io_service may be run by several threads.
+	typedef boost::asio::strand<boost::asio::io_service::executor_type> Strand;
+	Strand& strand() { return m_strand; }
+
 	// Connect to the printer and maintain the connection
 	void start();
 	
@@ -72,25 +124,34 @@ public:
 
 	typedef std::function<void(const std::vector<std::string>& reply)> CommandCallback;
 	void sendCommand(const char* cmd, CommandCallback cb, const std::string& gcodeTag = std::string());
+	// Doesn't copy cmd, which has to stay valid for as long as owner exists.
+	// checksum is the XOR of all characters in cmd, if known in advance.
+	void sendCommand(std::string_view cmd, std::shared_ptr<const void> owner, CommandCallback cb, int checksum = -1);
+
+	// Lines of the running print job, sent whenever there are no commands from sendCommand() waiting.
+	// Takes effect after the commands sent so far. Pass nullptr to stop taking lines from the feed.
+	void setJobFeed(std::shared_ptr<JobFeed> feed);
+	// To be called after the job pushes lines into an empty feed
+	void jobFeedChanged();
 
 	boost::signals2::signal<void(State)>& stateChangeSignal() { return m_stateChangeSignal; }
 
-	// TODO: save 30 mins worth of data
 	struct Temperature
 	{
 		float current = 0;
 		float target = 0;
 	};
-	struct TemperaturePoint
-	{
-		std::chrono::system_clock::time_point when;
-		std::map<std::string, Temperature> values;
-	};
 	std::map<std::string, Temperature> getTemperatures() const;
-	std::list<TemperaturePoint> getTemperatureHistory() const;
+	// Samples taken at or after since, thinned out to at most one per step
+	TemperatureHistory::Slice getTemperatureHistory(std::chrono::system_clock::time_point since = {},
+		std::chrono::system_clock::duration step = {}) const;
 
 	boost::signals2::signal<void(std::map<std::string, float>)>& temperatureChangeSignal() { return m_temperatureChangeSignal; }
 
+	// Serial link statistics, refreshed every second while connected
+	LinkStats::Report linkStats() const;
+	boost::signals2::signal<void(LinkStats::Report)>& linkStatsSignal() { return m_linkStatsSignal; }
+
 	struct PrintArea
 	{
 		int width, height, depth;
@@ -153,47 +214,108 @@ private:
 	void setupTimeoutCheck();
 	void timeoutCheck(const boost::system::error_code& ec);
 
+	void setupStatsReport();
+	void statsReport(const boost::system::error_code& ec);
+
+	void setupTemperatureReporting();
 	void getTemperature();
-	void parseTemperatures(const std::string& line);
+	void parseTemperatures(std::string_view line);
+	static bool isTemperatureReport(std::string_view line);
+	void parseFirmwareInfo(const std::vector<std::string>& reply);
 
-	void processCommandEffects(const std::string& line);
-	void processTargetTempSetting(const char* elem, const std::string& line);
+	void processCommandEffects(const std::string& code, std::string_view line);
+	void processTargetTempSetting(const char* elem, std::string_view line);
 
-	static unsigned int checksum(std::string cmd);
 	void setNoResetOnReopen();
 
 	void showStartupMessage();
-	void raiseGCodeEvent(const GCodeEvent& e);
+	void raiseGCodeEvent(uint64_t commandId, bool outgoing, std::string_view data, std::string_view tag);
 	void resetCommandQueue();
+	void failInflightCommands();
 
 	void handleResend(int resendLine);
+	void clearResendHistory();
+	void commandAcknowledged();
 	void raiseError(std::string_view message);
 	void workaroundOverconfirmationBug(std::istream& is);
 
-	bool useLineNumberForExecutingCommand() const;
+	static bool useLineNumber(const std::string& code);
+	bool canSend(size_t length) const;
+	const std::string& executingCommand() const;
 private:
 	std::string m_uniqueName; // As used in REST API URLs
 	std::string m_devicePath, m_name;
 	int m_baudRate = 115200;
-	State m_state = State::Stopped;
+	std::atomic<State> m_state { State::Stopped };
 	boost::asio::io_service& m_io;
+	Strand m_strand;
 
 	boost::asio::serial_port m_serial;
 	boost::asio::ip::tcp::socket m_socket;
 	bool m_usingSocket;
 
-	boost::asio::deadline_timer m_reconnectTimer, m_timeoutTimer, m_temperatureTimer;
+	boost::asio::deadline_timer m_reconnectTimer, m_timeoutTimer, m_temperatureTimer, m_statsTimer;
 
-	struct PendingCommand
+	// Who gets notified once a command has been processed
+	struct CommandOrigin
 	{
-		std::string command, tag;
+		std::string tag;
 		CommandCallback callback;
+		// Print job lines are reported to the feed instead
+		std::shared_ptr<JobFeed> jobFeed;
+		size_t jobPosition = 0;
+
+		// An empty reply indicates failure
+		void complete(const std::vector<std::string>& reply);
+	};
+	struct CommandText
+	{
+		std::string_view command() const { return owner ? view : std::string_view(text); }
+
+		std::string text; // Interactive commands are copied here
+		std::string_view view; // Or point into memory kept alive by owner
+		std::shared_ptr<const void> owner;
+		int checksum = -1;
+	};
+	struct PendingCommand : CommandOrigin, CommandText
+	{
+	};
+	// A numbered line kept for resending, job lines stay in the job's mapped file
+	struct HistoryLine : CommandText
+	{
+		int lineNo = -1;
+	};
+	// A command that has been written out and awaits its "ok"
+	struct InflightCommand : CommandOrigin
+	{
+		int lineNo; // -1 if sent without a line number
+		size_t length; // bytes taken in the firmware's RX buffer
+		uint64_t commandId;
+		std::string code;
+		std::chrono::steady_clock::time_point sentAt;
 	};
 	std::vector<std::string> m_replyLines;
-	std::queue<PendingCommand> m_commandQueue;
+	// Resent lines get spliced in at the front
+	std::deque<PendingCommand> m_commandQueue;
+
+	// Oldest first, each "ok" confirms the front item
+	std::deque<InflightCommand> m_inflight;
+	size_t m_inflightBytes = 0;
+	std::shared_ptr<JobFeed> m_jobFeed;
+	bool m_writing = false;
 
-	std::string m_executingCommand, m_executingTag;
+	std::atomic<bool> m_advanceSend { false };
+	std::atomic<int> m_rxBufferSize { 127 }, m_maxInflight { 4 };
+
+	// Lines sent after a failed one get rejected by the firmware with the same "Resend:" request
+	int m_lastResendLine = -1, m_resendSwallow = 0;
+
+	// Lines written out at once, keeps its capacity between writes
 	std::string m_commandBuffer;
+	LineFramer m_framer;
+	std::atomic<double> m_arcTolerance { 0 };
+	std::atomic<int> m_journalInterval { 2 };
+	std::string m_journalPath;
 	boost::asio::streambuf m_streamBuf;
 
 	boost::signals2::signal<void(State)> m_stateChangeSignal;
@@ -202,8 +324,13 @@ private:
 
 	// M115 result
 	std::map<std::string, std::string> m_baseParameters;
+	std::set<std::string, std::less<>> m_capabilities;
+	MotionLimits m_motionLimits;
+	// The firmware sends temperatures on its own (M155)
+	bool m_autoReportTemp = false;
+	std::atomic<int> m_temperatureInterval { 5 };
 
-	std::list<TemperaturePoint> m_temperatures;
+	TemperatureHistory m_temperatures;
 	mutable std::mutex m_temperaturesMutex;
 
 	PrintArea m_printArea;
@@ -221,11 +348,19 @@ private:
 	static const size_t MAX_GCODE_HISTORY = 100; // max line count
 	std::list<GCodeEvent> m_gcodeHistory;
 
-	static const size_t MAX_RESEND_HISTORY = 50;
-	std::list<std::tuple<int, std::string>> m_resendHistory;
+	// Line N is kept at index N % size()
+	std::vector<HistoryLine> m_resendHistory;
+	std::atomic<int> m_resendHistoryDepth { 500 };
+
+	// Only touched on m_strand, the last report is published under m_linkStatsMutex
+	LinkStats m_linkStats;
+	LinkStats::Report m_linkStatsReport;
+	mutable std::mutex m_linkStatsMutex;
+	boost::signals2::signal<void(LinkStats::Report)> m_linkStatsSignal;
 
 	PositioningState m_positioningState = { false, false };
 
+	// Also guards m_devicePath, m_baudRate, m_capabilities, m_motionLimits and m_journalPath
 	mutable std::mutex m_miscMutex;
 	std::string m_errorMessage;
 };
@@ -13,14 +13,19 @@
 
 #include "PrinterManager.h"
 #include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include "util.h"
+#include "JobJournal.h"
 
-PrinterManager::PrinterManager(boost::asio::io_service& io, boost::property_tree::ptree& config)
-: m_io(io), m_config(config)
+PrinterManager::PrinterManager(boost::asio::io_service& io, boost::property_tree::ptree& config, std::string_view journalDirectory)
+: m_io(io), m_config(config), m_journalDirectory(journalDirectory)
 {
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(m_journalDirectory, ec);
+
 	load();
 }
 
@@ -59,6 +64,14 @@ void PrinterManager::load()
 			std::shared_ptr<Printer> printer = std::make_shared<Printer>(m_io);
 			printer->setUniqueName(it.first.c_str());
 			printer->load(it.second);
+			setJournalPath(printer.get());
+
+			// Left behind by a job that didn't get to finish, see restGetRecovery()
+			if (std::optional<JobJournal::Contents> journal = JobJournal::read(printer->journalPath()))
+			{
+				BOOST_LOG_TRIVIAL(info) << "Print job " << journal->name << " on printer " << it.first
+					<< " can be resumed at offset " << journal->last.offset;
+			}
 
 			m_printers.emplace(it.first, printer);
 		}
@@ -83,6 +96,14 @@ void PrinterManager::regenerateApiKey()
 	m_octoprintApiKey = boost::uuids::to_string(u);
 }
 
+void PrinterManager::setJournalPath(Printer* printer)
+{
+	boost::filesystem::path path(m_journalDirectory);
+
+	path /= std::string(printer->uniqueName()) + ".journal";
+	printer->setJournalPath(path.generic_string());
+}
+
 std::shared_ptr<Printer> PrinterManager::newPrinter()
 {
 	return std::make_shared<Printer>(m_io);
@@ -115,6 +136,7 @@ void PrinterManager::addPrinter(std::shared_ptr<Printer> printer)
 	BOOST_LOG_TRIVIAL(info) << "Adding a new printer, unique name: \""
 							<< printer->uniqueName() << "\", device: " << printer->devicePath();
 	
+	setJournalPath(printer.get());
 	m_printers.insert(std::make_pair(printer->uniqueName(), printer));
 	if (m_defaultPrinter.empty())
 		m_defaultPrinter = printer->uniqueName();
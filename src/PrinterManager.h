@@ -26,7 +26,8 @@
 class PrinterManager
 {
 public:
-	PrinterManager(boost::asio::io_service& io, boost::property_tree::ptree& config);
+	// Print jobs keep their power loss journals in journalDirectory
+	PrinterManager(boost::asio::io_service& io, boost::property_tree::ptree& config, std::string_view journalDirectory);
 	~PrinterManager();
 
 	PrinterManager& operator=(const PrinterManager& that) = delete;
@@ -46,9 +47,11 @@ public:
 private:
 	void save();
 	void load();
+	void setJournalPath(Printer* printer);
 private:
 	boost::asio::io_service& m_io;
 	boost::property_tree::ptree& m_config;
+	const std::string m_journalDirectory;
 	std::map<std::string, std::shared_ptr<Printer>, std::less<>> m_printers;
 	mutable std::mutex m_printersMutex;
 	std::string m_defaultPrinter;
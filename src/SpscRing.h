@@ -0,0 +1,58 @@
+#ifndef _SPSCRING_H
+#define _SPSCRING_H
+#include <atomic>
+#include <array>
+#include <stddef.h>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+template <typename T, size_t Capacity>
+class SpscRing
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+	static constexpr size_t capacity() { return Capacity; }
+
+	// Producer side. Returns false if full.
+	bool push(const T& item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+
+		if (head - m_tail.load(std::memory_order_acquire) == Capacity)
+			return false;
+
+		m_items[head & (Capacity - 1)] = item;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Returns nullptr if empty.
+	const T* front() const
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+		if (tail == m_head.load(std::memory_order_acquire))
+			return nullptr;
+
+		return &m_items[tail & (Capacity - 1)];
+	}
+
+	// Consumer side, only after front() returned an item
+	void pop()
+	{
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Exact only when called from either side
+	size_t size() const
+	{
+		return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+	}
+	bool empty() const { return size() == 0; }
+private:
+	// Separate cache lines so that both sides don't keep invalidating each other
+	alignas(64) std::atomic<size_t> m_head{0};
+	alignas(64) std::atomic<size_t> m_tail{0};
+	std::array<T, Capacity> m_items;
+};
+
+#endif
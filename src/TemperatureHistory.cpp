@@ -0,0 +1,137 @@
+#include "TemperatureHistory.h"
+#include <cmath>
+#include <limits>
+
+static const float NO_VALUE = std::numeric_limits<float>::quiet_NaN();
+
+TemperatureHistory::TemperatureHistory(size_t capacity, Clock::duration maxAge)
+: m_capacity(capacity), m_maxAge(maxAge), m_when(capacity)
+{
+	m_sensors.reserve(MAX_SENSORS);
+}
+
+int TemperatureHistory::sensorId(std::string_view name)
+{
+	for (size_t i = 0; i < m_sensors.size(); i++)
+	{
+		if (m_sensors[i].name == name)
+			return i;
+	}
+
+	if (m_sensors.size() >= MAX_SENSORS)
+		return -1;
+
+	// Earlier samples have no value for a new sensor
+	m_sensors.push_back(Sensor{ std::string(name), std::vector<float>(m_capacity, NO_VALUE),
+		std::vector<float>(m_capacity, NO_VALUE), std::vector<float>(m_capacity, NO_VALUE) });
+	return m_sensors.size() - 1;
+}
+
+void TemperatureHistory::beginSample(Clock::time_point when)
+{
+	while (m_count > 0 && (m_count == m_capacity || when - m_when[m_head] > m_maxAge))
+		dropOldest();
+
+	const size_t s = slot(m_count);
+
+	m_when[s] = when;
+	for (Sensor& sensor : m_sensors)
+		sensor.current[s] = sensor.target[s] = sensor.power[s] = NO_VALUE;
+
+	m_count++;
+}
+
+void TemperatureHistory::set(int sensor, float current, float target)
+{
+	if (m_count == 0)
+		return;
+
+	const size_t s = slot(m_count - 1);
+
+	m_sensors[sensor].current[s] = current;
+	m_sensors[sensor].target[s] = target;
+}
+
+void TemperatureHistory::setPower(int sensor, float power)
+{
+	if (m_count > 0)
+		m_sensors[sensor].power[slot(m_count - 1)] = power;
+}
+
+float TemperatureHistory::latestPower(int sensor) const
+{
+	if (m_count == 0)
+		return NO_VALUE;
+	return m_sensors[sensor].power[slot(m_count - 1)];
+}
+
+bool TemperatureHistory::latest(int sensor, float& current, float& target) const
+{
+	if (m_count == 0)
+		return false;
+
+	const size_t s = slot(m_count - 1);
+
+	current = m_sensors[sensor].current[s];
+	target = m_sensors[sensor].target[s];
+
+	return !std::isnan(current);
+}
+
+void TemperatureHistory::clear()
+{
+	m_head = m_count = 0;
+}
+
+void TemperatureHistory::dropOldest()
+{
+	m_head = (m_head + 1) % m_capacity;
+	m_count--;
+}
+
+size_t TemperatureHistory::lowerBound(Clock::time_point t, size_t from) const
+{
+	size_t lo = from, hi = m_count;
+
+	while (lo < hi)
+	{
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (m_when[slot(mid)] < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+TemperatureHistory::Slice TemperatureHistory::query(Clock::time_point since, Clock::duration step) const
+{
+	Slice slice;
+
+	for (const Sensor& sensor : m_sensors)
+		slice.sensors.push_back(sensor.name);
+
+	size_t i = lowerBound(since, 0);
+
+	while (i < m_count)
+	{
+		const size_t s = slot(i);
+
+		slice.when.push_back(m_when[s]);
+		for (const Sensor& sensor : m_sensors)
+		{
+			slice.current.push_back(sensor.current[s]);
+			slice.target.push_back(sensor.target[s]);
+			slice.power.push_back(sensor.power[s]);
+		}
+
+		if (step > Clock::duration::zero())
+			i = lowerBound(m_when[s] + step, i + 1);
+		else
+			i++;
+	}
+
+	return slice;
+}
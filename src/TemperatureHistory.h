@@ -0,0 +1,71 @@
+#ifndef _TEMPERATUREHISTORY_H
+#define _TEMPERATUREHISTORY_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <stddef.h>
+
+// Fixed-capacity ring of temperature samples stored column by column:
+// one timestamp array plus current/target/power float arrays per sensor.
+// Sensor names are interned into small integer IDs.
+// Not thread-safe, Printer guards it with a mutex.
+class TemperatureHistory
+{
+public:
+	typedef std::chrono::system_clock Clock;
+	static constexpr int MAX_SENSORS = 16;
+
+	// Samples older than maxAge (relative to the newest one) are dropped as well
+	TemperatureHistory(size_t capacity, Clock::duration maxAge);
+
+	// Returns -1 if there are already too many sensors
+	int sensorId(std::string_view name);
+	const std::string& sensorName(int id) const { return m_sensors[id].name; }
+	int sensorCount() const { return m_sensors.size(); }
+
+	// Starts a new sample, sensors not set afterwards have no value in it
+	void beginSample(Clock::time_point when);
+	void set(int sensor, float current, float target);
+	void setPower(int sensor, float power);
+
+	// Values from the newest sample, returns false if the sensor has none there
+	bool latest(int sensor, float& current, float& target) const;
+	float latestPower(int sensor) const;
+
+	bool empty() const { return m_count == 0; }
+	size_t size() const { return m_count; }
+	void clear();
+
+	// Selected samples, values are stored row by row: when.size() x sensors.size().
+	// Missing values are NaN.
+	struct Slice
+	{
+		std::vector<std::string> sensors;
+		std::vector<Clock::time_point> when;
+		std::vector<float> current, target, power;
+	};
+
+	// Samples taken at or after since, each at least step after the previous one
+	Slice query(Clock::time_point since, Clock::duration step) const;
+private:
+	size_t slot(size_t index) const { return (m_head + index) % m_capacity; }
+	// Index of the first sample taken at or after t, searching from index from
+	size_t lowerBound(Clock::time_point t, size_t from) const;
+	void dropOldest();
+private:
+	struct Sensor
+	{
+		std::string name;
+		std::vector<float> current, target, power;
+	};
+
+	const size_t m_capacity;
+	const Clock::duration m_maxAge;
+	std::vector<Clock::time_point> m_when;
+	std::vector<Sensor> m_sensors;
+	// Index of the oldest sample in the arrays and the number of samples
+	size_t m_head = 0, m_count = 0;
+};
+
+#endif
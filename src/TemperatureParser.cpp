@@ -0,0 +1,168 @@
+#include "TemperatureParser.h"
+#include <limits>
+#include <stdint.h>
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parses [+-]digits[.digits], advances p past the number
+static bool parseNumber(const char*& p, const char* end, float& value)
+{
+	static const float POW10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f };
+	const char* s = p;
+	bool negative = false;
+	int64_t mantissa = 0;
+	int fractionDigits = 0, digits = 0;
+
+	if (s < end && (*s == '-' || *s == '+'))
+		negative = *s++ == '-';
+
+	for (; s < end && isDigit(*s); s++, digits++)
+	{
+		if (digits < 18)
+			mantissa = mantissa*10 + (*s - '0');
+	}
+
+	if (s < end && *s == '.')
+	{
+		for (s++; s < end && isDigit(*s); s++)
+		{
+			if (fractionDigits < 9 && digits < 18)
+			{
+				mantissa = mantissa*10 + (*s - '0');
+				fractionDigits++;
+				digits++;
+			}
+		}
+	}
+
+	if (digits == 0)
+		return false;
+
+	value = float(mantissa) / POW10[fractionDigits];
+	if (negative)
+		value = -value;
+
+	p = s;
+	return true;
+}
+
+// Fills in kind and name from the part before the colon, returns false for fields we don't care about
+static bool classifyKey(std::string_view key, TemperatureReading& reading)
+{
+	std::string_view heater = key;
+	char prefix = 0;
+
+	if (key.empty() || key.length() >= sizeof(reading.name))
+		return false;
+
+	if (key.back() == '@')
+	{
+		// "@", "B@", "C@"
+		reading.kind = TemperatureReading::Kind::Power;
+		heater.remove_suffix(1);
+		if (heater.empty())
+			heater = "T";
+	}
+	else if (key[0] == '@')
+	{
+		// "@0", "@1" ...
+		reading.kind = TemperatureReading::Kind::Power;
+		heater.remove_prefix(1);
+		prefix = 'T';
+	}
+	else
+		reading.kind = TemperatureReading::Kind::Temperature;
+
+	if (!prefix)
+	{
+		switch (heater[0])
+		{
+			case 'T':
+				break;
+			case 'B':
+			case 'C':
+			case 'P':
+				if (heater.length() != 1)
+					return false;
+				break;
+			default:
+				return false;
+		}
+	}
+
+	for (size_t i = prefix ? 0 : 1; i < heater.length(); i++)
+	{
+		if (!isDigit(heater[i]))
+			return false;
+	}
+
+	size_t len = 0;
+	if (prefix)
+		reading.name[len++] = prefix;
+	for (char c : heater)
+		reading.name[len++] = c;
+	reading.nameLength = len;
+
+	return true;
+}
+
+size_t parseTemperatureReport(std::string_view line, TemperatureReading* out, size_t maxReadings)
+{
+	const char* p = line.data();
+	const char* end = p + line.length();
+	size_t count = 0;
+
+	while (p < end && count < maxReadings)
+	{
+		while (p < end && isSpace(*p))
+			p++;
+
+		const char* token = p;
+		const char* colon = nullptr;
+
+		while (p < end && !isSpace(*p) && *p != ':')
+			p++;
+		if (p < end && *p == ':')
+			colon = p;
+
+		TemperatureReading& reading = out[count];
+
+		if (!colon || !classifyKey(std::string_view(token, colon - token), reading))
+		{
+			// Skip the whole token
+			while (p < end && !isSpace(*p))
+				p++;
+			continue;
+		}
+
+		p = colon + 1;
+		if (!parseNumber(p, end, reading.current))
+			continue;
+
+		reading.target = std::numeric_limits<float>::quiet_NaN();
+
+		// The target follows either directly ("T:210/215") or as the next token ("T:210 /215")
+		const char* q = p;
+		while (q < end && isSpace(*q))
+			q++;
+
+		if (q < end && *q == '/')
+		{
+			q++;
+			if (parseNumber(q, end, reading.target))
+				p = q;
+		}
+
+		count++;
+	}
+
+	return count;
+}
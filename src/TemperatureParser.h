@@ -0,0 +1,33 @@
+#ifndef _TEMPERATUREPARSER_H
+#define _TEMPERATUREPARSER_H
+#include <string_view>
+#include <stddef.h>
+
+// One field of a temperature report (M105 reply or an auto-report line), e.g.
+//   T:210.3 /215.0    T1:25.0 /0.0    B:60.1 /60.0    C:30.2 /0.0    P:35.1    @:127    B@:0
+struct TemperatureReading
+{
+	enum class Kind
+	{
+		Temperature,
+		Power, // heater PWM, 0-127 in Marlin
+	};
+
+	Kind kind;
+	// Heater/sensor the value belongs to: "T", "T0".."Tn", "B", "C" or "P".
+	// For power fields it's the heater being powered ("@" -> "T", "@1" -> "T1", "B@" -> "B").
+	char name[8];
+	unsigned char nameLength;
+
+	float current;
+	float target; // NaN if not reported
+
+	std::string_view sensor() const { return std::string_view(name, nameLength); }
+};
+
+// Hand-written parser for temperature reports, which doesn't allocate.
+// Unknown fields (W:?, E:0, raw ADC values in parentheses...) are skipped.
+// Returns the number of readings stored into out, at most maxReadings.
+size_t parseTemperatureReport(std::string_view line, TemperatureReading* out, size_t maxReadings);
+
+#endif
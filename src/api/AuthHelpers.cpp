@@ -5,7 +5,7 @@
 
 WebRouter::filter_t checkToken(AuthManager* authManager)
 {
-	return [=](WebRequest& req, WebResponse& resp, WebRouter::handler_t next) {
+	return [=](WebRequest& req, WebResponse& resp, const WebRouter::next_t& next) {
 		std::string_view hdr = req.header(boost::beast::http::field::authorization);
 		if (!hdr.empty())
 		{
@@ -30,7 +30,7 @@ WebRouter::filter_t checkToken(AuthManager* authManager)
 
 WebRouter::filter_t checkOctoprintKey(AuthManager* authManager)
 {
-	return [=](WebRequest& req, WebResponse& resp, WebRouter::handler_t next) {
+	return [=](WebRequest& req, WebResponse& resp, const WebRouter::next_t& next) {
 		std::string_view hdr = req.request()["X-API-Key"];
 
 		if (!hdr.empty())
@@ -0,0 +1,61 @@
+#ifndef API_COALESCEDVALUE_H_
+#define API_COALESCEDVALUE_H_
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+// Last value wins: however often set() gets called, the handler runs on the strand at most rate times a second,
+// always with the latest value. set() may be called from any thread and costs an atomic store,
+// plus a post to the strand whenever no call is pending yet.
+template <typename T>
+class CoalescedValue : public std::enable_shared_from_this<CoalescedValue<T>>
+{
+public:
+	typedef boost::asio::strand<boost::asio::executor> Strand;
+	typedef boost::asio::basic_waitable_timer<std::chrono::steady_clock, boost::asio::wait_traits<std::chrono::steady_clock>, Strand> Timer;
+
+	CoalescedValue(const Strand& strand, double rate, std::function<void(T)> handler)
+	: m_strand(strand), m_timer(strand), m_handler(std::move(handler))
+	{
+		m_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1 / rate));
+	}
+
+	void set(T value)
+	{
+		m_value.store(value, std::memory_order_relaxed);
+
+		if (!m_pending.exchange(true, std::memory_order_acq_rel))
+			boost::asio::post(m_strand, std::bind(&CoalescedValue::schedule, this->shared_from_this()));
+	}
+private:
+	void schedule()
+	{
+		m_timer.expires_at(std::max(std::chrono::steady_clock::now(), m_lastCall + m_period));
+		m_timer.async_wait(std::bind(&CoalescedValue::fire, this->shared_from_this(), std::placeholders::_1));
+	}
+
+	void fire(const boost::system::error_code& ec)
+	{
+		if (ec)
+			return;
+
+		// Values set from now on schedule another call. The load can't move before the exchange,
+		// so a set() that still finds m_pending set has stored a value this call reads.
+		m_pending.exchange(false, std::memory_order_acq_rel);
+		m_lastCall = std::chrono::steady_clock::now();
+		m_handler(m_value.load(std::memory_order_relaxed));
+	}
+private:
+	Strand m_strand;
+	// Runs its handler on m_strand
+	Timer m_timer;
+	std::chrono::steady_clock::duration m_period;
+	std::chrono::steady_clock::time_point m_lastCall;
+	std::atomic<T> m_value { T() };
+	std::atomic<bool> m_pending { false };
+	std::function<void(T)> m_handler;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "FileApi.h"
 #include "web/WebServer.h"
+#include "web/MultipartUpload.h"
 
 namespace
 {
@@ -15,6 +16,7 @@ namespace
 			ff["name"] = file.name;
 			ff["length"] = file.length;
 			ff["mtime"] = file.modifiedTime;
+			ff["metadata"] = file.metadata;
 
 			result.push_back(ff);
 		}
@@ -34,8 +36,18 @@ namespace
 	void restUploadFile(WebRequest& req, WebResponse& resp, FileManager* fileManager)
 	{
 		std::string name = WebRequest::urlDecode(req.pathParam(1));
-		
-		if (req.hasRequestFile())
+
+		// Sent as a form, large bodies are only available this way
+		if (MultipartUpload* upload = req.multipartUpload())
+		{
+			const MultipartUpload::Part* file = upload->part("file");
+
+			if (!file || file->path.empty())
+				throw WebErrors::bad_request("missing file field");
+
+			name = fileManager->saveFile(name.c_str(), file->path);
+		}
+		else if (req.hasRequestFile())
 			name = fileManager->saveFile(name.c_str(), req.requestFile().c_str());
 		else
 			name = fileManager->saveFile(name.c_str(), req.request().body().c_str(), req.request().body().length());
@@ -45,6 +57,29 @@ namespace
 		resp.send(boost::beast::http::status::created);
 	}
 
+	void restGetFileAnalysis(WebRequest& req, WebResponse& resp, FileManager* fileManager)
+	{
+		std::string name = WebRequest::urlDecode(req.pathParam(1));
+
+		if (!boost::filesystem::is_regular_file(fileManager->getFilePath(name)))
+			throw WebErrors::not_found("File not found");
+
+		// Not waited for, the file is analyzed next and the client asks again
+		if (std::optional<nlohmann::json> analysis = fileManager->getAnalysis(name))
+			resp.send(*analysis, WebResponse::http_status::ok);
+		else
+			resp.send(nlohmann::json { { "status", "pending" } }, WebResponse::http_status::accepted);
+	}
+
+	void restGetFileThumbnail(WebRequest& req, WebResponse& resp, FileManager* fileManager)
+	{
+		std::string name = WebRequest::urlDecode(req.pathParam(1));
+		std::string path = FileManager::thumbnailPath(fileManager->getFilePath(name));
+
+		resp.set(WebResponse::http_header::content_type, "image/png");
+		resp.sendFile(path.c_str());
+	}
+
 	void restDownloadFile(WebRequest& req, WebResponse& resp, FileManager* fileManager)
 	{
 		std::string name = WebRequest::urlDecode(req.pathParam(1));
@@ -58,6 +93,8 @@ void routeFile(WebRouter* router, FileManager& fileManager)
 {
 	router->post("files/([^/]+)", restUploadFile, &fileManager);
 	router->get("files/([^/]+)", restDownloadFile, &fileManager);
+	router->get("files/([^/]+)/analysis", restGetFileAnalysis, &fileManager);
+	router->get("files/([^/]+)/thumbnail", restGetFileThumbnail, &fileManager);
 	router->delete_("files/([^/]+)", restDeleteFile, &fileManager);
 	router->get("files", restListFiles, &fileManager);
 }
\ No newline at end of file
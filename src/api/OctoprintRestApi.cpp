@@ -13,49 +13,22 @@ namespace
 	{
 		// TODO: Support "path" parameter
 
-		std::unique_ptr<MultipartFormData> mp(req.multipartBody());
-		const void* fileData = nullptr;
-		size_t fileSize;
-		std::string fileName;
-		bool print = false;
+		// The file part has been spooled next to the storage while it was received
+		MultipartUpload* upload = req.multipartUpload();
 
-		if (!mp)
+		if (!upload)
 			throw WebErrors::bad_request("multipart data expected");
 
-		mp->parse([&](const MultipartFormData::Headers_t& headers, const char* name, const void* data, uint64_t length) {
-			if (std::strcmp(name, "print") == 0)
-			{
-				if (length >= 4 && std::memcmp(data, "true", 4) == 0)
-					print = true;
-			}
-			else if (std::strcmp(name, "file") == 0)
-			{
-				auto itCDP = headers.find("content-disposition");
-				if (itCDP != headers.end())
-				{
-					std::string value;
-					MultipartFormData::Headers_t params;
-
-					MultipartFormData::parseKV(itCDP->second.c_str(), value, params);
-					auto it = params.find("filename");
-
-					if (it != params.end())
-						fileName = it->second;
-				}
-
-				fileData = data;
-				fileSize = length;
-			}
-			return true;
-		});
+		const MultipartUpload::Part* file = upload->part("file");
+		const MultipartUpload::Part* print = upload->part("print");
 
-		if (!fileData || fileName.empty())
+		if (!file || file->path.empty() || file->filename.empty())
 			throw WebErrors::bad_request("missing fields");
 
-		std::string finalFileName = fileManager->saveFile(fileName.c_str(), fileData, fileSize);
+		std::string finalFileName = fileManager->saveFile(file->filename, file->path);
 		std::string filePath = fileManager->getFilePath(finalFileName);
 
-		if (print)
+		if (print && print->value.compare(0, 4, "true") == 0)
 		{
 			std::string defaultPrinter = printerManager->defaultPrinter();
 			std::shared_ptr<Printer> printer = printerManager->printer(defaultPrinter);
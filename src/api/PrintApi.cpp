@@ -13,13 +13,18 @@
 
 #include "PrintApi.h"
 #include <sstream>
+#include <charconv>
+#include <cmath>
 #include "web/web.h"
 #include "nlohmann/json.hpp"
 #include "PrinterDiscovery.h"
 #include "PrinterManager.h"
 #include "util.h"
 #include "PrintJob.h"
+#include "GCodePipeline.h"
+#include "ArcFitter.h"
 #include "AuthManager.h"
+#include "JobJournal.h"
 
 namespace
 {
@@ -57,7 +62,14 @@ namespace
 				{"height", printer->printArea().height},
 				{"depth", printer->printArea().depth},
 				{"state", Printer::stateName(printer->state())},
-				{"errorMessage", printer->errorMessage()}
+				{"errorMessage", printer->errorMessage()},
+				{"advance_send", printer->advanceSend()},
+				{"rx_buffer_size", printer->rxBufferSize()},
+				{"max_inflight", printer->maxInflight()},
+				{"temperature_interval", printer->temperatureInterval()},
+				{"resend_history_depth", printer->resendHistoryDepth()},
+				{"arc_tolerance", printer->arcTolerance()},
+				{"journal_interval", printer->journalInterval()}
 		};
 	}
 
@@ -142,6 +154,21 @@ namespace
 
 		printer->setPrintArea(area);
 
+		if (data["advance_send"].is_boolean())
+			printer->setAdvanceSend(data["advance_send"].get<bool>());
+		if (data["rx_buffer_size"].is_number() && data["rx_buffer_size"].get<int>() > 0)
+			printer->setRxBufferSize(data["rx_buffer_size"].get<int>());
+		if (data["max_inflight"].is_number() && data["max_inflight"].get<int>() > 0)
+			printer->setMaxInflight(data["max_inflight"].get<int>());
+		if (data["temperature_interval"].is_number() && data["temperature_interval"].get<int>() > 0)
+			printer->setTemperatureInterval(data["temperature_interval"].get<int>());
+		if (data["resend_history_depth"].is_number() && data["resend_history_depth"].get<int>() > 0)
+			printer->setResendHistoryDepth(data["resend_history_depth"].get<int>());
+		if (data["arc_tolerance"].is_number() && data["arc_tolerance"].get<double>() >= 0)
+			printer->setArcTolerance(data["arc_tolerance"].get<double>());
+		if (data["journal_interval"].is_number() && data["journal_interval"].get<int>() >= 0)
+			printer->setJournalInterval(data["journal_interval"].get<int>());
+
 		if (data["stopped"].is_boolean())
 		{
 			bool stop = data["stopped"].get<bool>();
@@ -211,23 +238,92 @@ namespace
 		resp.send(WebResponse::http_status::no_content);
 	}
 
+	// E.g. [{"type": "feedrate", "factor": 1.2}, {"type": "m73_progress"}], applied in this order
+	std::vector<std::unique_ptr<GCodeStage>> jobStagesFromJson(const nlohmann::json& transforms, Printer* printer)
+	{
+		std::vector<std::unique_ptr<GCodeStage>> stages;
+
+		if (transforms.is_null())
+			return stages;
+		if (!transforms.is_array())
+			throw WebErrors::bad_request("'transforms' must be an array");
+
+		for (const nlohmann::json& transform : transforms)
+		{
+			if (!transform.is_object() || !transform.contains("type") || !transform["type"].is_string())
+				throw WebErrors::bad_request("missing transform 'type'");
+
+			const std::string type = transform["type"].get<std::string>();
+			auto number = [&](const char* name) {
+				if (!transform.contains(name) || !transform[name].is_number())
+					throw WebErrors::bad_request(std::string("missing '") + name + "' for transform " + type);
+				return transform[name].get<double>();
+			};
+			auto positive = [&](const char* name) {
+				const double value = number(name);
+				if (!(value > 0))
+					throw WebErrors::bad_request(std::string("'") + name + "' must be positive");
+				return value;
+			};
+
+			if (type == "strip_comments")
+				stages.push_back(std::make_unique<StripCommentsStage>());
+			else if (type == "strip_line_numbers")
+				stages.push_back(std::make_unique<StripLineNumbersStage>());
+			else if (type == "m73_progress")
+				stages.push_back(std::make_unique<ProgressStage>());
+			else if (type == "feedrate")
+				stages.push_back(std::make_unique<ScaleParamStage>('F', positive("factor")));
+			else if (type == "flow")
+				stages.push_back(std::make_unique<ScaleParamStage>('E', positive("factor")));
+			else if (type == "z_offset")
+				stages.push_back(std::make_unique<ZOffsetStage>(number("offset")));
+			else if (type == "arc_fit")
+			{
+				if (!printer->hasCapability("ARCS"))
+					throw WebErrors::bad_request("The printer doesn't support arcs");
+				stages.push_back(std::make_unique<ArcFitStage>(positive("tolerance")));
+			}
+			else
+				throw WebErrors::bad_request("Unknown transform: " + type);
+		}
+
+		return stages;
+	}
+
 	void restSubmitJob(WebRequest& req, WebResponse& resp, PrinterManager* printerManager, FileManager* fileManager)
 	{
 		// If there's a paused/running print job, report a conflict
 		// else create a new PrintJob based on the file name passed and start it.
 		nlohmann::json jreq = req.jsonRequest();
 
-		if (!jreq["file"].is_string())
-			throw WebErrors::bad_request("missing 'file' param");
-
 		std::string printerName = req.pathParam(1);
 		std::shared_ptr<Printer> printer = printerManager->printer(printerName.c_str());
 
 		if (!printer)
 			throw WebErrors::not_found("Printer not found");
 
-		std::shared_ptr<PrintJob> printJob = printer->printJob();
-		if (printJob && (printJob->state() == PrintJob::State::Paused || printJob->state() == PrintJob::State::Running))
+		// Resuming where the journal says the last job got, the file defaults to that job's
+		std::optional<JobJournal::Contents> journal;
+		if (jreq["recover"].is_boolean() && jreq["recover"].get<bool>())
+		{
+			journal = JobJournal::read(printer->journalPath());
+			if (!journal)
+				throw WebErrors::not_found("No job to recover");
+			if (!jreq.contains("file"))
+				jreq["file"] = journal->name;
+			if (jreq.contains("layer") || jreq.contains("offset"))
+				throw WebErrors::bad_request("'recover' excludes 'layer' and 'offset'");
+		}
+
+		if (!jreq["file"].is_string())
+			throw WebErrors::bad_request("missing 'file' param");
+
+		auto busy = [&]() {
+			std::shared_ptr<PrintJob> printJob = printer->printJob();
+			return printJob && (printJob->state() == PrintJob::State::Paused || printJob->state() == PrintJob::State::Running);
+		};
+		if (busy())
 		{
 			resp.send(WebResponse::http_status::conflict);
 			return;
@@ -239,7 +335,80 @@ namespace
 		if (!boost::filesystem::is_regular_file(filePath))
 			throw WebErrors::not_found(".gcode file not found");
 		
-		printJob = std::make_shared<PrintJob>(printer, fileName, filePath.c_str());
+		std::vector<std::unique_ptr<GCodeStage>> stages = jobStagesFromJson(jreq["transforms"], printer.get());
+
+		std::shared_ptr<PrintJob> printJob = std::make_shared<PrintJob>(printer, fileName, filePath.c_str(), std::move(stages));
+
+		// Resuming a failed print, "layer" is an index into the file's analysis
+		if (jreq.contains("layer") || jreq.contains("offset"))
+		{
+			const char* param = jreq.contains("layer") ? "layer" : "offset";
+
+			if (jreq.contains("layer") && jreq.contains("offset"))
+				throw WebErrors::bad_request("'layer' and 'offset' are mutually exclusive");
+			if (!jreq[param].is_number_unsigned())
+				throw WebErrors::bad_request(std::string("invalid '") + param + "' param");
+		}
+
+		if (journal && (journal->name != fileName || journal->size != boost::filesystem::file_size(filePath)))
+			throw WebErrors::bad_request("The file has changed since the job was journaled");
+
+		if (jreq.contains("layer") || jreq.contains("offset") || journal)
+		{
+			FileManager::StartPoint start;
+			std::exception_ptr error;
+
+			// Finding it reads the file, the analysis threads do that while the server goes on with other requests
+			req.await([&](std::function<void()> resume) {
+				fileManager->post([&, resume]() {
+					try
+					{
+						if (journal)
+							start = fileManager->offsetStartPoint(fileName, journal->last.offset);
+						else if (jreq.contains("layer"))
+							start = fileManager->layerStartPoint(fileName, jreq["layer"].get<size_t>());
+						else
+							start = fileManager->offsetStartPoint(fileName, jreq["offset"].get<uint64_t>());
+					}
+					catch (...)
+					{
+						error = std::current_exception();
+					}
+					resume();
+				});
+			});
+
+			try
+			{
+				if (error)
+					std::rethrow_exception(error);
+			}
+			catch (const std::out_of_range& e)
+			{
+				throw WebErrors::bad_request(e.what());
+			}
+
+			// The journal knows the actual temperatures and positioning modes, the file the rest
+			if (journal)
+			{
+				start.state.relative = journal->last.relative;
+				start.state.relativeE = journal->last.relativeE;
+				if (journal->last.hotend > 0)
+					start.state.hotend = journal->last.hotend;
+				if (journal->last.bed > 0)
+					start.state.bed = journal->last.bed;
+			}
+
+			printJob->setStartPoint(start.offset, start.state);
+
+			// Someone else may have started a job meanwhile
+			if (busy())
+			{
+				resp.send(WebResponse::http_status::conflict);
+				return;
+			}
+		}
+
 		printer->setPrintJob(printJob);
 
 		// Unless state is Stopped, start the job
@@ -319,9 +488,72 @@ namespace
 		result["total"] = total;
 		result["elapsed"] = printJob->timeElapsed().count();
 
+		// Not known until the file has been analyzed
+		const int remaining = printJob->timeRemaining();
+		result["remaining"] = (remaining >= 0) ? nlohmann::json(remaining) : nlohmann::json();
+		const int estimated = printJob->timeEstimated();
+		result["estimated"] = (estimated >= 0) ? nlohmann::json(estimated) : nlohmann::json();
+
 		resp.send(result);
 	}
 
+	// A job that didn't get to finish, e.g. because of a power loss, which can be resumed by POSTing {"recover": true} to the job
+	void restGetRecovery(WebRequest& req, WebResponse& resp, PrinterManager* printerManager)
+	{
+		std::string printerName = req.pathParam(1);
+		std::shared_ptr<Printer> printer = printerManager->printer(printerName.c_str());
+
+		if (!printer)
+			throw WebErrors::not_found("Printer not found");
+
+		std::optional<JobJournal::Contents> journal = JobJournal::read(printer->journalPath());
+		if (!journal)
+			throw WebErrors::not_found("No job to recover");
+
+		resp.send(nlohmann::json {
+			{ "file", journal->name },
+			{ "done", journal->last.offset },
+			{ "total", journal->size },
+			{ "when", std::chrono::duration_cast<std::chrono::milliseconds>(journal->last.when.time_since_epoch()).count() },
+			{ "hotend", journal->last.hotend },
+			{ "bed", journal->last.bed }
+		});
+	}
+
+	void restDeleteRecovery(WebRequest& req, WebResponse& resp, PrinterManager* printerManager)
+	{
+		std::string printerName = req.pathParam(1);
+		std::shared_ptr<Printer> printer = printerManager->printer(printerName.c_str());
+
+		if (!printer)
+			throw WebErrors::not_found("Printer not found");
+
+		// A running job keeps its journal
+		std::shared_ptr<PrintJob> printJob = printer->printJob();
+		if (printJob && printJob->inProgress())
+		{
+			resp.send(WebResponse::http_status::conflict);
+			return;
+		}
+
+		boost::system::error_code ec;
+		if (!boost::filesystem::remove(printer->journalPath(), ec))
+			throw WebErrors::not_found("No job to recover");
+
+		resp.send(WebResponse::http_status::no_content);
+	}
+
+	int64_t parseMillisParam(std::string_view value, const char* name)
+	{
+		int64_t ms;
+		auto [p, ec] = std::from_chars(value.data(), value.data() + value.length(), ms);
+
+		if (ec != std::errc() || p != value.data() + value.length() || ms < 0)
+			throw WebErrors::bad_request(std::string("invalid '") + name + "' param");
+
+		return ms;
+	}
+
 	void restGetPrinterTemperatures(WebRequest& req, WebResponse& resp, PrinterManager* printerManager)
 	{
 		std::string name = req.pathParam(1);
@@ -330,24 +562,47 @@ namespace
 		if (!printer)
 			throw WebErrors::not_found("Printer not found");
 
+		// Both in milliseconds, since is relative to the Unix epoch
+		std::chrono::system_clock::time_point since;
+		std::chrono::system_clock::duration step = std::chrono::system_clock::duration::zero();
+
+		if (const char* param = req.queryParam("since"))
+			since += std::chrono::milliseconds(parseMillisParam(param, "since"));
+		if (const char* param = req.queryParam("step"))
+			step = std::chrono::milliseconds(parseMillisParam(param, "step"));
+
 		nlohmann::json result = nlohmann::json::array();
-		std::list<Printer::TemperaturePoint> temps = printer->getTemperatureHistory();
+		TemperatureHistory::Slice temps = printer->getTemperatureHistory(since, step);
+		const size_t sensorCount = temps.sensors.size();
 
-		for (auto it = temps.begin(); it != temps.end(); it++)
+		for (size_t i = 0; i < temps.when.size(); i++)
 		{
 			nlohmann::json values = nlohmann::json::object();
 
-			for (auto it2 = it->values.begin(); it2 != it->values.end(); it2++)
+			for (size_t j = 0; j < sensorCount; j++)
 			{
-				values[it2->first] = {
-						{"current", it2->second.current},
-						{"target",  it2->second.target}
+				const size_t k = i*sensorCount + j;
+
+				if (std::isnan(temps.current[k]))
+					continue;
+
+				nlohmann::json value = {
+						{"current", temps.current[k]}
 				};
+
+				if (!std::isnan(temps.target[k]))
+					value["target"] = temps.target[k];
+				if (!std::isnan(temps.power[k]))
+					value["power"] = temps.power[k];
+
+				values[temps.sensors[j]] = value;
 			}
 
-			std::time_t tt = std::chrono::system_clock::to_time_t(it->when);
+			const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(temps.when[i].time_since_epoch()).count();
+			std::time_t tt = ms / 1000;
 			char when[sizeof "2011-10-08T07:07:09.000Z"];
-			strftime(when, sizeof when, "%FT%T.000Z", gmtime(&tt));
+			size_t len = strftime(when, sizeof when, "%FT%T", gmtime(&tt));
+			snprintf(when + len, sizeof(when) - len, ".%03dZ", int(ms % 1000));
 
 			nlohmann::json pt = nlohmann::json::object();
 			pt["when"] = when;
@@ -358,6 +613,17 @@ namespace
 		resp.send(result, WebResponse::http_status::ok);
 	}
 
+	void restGetPrinterStats(WebRequest& req, WebResponse& resp, PrinterManager* printerManager)
+	{
+		std::string name = req.pathParam(1);
+
+		std::shared_ptr<Printer> printer = printerManager->printer(name.c_str());
+		if (!printer)
+			throw WebErrors::not_found("Printer not found");
+
+		resp.send(linkStatsJson(printer->linkStats()));
+	}
+
 	void restSetPrinterTemperatures(WebRequest& req, WebResponse& resp, PrinterManager* printerManager)
 	{
 		std::string name = req.pathParam(1);
@@ -471,6 +737,50 @@ namespace
 	}
 }
 
+nlohmann::json linkStatsJson(const LinkStats::Report& report)
+{
+	// Only the buckets that have any samples, as [lower bound in us, count] pairs
+	nlohmann::json histogram = nlohmann::json::array();
+
+	for (int i = 0; i < LinkStats::BUCKETS; i++)
+	{
+		if (report.latency[i] > 0)
+			histogram.push_back({ LinkStats::bucketLowerBound(i), report.latency[i] });
+	}
+
+	return nlohmann::json {
+		{ "when", std::chrono::duration_cast<std::chrono::milliseconds>(report.when.time_since_epoch()).count() },
+		{ "rate", {
+			{ "linesSent", report.linesSentPerSec },
+			{ "linesReceived", report.linesReceivedPerSec },
+			{ "bytesSent", report.bytesSentPerSec },
+			{ "bytesReceived", report.bytesReceivedPerSec }
+		}},
+		{ "total", {
+			{ "linesSent", report.linesSent },
+			{ "linesReceived", report.linesReceived },
+			{ "bytesSent", report.bytesSent },
+			{ "bytesReceived", report.bytesReceived },
+			{ "oks", report.oks },
+			{ "resends", report.resends },
+			{ "timeouts", report.timeouts }
+		}},
+		{ "queue", {
+			{ "commands", report.queued },
+			{ "job", report.jobQueued },
+			{ "inflight", report.inflight },
+			{ "inflightBytes", report.inflightBytes }
+		}},
+		{ "latency", {
+			{ "p50", LinkStats::percentile(report.latency, 0.5) },
+			{ "p90", LinkStats::percentile(report.latency, 0.9) },
+			{ "p99", LinkStats::percentile(report.latency, 0.99) },
+			{ "max", LinkStats::percentile(report.latency, 1) },
+			{ "histogram", histogram }
+		}}
+	};
+}
+
 void routePrinter(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager)
 {
 	router->post("printers/discover", restPrintersDiscover);
@@ -485,10 +795,13 @@ void routePrinter(WebRouter* router, FileManager& fileManager, PrinterManager& p
 	router->post("printers/([^/]+)/job", restSubmitJob, &printerManager, &fileManager);
 	router->put("printers/([^/]+)/job", restModifyJob, &printerManager);
 	router->get("printers/([^/]+)/job", restGetJob, &printerManager);
+	router->get("printers/([^/]+)/recovery", restGetRecovery, &printerManager);
+	router->delete_("printers/([^/]+)/recovery", restDeleteRecovery, &printerManager);
 
 	router->get("printers/([^/]+)/gcode", restGetGcodeHistory, &printerManager);
 	router->post("printers/([^/]+)/gcode", restSubmitGcode, &printerManager);
 
 	router->put("printers/([^/]+)/temperatures", restSetPrinterTemperatures, &printerManager);
 	router->get("printers/([^/]+)/temperatures", restGetPrinterTemperatures, &printerManager);
+	router->get("printers/([^/]+)/stats", restGetPrinterStats, &printerManager);
 }
@@ -18,8 +18,12 @@
 #include "web/WebRouter.h"
 #include "FileManager.h"
 #include "PrinterManager.h"
+#include "LinkStats.h"
 
 void routePrinter(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager);
 
+// Shared by the REST API and WebSocket events
+nlohmann::json linkStatsJson(const LinkStats::Report& report);
+
 #endif /* RESTAPI_H */
 
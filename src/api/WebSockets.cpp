@@ -5,13 +5,19 @@
 #include <boost/log/trivial.hpp>
 #include <boost/algorithm/string.hpp>
 #include "PrintJob.h"
+#include "PrintApi.h"
+#include "CoalescedValue.h"
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <functional>
 
 class WSSubscriptionServer : public std::enable_shared_from_this<WSSubscriptionServer>
 {
 public:
-	WSSubscriptionServer(WebSocketHandler& ws, PrinterManager& printerManager, FileManager& fileManager)
-	: m_ws(ws), m_printerManager(printerManager), m_fileManager(fileManager)
+	// Job progress is reported at most progressRate times a second
+	WSSubscriptionServer(WebSocketHandler& ws, PrinterManager& printerManager, FileManager& fileManager, double progressRate)
+	: m_ws(ws), m_printerManager(printerManager), m_fileManager(fileManager), m_progressRate(progressRate)
 	{
 	}
 
@@ -49,6 +55,14 @@ private:
 							.track_foreign(shared_from_this()));
 	}
 
+	// Same as above, but the handler runs wherever the signal is raised
+	template<typename SignalType, typename CallableType>
+	boost::signals2::connection directSelfTrackingConnect(boost::signals2::signal<SignalType>& signal, CallableType handler)
+	{
+		typedef typename boost::signals2::signal<SignalType>::slot_type slot_type;
+		return signal.connect(slot_type(handler).track_foreign(shared_from_this()));
+	}
+
 	void handleSubscribeRequest(const nlohmann::json& request)
 	{
 		if (request.is_string())
@@ -94,6 +108,12 @@ private:
 						doSubscribeJob(printer);
 						return;
 					}
+					else if (route[2] == "stats")
+					{
+						m_subscriptions.emplace(v, selfTrackingConnect(printer->linkStatsSignal(),
+							std::bind(&WSSubscriptionServer::printerStatsEvent, this, route[1], std::placeholders::_1)));
+						return;
+					}
 					else if (route[2] == "gcode")
 					{
 						m_subscriptions.emplace(v, selfTrackingConnect(printer->gcodeSignal(),
@@ -172,6 +192,14 @@ private:
 		raiseEvent(event);
 	}
 
+	void printerStatsEvent(std::string printer, const LinkStats::Report& report)
+	{
+		nlohmann::json event;
+
+		event["event"]["Printer." + printer + ".stats"] = linkStatsJson(report);
+		raiseEvent(event);
+	}
+
 	void printerGcodeEvent(std::string printer, Printer::GCodeEvent gcode)
 	{
 		nlohmann::json event;
@@ -195,8 +223,21 @@ private:
 			m_subscriptions.emplace(v, selfTrackingConnect(printJob->stateChangeSignal(),
 				std::bind(&WSSubscriptionServer::jobStateChangeEvent, this, printer->uniqueName(), printJob.get(), std::placeholders::_1, std::placeholders::_2)));
 
-			m_subscriptions.emplace(v, selfTrackingConnect(printJob->progressChangeSignal(),
-				std::bind(&WSSubscriptionServer::jobProgressEvent, this, printer->uniqueName(), printJob.get(), std::placeholders::_1)));
+			// Progress changes with every line, only the latest value gets sent
+			std::weak_ptr<WSSubscriptionServer> weakSelf = shared_from_this();
+			std::weak_ptr<PrintJob> weakJob = printJob;
+			auto progress = std::make_shared<CoalescedValue<size_t>>(*m_ws.strand(), m_progressRate,
+				[weakSelf, weakJob, printerId = std::string(printer->uniqueName())](size_t done) {
+					std::shared_ptr<WSSubscriptionServer> self = weakSelf.lock();
+					std::shared_ptr<PrintJob> job = weakJob.lock();
+
+					if (self && job)
+						self->jobProgressEvent(printerId, job.get(), done);
+				});
+
+			m_subscriptions.emplace(v, directSelfTrackingConnect(printJob->progressChangeSignal(), [progress](size_t done) {
+				progress->set(done);
+			}));
 		}
 		return printJob;
 	}
@@ -257,6 +298,10 @@ private:
 			{ "elapsed", job->timeElapsed().count() }
 		};
 
+		const int remaining = job->timeRemaining();
+		if (remaining >= 0)
+			event["event"]["Printer." + printer + ".job"]["remaining"] = remaining;
+
 		raiseEvent(event);
 	}
 
@@ -271,12 +316,13 @@ private:
 	WebSocketHandler& m_ws;
 	PrinterManager& m_printerManager;
 	FileManager& m_fileManager;
+	const double m_progressRate;
 	std::multimap<std::string, boost::signals2::connection> m_subscriptions;
 };
 
-void routeWebSockets(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager, AuthManager& authManager)
+void routeWebSockets(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager, AuthManager& authManager, double progressRate)
 {
-	router->addFilter([=, &authManager](WebRequest& req,WebResponse& resp, WebRouter::handler_t next) {
+	router->addFilter([=, &authManager](WebRequest& req,WebResponse& resp, const WebRouter::next_t& next) {
 		const std::string& sv = req.target();
 		auto pos = sv.rfind('/');
 
@@ -296,7 +342,7 @@ void routeWebSockets(WebRouter* router, FileManager& fileManager, PrinterManager
 		resp.send(boost::beast::http::status::unauthorized);
 	});
 	router->ws("(.*)", [&](WebSocketHandler& ws,WebRequest& req,WebResponse& resp) {
-		std::shared_ptr<WSSubscriptionServer> h = std::make_shared<WSSubscriptionServer>(ws, printerManager, fileManager);
+		std::shared_ptr<WSSubscriptionServer> h = std::make_shared<WSSubscriptionServer>(ws, printerManager, fileManager, progressRate);
 
 		ws.message([=](const std::string& msg) {
 			//std::shared_ptr<WSSubscriptionServer> inst = h;
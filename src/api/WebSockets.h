@@ -5,6 +5,7 @@
 #include "PrinterManager.h"
 #include "AuthManager.h"
 
-void routeWebSockets(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager, AuthManager& authManager);
+// Job progress events are coalesced to at most progressRate per second and client
+void routeWebSockets(WebRouter* router, FileManager& fileManager, PrinterManager& printerManager, AuthManager& authManager, double progressRate);
 
 #endif
@@ -26,6 +26,8 @@
 #include "CameraManager.h"
 #include <signal.h>
 #include <cstring>
+#include <thread>
+#include <vector>
 
 #ifdef WITH_MMAL_CAMERA
 #	include "camera/MMALCamera.h"
@@ -37,6 +39,8 @@
 static void runApp();
 static void sanityCheck();
 static void ignoreHup();
+static int configuredThreads(const char* key);
+static double progressRate();
 
 boost::property_tree::ptree g_config;
 
@@ -67,12 +71,25 @@ static std::string localStoragePath()
 	return path.generic_string();
 }
 
+static std::string journalPath()
+{
+	boost::filesystem::path path(::getenv("HOME"));
+
+	path /= ".local/share/dashprint/journal";
+	return path.generic_string();
+}
+
 void runApp()
 {
-	boost::asio::io_service io;
-	FileManager fileManager(localStoragePath());
-	PrinterManager printerManager(io, g_config);
+	// Printers get an io_service of their own, so that serial I/O never waits behind HTTP work
+	boost::asio::io_service io, printerIo;
+	auto printerWork = boost::asio::make_work_guard(printerIo);
+	// Uploads are analyzed off the I/O threads
+	FileManager fileManager(localStoragePath(), configuredThreads("Files.analysis_threads"));
+	PrinterManager printerManager(printerIo, g_config, journalPath());
 	WebServer webServer(io);
+	// Uploads are renamed into the storage instead of being copied there
+	webServer.setUploadDirectory(fileManager.uploadDirectory());
 	AuthManager authManager(g_config.get_child("users"));
 	PluginManager pluginManager;
 	CameraManager cameraManager(g_config.get_child("cameras"));
@@ -83,7 +100,7 @@ void runApp()
 	routeFile(apiv1, fileManager);
 	routeAuth(apiv1, authManager);
 	routeOctoprintRest(webServer.router("/api/")->addFilter(checkOctoprintKey(&authManager)), fileManager, printerManager, authManager);
-	routeWebSockets(webServer.router("/websocket"), fileManager, printerManager, authManager);
+	routeWebSockets(webServer.router("/websocket"), fileManager, printerManager, authManager, progressRate());
 	routeCamera(apiv1->router("camera/"), cameraManager, authManager);
 	
 	// Fallback for static resources
@@ -113,8 +130,50 @@ void runApp()
 	});
 
 	webServer.start(g_config.get<int>("WebServer.port", 8970));
-	
+
+	std::vector<std::thread> threads;
+	const int printerThreads = configuredThreads("Printers.threads");
+	const int webThreads = configuredThreads("WebServer.threads");
+
+	BOOST_LOG_TRIVIAL(info) << "Running " << webThreads << " web server thread(s) and " << printerThreads << " printer thread(s)";
+
+	for (int i = 0; i < printerThreads; i++)
+		threads.emplace_back([&printerIo]() { printerIo.run(); });
+	for (int i = 1; i < webThreads; i++)
+		threads.emplace_back([&io]() { io.run(); });
+
 	io.run();
+
+	printerWork.reset();
+	printerIo.stop();
+	for (std::thread& t : threads)
+		t.join();
+}
+
+int configuredThreads(const char* key)
+{
+	int count = g_config.get<int>(key, 1);
+
+	if (count < 1)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Invalid " << key << " value " << count << ", using 1";
+		count = 1;
+	}
+
+	return count;
+}
+
+double progressRate()
+{
+	double rate = g_config.get<double>("WebServer.progress_rate", 4);
+
+	if (!(rate > 0))
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Invalid WebServer.progress_rate value " << rate << ", using 4";
+		rate = 4;
+	}
+
+	return rate;
 }
 
 void sanityCheck()
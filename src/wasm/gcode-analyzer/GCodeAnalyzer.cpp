@@ -0,0 +1,252 @@
+#include "GCodeAnalyzer.h"
+#include "GCodeScanner.h"
+#include <cmath>
+#include <algorithm>
+
+// Layers closer than this are the same one
+static constexpr float Z_EPSILON = 1e-4f;
+
+void GCodeAnalyzer::feed(const char* data, size_t length)
+{
+	const char* end = data + length;
+
+	while (data < end)
+	{
+		const char* nl = gcodescan::findEither(data, end, '\n', '\n');
+
+		if (nl == end)
+		{
+			m_partial.append(data, end - data);
+			break;
+		}
+
+		if (!m_partial.empty())
+		{
+			m_partial.append(data, nl - data);
+			processLine(m_partial, m_offset);
+			m_offset += m_partial.length() + 1;
+			m_partial.clear();
+		}
+		else
+		{
+			processLine(std::string_view(data, nl - data), m_offset);
+			m_offset += nl - data + 1;
+		}
+
+		data = nl + 1;
+	}
+}
+
+const GCodeAnalysis& GCodeAnalyzer::finish()
+{
+	if (!m_partial.empty())
+	{
+		processLine(m_partial, m_offset);
+		m_offset += m_partial.length();
+		m_partial.clear();
+	}
+
+	return m_analysis;
+}
+
+void GCodeAnalyzer::processLine(std::string_view line, uint64_t offset)
+{
+	m_analysis.lines++;
+
+	// Remove comments and checksums
+	line = line.substr(0, gcodescan::findEither(line.data(), line.data() + line.length(), ';', '*') - line.data());
+
+	gcodescan::Words words(line);
+	std::string_view cmd;
+
+	if (!words.next(cmd))
+		return;
+	if (cmd[0] == 'N' && !words.next(cmd))
+		return;
+
+	if (cmd == "G0" || cmd == "G1" || cmd == "G2" || cmd == "G3" || cmd == "G00" || cmd == "G01" || cmd == "G02" || cmd == "G03")
+	{
+		move(words, offset);
+	}
+	else if (cmd == "G90")
+	{
+		// Absolute positioning, E included
+		m_state.relative = m_state.relativeE = false;
+	}
+	else if (cmd == "G91")
+	{
+		m_state.relative = m_state.relativeE = true;
+	}
+	else if (cmd == "M82")
+	{
+		m_state.relativeE = false;
+	}
+	else if (cmd == "M83")
+	{
+		m_state.relativeE = true;
+	}
+	else if (cmd == "G92")
+	{
+		// Declare the current position
+		std::string_view word;
+		double value;
+
+		while (words.next(word))
+		{
+			if (!gcodescan::parseNumber(word.substr(1), value))
+				continue;
+
+			switch (word[0])
+			{
+				case 'X': m_state.position[0] = value; break;
+				case 'Y': m_state.position[1] = value; break;
+				case 'Z': m_state.position[2] = value; break;
+				case 'E': m_state.e = value; break;
+			}
+		}
+	}
+	else if (cmd == "G28")
+	{
+		// Homes the given axes, all of them if there are none
+		std::string_view word;
+		bool all = true;
+
+		m_zOffset = offset;
+		m_zState = m_state;
+
+		while (words.next(word))
+		{
+			if (word[0] >= 'X' && word[0] <= 'Z')
+			{
+				m_state.position[word[0] - 'X'] = 0;
+				all = false;
+			}
+		}
+
+		if (all)
+			std::fill(m_state.position, m_state.position + 3, 0);
+	}
+	else if (cmd == "M104" || cmd == "M109" || cmd == "M140" || cmd == "M190")
+	{
+		std::string_view word;
+		double value, temperature = -1;
+		bool otherTool = false;
+
+		while (words.next(word))
+		{
+			if (word[0] == 'T')
+				otherTool = (word != "T0");
+			else if ((word[0] == 'S' || word[0] == 'R') && gcodescan::parseNumber(word.substr(1), value))
+				temperature = value;
+		}
+
+		// Only the first extruder is tracked
+		if (temperature >= 0 && !otherTool)
+		{
+			if (cmd == "M104" || cmd == "M109")
+				m_state.hotend = temperature;
+			else
+				m_state.bed = temperature;
+		}
+	}
+	else if (cmd == "M106")
+	{
+		std::string_view word;
+		double value;
+
+		m_state.fan = 255;
+		while (words.next(word))
+		{
+			if (word[0] == 'S' && gcodescan::parseNumber(word.substr(1), value))
+				m_state.fan = std::clamp(int(value), 0, 255);
+		}
+	}
+	else if (cmd == "M107")
+	{
+		m_state.fan = 0;
+	}
+}
+
+void GCodeAnalyzer::move(gcodescan::Words& params, uint64_t offset)
+{
+	float target[3] = { m_state.position[0], m_state.position[1], m_state.position[2] };
+	double e = 0, newE = m_state.e;
+	float feedrate = m_state.feedrate;
+	std::string_view word;
+	double value;
+
+	while (params.next(word))
+	{
+		if (!gcodescan::parseNumber(word.substr(1), value))
+			continue;
+
+		switch (word[0])
+		{
+			case 'X':
+			case 'Y':
+			case 'Z':
+			{
+				const int axis = word[0] - 'X';
+				target[axis] = m_state.relative ? target[axis] + value : value;
+				break;
+			}
+			case 'E':
+				e = m_state.relativeE ? value : value - newE;
+				newE = m_state.relativeE ? newE + value : value;
+				break;
+			case 'F':
+				feedrate = value;
+				break;
+		}
+	}
+
+	const float (&position)[3] = m_state.position;
+
+	if (target[2] != position[2])
+	{
+		m_zOffset = offset;
+		m_zState = m_state;
+	}
+
+	const bool xyMoved = target[0] != position[0] || target[1] != position[1];
+
+	if (e > 0 && xyMoved)
+		extrusion(position, target);
+	else if (xyMoved || target[2] != position[2])
+		m_analysis.travelMoves++;
+
+	// Retractions count too, they get undone later on
+	m_analysis.filament += e;
+	if (!m_analysis.layers.empty())
+		m_analysis.layers.back().filament += e;
+
+	std::copy(target, target + 3, m_state.position);
+	m_state.e = newE;
+	m_state.feedrate = feedrate;
+}
+
+void GCodeAnalyzer::extrusion(const float (&from)[3], const float (&to)[3])
+{
+	std::vector<GCodeAnalysis::Layer>& layers = m_analysis.layers;
+
+	if (layers.empty() || std::abs(layers.back().z - to[2]) > Z_EPSILON)
+		layers.push_back({ to[2], m_zOffset, 0, 0, m_zState });
+
+	if (m_analysis.extrusionMoves == 0)
+	{
+		std::copy(from, from + 3, m_analysis.min);
+		std::copy(from, from + 3, m_analysis.max);
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		m_analysis.min[i] = std::min({ m_analysis.min[i], from[i], to[i] });
+		m_analysis.max[i] = std::max({ m_analysis.max[i], from[i], to[i] });
+	}
+
+	layers.back().moves++;
+	m_analysis.extrusionMoves++;
+
+	if (extrusionCallback)
+		extrusionCallback(layers.size() - 1, from, to);
+}
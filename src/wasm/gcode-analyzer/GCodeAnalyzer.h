@@ -0,0 +1,77 @@
+#ifndef _GCODEANALYZER_H
+#define _GCODEANALYZER_H
+#include <string_view>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace gcodescan { class Words; }
+
+// What a .gcode file is going to print.
+// Built into the server as well as into the browser's wasm module, so it depends on nothing but the standard library.
+struct GCodeAnalysis
+{
+	// What the lines up to some point of the file leave the printer in,
+	// i.e. what has to be restored to start printing from there
+	struct State
+	{
+		bool relative = false, relativeE = false;
+		float position[3] = { 0, 0, 0 };
+		double e = 0;
+		float feedrate = 0; // mm/min, 0 until set
+		float hotend = 0, bed = 0; // Target temperatures
+		int fan = 0; // 0-255
+	};
+
+	struct Layer
+	{
+		float z;
+		// Where the move to this layer's height starts in the file
+		uint64_t offset;
+		uint64_t moves; // Extrusion moves
+		float filament; // mm
+		// Before the line at offset
+		State state;
+	};
+	std::vector<Layer> layers;
+
+	// Extents of extrusion moves, all zeros if there aren't any
+	float min[3] = { 0, 0, 0 }, max[3] = { 0, 0, 0 };
+	// Net length of filament pushed into the extruder in mm
+	double filament = 0;
+	uint64_t extrusionMoves = 0, travelMoves = 0, lines = 0;
+};
+
+// Takes the file in chunks of any size, lines may span chunks
+class GCodeAnalyzer
+{
+public:
+	void feed(const char* data, size_t length);
+	// The file has ended
+	const GCodeAnalysis& finish();
+	const GCodeAnalysis& analysis() const { return m_analysis; }
+	// After the lines fed so far, not including a partial one
+	const GCodeAnalysis::State& state() const { return m_state; }
+
+	// Called for every extrusion move, for the preview in the browser
+	std::function<void(size_t layer, const float (&from)[3], const float (&to)[3])> extrusionCallback;
+private:
+	void processLine(std::string_view line, uint64_t offset);
+	void move(gcodescan::Words& params, uint64_t offset);
+	void extrusion(const float (&from)[3], const float (&to)[3]);
+private:
+	GCodeAnalysis m_analysis;
+
+	// The start of a line that didn't fit into the last chunk
+	std::string m_partial;
+	uint64_t m_offset = 0;
+
+	GCodeAnalysis::State m_state;
+	// The last line that changed Z, it starts a layer if followed by extrusion
+	uint64_t m_zOffset = 0;
+	GCodeAnalysis::State m_zState;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef _GCODESCANNER_H
+#define _GCODESCANNER_H
+#include <string_view>
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorised helpers for splitting G-code into lines and words, 16 or 32 bytes at a time.
+// SSE2/AVX2 on x86, NEON on ARM, SIMD128 in wasm, plain loops elsewhere.
+// Shared by the server and the wasm analyzer, so only the standard library is used.
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#	include <immintrin.h>
+#elif defined(__ARM_NEON)
+#	include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#	include <wasm_simd128.h>
+#endif
+
+namespace gcodescan
+{
+	// Bit i is set if p[i] is a or b, 16 bytes are read
+	inline uint32_t matchMask16(const char* p, char a, char b)
+	{
+#if defined(__SSE2__)
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		const __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+		return uint32_t(_mm_movemask_epi8(m));
+#elif defined(__ARM_NEON)
+		static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+		const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+		const uint8x16_t m = vandq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(uint8_t(a))), vceqq_u8(v, vdupq_n_u8(uint8_t(b)))), vld1q_u8(weights));
+		// No movemask on NEON, add up the weighted bytes of each half instead
+		uint8x8_t sum = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+		sum = vpadd_u8(sum, sum);
+		sum = vpadd_u8(sum, sum);
+		return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+#elif defined(__wasm_simd128__)
+		const v128_t v = wasm_v128_load(p);
+		return wasm_i8x16_bitmask(wasm_v128_or(wasm_i8x16_eq(v, wasm_i8x16_splat(a)), wasm_i8x16_eq(v, wasm_i8x16_splat(b))));
+#else
+		uint32_t mask = 0;
+		for (int i = 0; i < 16; i++)
+			mask |= uint32_t(p[i] == a || p[i] == b) << i;
+		return mask;
+#endif
+	}
+
+	// The first a or b in [p, end), end if there's none
+	inline const char* findEither(const char* p, const char* end, char a, char b)
+	{
+#if defined(__AVX2__)
+		const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+		while (end - p >= 32)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			const uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+
+			if (mask)
+				return p + __builtin_ctz(mask);
+			p += 32;
+		}
+#endif
+		while (end - p >= 16)
+		{
+			const uint32_t mask = matchMask16(p, a, b);
+
+			if (mask)
+				return p + __builtin_ctz(mask);
+			p += 16;
+		}
+
+		for (; p < end; p++)
+		{
+			if (*p == a || *p == b)
+				return p;
+		}
+
+		return end;
+	}
+
+	inline bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline std::string_view trim(std::string_view text)
+	{
+		while (!text.empty() && isBlank(text.front()))
+			text.remove_prefix(1);
+		while (!text.empty() && isBlank(text.back()))
+			text.remove_suffix(1);
+		return text;
+	}
+
+	// Splits a line into space separated words.
+	// Lines of up to 64 bytes, i.e. nearly all of them, are classified in one go.
+	class Words
+	{
+	public:
+		Words(std::string_view line)
+		: m_line(line)
+		{
+			if (line.length() > 64)
+				return;
+
+			// Same blanks as isBlank()
+			size_t i = 0;
+			for (; i + 16 <= line.length(); i += 16)
+			{
+				const char* p = line.data() + i;
+				m_blanks |= uint64_t(matchMask16(p, ' ', '\t') | matchMask16(p, '\r', '\r')) << i;
+			}
+			for (; i < line.length(); i++)
+				m_blanks |= uint64_t(isBlank(line[i])) << i;
+
+			// Past the end counts as blank
+			if (line.length() < 64)
+				m_blanks |= ~uint64_t(0) << line.length();
+			m_fast = true;
+		}
+
+		bool next(std::string_view& word)
+		{
+			if (!m_fast)
+				return nextSlow(word);
+
+			// Everything before m_pos has been consumed
+			const uint64_t words = ~m_blanks & (m_pos < 64 ? ~uint64_t(0) << m_pos : 0);
+			if (!words)
+				return false;
+
+			const unsigned start = __builtin_ctzll(words);
+			const uint64_t after = (start < 63) ? m_blanks & (~uint64_t(0) << start) : 0;
+			const unsigned end = after ? __builtin_ctzll(after) : 64;
+
+			word = m_line.substr(start, end - start);
+			m_pos = end;
+			return true;
+		}
+	private:
+		bool nextSlow(std::string_view& word)
+		{
+			while (m_pos < m_line.length() && isBlank(m_line[m_pos]))
+				m_pos++;
+			if (m_pos >= m_line.length())
+				return false;
+
+			const size_t start = m_pos;
+			while (m_pos < m_line.length() && !isBlank(m_line[m_pos]))
+				m_pos++;
+
+			word = m_line.substr(start, m_pos - start);
+			return true;
+		}
+	private:
+		std::string_view m_line;
+		uint64_t m_blanks = 0;
+		size_t m_pos = 0;
+		bool m_fast = false;
+	};
+
+	// Parses "-12.345" style numbers, as used for G-code parameters, without exponents.
+	// Returns false unless the whole text is a number.
+	// Up to 15 significant digits the result is the correctly rounded double, like strtod's.
+	inline bool parseNumber(std::string_view text, double& value)
+	{
+		static const double powersOf10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		const char* p = text.data();
+		const char* end = p + text.length();
+		bool negative = false;
+
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = (*p++ == '-');
+
+		uint64_t mantissa = 0;
+		int digits = 0, decimals = 0;
+		bool point = false;
+		double slow = 0, scale = 1;
+
+		for (; p < end; p++)
+		{
+			const unsigned d = unsigned(*p) - '0';
+
+			if (d < 10)
+			{
+				if (digits < 19)
+					mantissa = mantissa * 10 + d;
+				slow = slow * 10 + d;
+				digits++;
+
+				if (point)
+				{
+					decimals++;
+					scale *= 10;
+				}
+			}
+			else if (*p == '.' && !point)
+				point = true;
+			else
+				return false;
+		}
+
+		if (digits == 0)
+			return false;
+
+		// Both operands are exact doubles, so a single division rounds correctly
+		if (digits <= 15 && decimals <= 22)
+			value = double(mantissa) / powersOf10[decimals];
+		else
+			value = slow / scale;
+
+		if (negative)
+			value = -value;
+		return true;
+	}
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "MultipartParser.h"
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <ctype.h>
+
+static constexpr size_t MAX_HEADERS_LENGTH = 16*1024;
+
+MultipartParser::MultipartParser(std::string_view boundary, PartBegin_t partBegin, PartData_t partData, PartEnd_t partEnd)
+: m_delimiter("\r\n--" + std::string(boundary)), m_partBegin(partBegin), m_partData(partData), m_partEnd(partEnd)
+{
+	if (boundary.empty() || boundary.find_first_of("\r\n") != std::string_view::npos)
+		throw std::runtime_error("Invalid multipart boundary");
+}
+
+void MultipartParser::feed(const char* data, size_t length)
+{
+	const char* p = data;
+	const char* end = data + length;
+
+	while (p < end)
+	{
+		switch (m_state)
+		{
+			case State::Preamble:
+			case State::Body:
+			{
+				const bool body = m_state == State::Body;
+
+				if (!findDelimiter(p, end, body))
+					return;
+
+				if (body)
+					m_partEnd();
+
+				m_state = State::AfterDelimiter;
+				m_line.clear();
+				break;
+			}
+			case State::AfterDelimiter:
+			{
+				m_line.push_back(*p++);
+
+				if (m_line == "--")
+				{
+					m_state = State::Done;
+					break;
+				}
+
+				if (m_line.length() >= 2 && m_line.compare(m_line.length() - 2, 2, "\r\n") == 0)
+				{
+					// Transport padding may only be whitespace
+					if (!std::all_of(m_line.begin(), m_line.end() - 2, [](char c) { return c == ' ' || c == '\t'; }))
+						throw std::runtime_error("Malformed multipart delimiter");
+
+					m_state = State::Headers;
+					m_line.clear();
+				}
+				else if (m_line.length() > 256)
+					throw std::runtime_error("Malformed multipart delimiter");
+				break;
+			}
+			case State::Headers:
+			{
+				// Up to and including the empty line ending the headers
+				const char* lf = static_cast<const char*>(std::memchr(p, '\n', end - p));
+				const char* stop = lf ? lf + 1 : end;
+
+				m_line.append(p, stop);
+				p = stop;
+
+				if (m_line.length() > MAX_HEADERS_LENGTH)
+					throw std::runtime_error("Multipart headers too long");
+
+				if (m_line == "\r\n" || (m_line.length() >= 4 && m_line.compare(m_line.length() - 4, 4, "\r\n\r\n") == 0))
+				{
+					parseHeaders();
+					m_state = State::Body;
+				}
+				break;
+			}
+			case State::Done:
+				// The epilogue is to be ignored
+				return;
+		}
+	}
+}
+
+bool MultipartParser::findDelimiter(const char*& p, const char* end, bool emit)
+{
+	// Continue a match begun at the end of the previous piece
+	if (m_matched > 0)
+	{
+		const size_t n = std::min<size_t>(m_delimiter.length() - m_matched, end - p);
+
+		if (std::memcmp(p, m_delimiter.data() + m_matched, n) == 0)
+		{
+			p += n;
+			m_matched += n;
+
+			if (m_matched < m_delimiter.length())
+				return false;
+
+			m_matched = 0;
+			return true;
+		}
+
+		// The boundary contains no CR, so no delimiter can start within the held back bytes
+		// and they're part of the contents. The start of the body has no held back bytes of its own.
+		if (emit)
+			m_partData(m_delimiter.data(), m_matched);
+		m_matched = 0;
+	}
+
+	const char* start = p;
+
+	while (p < end)
+	{
+		const char* cr = static_cast<const char*>(std::memchr(p, '\r', end - p));
+
+		if (!cr)
+		{
+			p = end;
+			break;
+		}
+
+		const size_t n = std::min<size_t>(m_delimiter.length(), end - cr);
+
+		if (std::memcmp(cr, m_delimiter.data(), n) == 0)
+		{
+			if (emit && cr > start)
+				m_partData(start, cr - start);
+
+			p = cr + n;
+
+			if (n < m_delimiter.length())
+			{
+				// Held back until the next piece tells
+				m_matched = n;
+				return false;
+			}
+			return true;
+		}
+
+		p = cr + 1;
+	}
+
+	if (emit && p > start)
+		m_partData(start, p - start);
+	return false;
+}
+
+void MultipartParser::parseHeaders()
+{
+	Headers_t headers;
+	std::string_view block = m_line;
+
+	while (!block.empty())
+	{
+		const size_t crlf = block.find("\r\n");
+		std::string_view line = block.substr(0, crlf);
+
+		block.remove_prefix(std::min(block.length(), crlf + 2));
+
+		const size_t colon = line.find(':');
+		if (colon == std::string_view::npos)
+			continue;
+
+		std::string key(line.substr(0, colon));
+		std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+			return ::tolower(c);
+		});
+
+		std::string_view value = line.substr(colon + 1);
+		while (!value.empty() && ::isspace(value.front()))
+			value.remove_prefix(1);
+
+		headers.emplace(std::move(key), std::string(value));
+	}
+
+	m_line.clear();
+	m_partBegin(headers);
+}
@@ -0,0 +1,49 @@
+#ifndef _MULTIPART_PARSER_H
+#define _MULTIPART_PARSER_H
+#include <string>
+#include <string_view>
+#include <functional>
+#include <stddef.h>
+#include "MultipartFormData.h"
+
+// Push parser of multipart/form-data bodies, fed pieces of any size as they arrive from the socket.
+// Part contents are passed on as they're found, only a possible start of the next delimiter is held back,
+// so the memory used doesn't depend on the size of the body.
+class MultipartParser
+{
+public:
+	typedef MultipartFormData::Headers_t Headers_t;
+	typedef std::function<void(const Headers_t& headers)> PartBegin_t;
+	typedef std::function<void(const char* data, size_t length)> PartData_t;
+	typedef std::function<void()> PartEnd_t;
+
+	// boundary as in the Content-Type header, without the leading dashes
+	MultipartParser(std::string_view boundary, PartBegin_t partBegin, PartData_t partData, PartEnd_t partEnd);
+
+	// Throws std::runtime_error on malformed bodies
+	void feed(const char* data, size_t length);
+	// Has the closing delimiter been seen?
+	bool done() const { return m_state == State::Done; }
+private:
+	enum class State { Preamble, AfterDelimiter, Headers, Body, Done };
+
+	// Looks for the delimiter, passing on what comes before it if emit is set.
+	// Returns true with p right after the delimiter if found.
+	bool findDelimiter(const char*& p, const char* end, bool emit);
+	void parseHeaders();
+private:
+	// CRLF, two dashes and the boundary
+	const std::string m_delimiter;
+	PartBegin_t m_partBegin;
+	PartData_t m_partData;
+	PartEnd_t m_partEnd;
+
+	State m_state = State::Preamble;
+	// Bytes at the end of the data fed so far which match the start of the delimiter.
+	// The body may begin with the delimiter without the CRLF.
+	size_t m_matched = 2;
+	// Transport padding after a delimiter, then the part's headers
+	std::string m_line;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "MultipartUpload.h"
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <stdlib.h>
+
+MultipartUpload::MultipartUpload(std::string_view boundary, std::string spoolDirectory)
+: m_parser(boundary,
+	[this](const MultipartParser::Headers_t& headers) { partBegin(headers); },
+	[this](const char* data, size_t length) { partData(data, length); },
+	[this]() { partEnd(); }),
+  m_spoolDirectory(std::move(spoolDirectory))
+{
+}
+
+MultipartUpload::~MultipartUpload()
+{
+	if (m_fd != -1)
+		::close(m_fd);
+
+	for (const Part& part : m_parts)
+	{
+		if (!part.path.empty())
+			::unlink(part.path.c_str());
+	}
+}
+
+void MultipartUpload::feed(const char* data, size_t length)
+{
+	m_parser.feed(data, length);
+}
+
+void MultipartUpload::finish()
+{
+	if (!m_parser.done())
+		throw std::runtime_error("Premature multipart body end");
+}
+
+const MultipartUpload::Part* MultipartUpload::part(std::string_view name) const
+{
+	for (const Part& part : m_parts)
+	{
+		if (part.name == name)
+			return &part;
+	}
+	return nullptr;
+}
+
+void MultipartUpload::partBegin(const MultipartParser::Headers_t& headers)
+{
+	Part part;
+	part.headers = headers;
+
+	auto it = headers.find("content-disposition");
+	if (it != headers.end())
+	{
+		MultipartFormData::Headers_t params;
+		std::string value;
+
+		MultipartFormData::parseKV(it->second, value, params);
+
+		auto itName = params.find("name");
+		if (itName != params.end())
+			part.name = itName->second;
+
+		auto itFilename = params.find("filename");
+		if (itFilename != params.end())
+			part.filename = itFilename->second;
+	}
+
+	if (!part.filename.empty())
+	{
+		part.path = m_spoolDirectory + "partXXXXXX";
+
+		m_fd = ::mkstemp(&part.path[0]);
+		if (m_fd == -1)
+			throw std::runtime_error("Unable to create temporary file");
+	}
+
+	m_parts.push_back(std::move(part));
+}
+
+void MultipartUpload::partData(const char* data, size_t length)
+{
+	Part& part = m_parts.back();
+
+	part.length += length;
+
+	if (m_fd == -1)
+	{
+		if (part.length > MAX_VALUE_LENGTH)
+			throw std::runtime_error("Multipart field too long");
+
+		part.value.append(data, length);
+		return;
+	}
+
+	while (length > 0)
+	{
+		const ssize_t written = ::write(m_fd, data, length);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Unable to write temporary file");
+		}
+
+		data += written;
+		length -= written;
+	}
+}
+
+void MultipartUpload::partEnd()
+{
+	if (m_fd != -1)
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
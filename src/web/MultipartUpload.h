@@ -0,0 +1,52 @@
+#ifndef _MULTIPART_UPLOAD_H
+#define _MULTIPART_UPLOAD_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include "MultipartParser.h"
+
+// A multipart/form-data body received while it streams in. Parts with a filename are written
+// into files in the spool directory as they arrive, the others are kept in memory.
+// The files are deleted along with the upload unless renamed away first.
+class MultipartUpload
+{
+public:
+	struct Part
+	{
+		MultipartParser::Headers_t headers;
+		std::string name, filename;
+		std::string value; // Unless a file part
+		std::string path; // Where a file part is
+		uint64_t length = 0;
+	};
+
+	// spoolDirectory ends with a slash
+	MultipartUpload(std::string_view boundary, std::string spoolDirectory);
+	~MultipartUpload();
+
+	MultipartUpload(const MultipartUpload&) = delete;
+	MultipartUpload& operator=(const MultipartUpload&) = delete;
+
+	void feed(const char* data, size_t length);
+	// Throws if the body has ended before the closing delimiter
+	void finish();
+
+	const std::vector<Part>& parts() const { return m_parts; }
+	// The first part of that name or nullptr
+	const Part* part(std::string_view name) const;
+
+	// Parts without a filename are limited to this
+	static constexpr size_t MAX_VALUE_LENGTH = 64*1024;
+private:
+	void partBegin(const MultipartParser::Headers_t& headers);
+	void partData(const char* data, size_t length);
+	void partEnd();
+private:
+	MultipartParser m_parser;
+	const std::string m_spoolDirectory;
+	std::vector<Part> m_parts;
+	int m_fd = -1;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "RouteTable.h"
+#include <algorithm>
+#include <limits>
+
+static constexpr size_t NO_ROUTE = std::numeric_limits<size_t>::max();
+
+static constexpr std::string_view CAPTURE_SEGMENT = "([^/]+)";
+
+// State of a walk through the trie, captures of the route being looked at and of the best match so far
+struct RouteTable::Walk
+{
+	method_t method;
+	std::string_view captures[MAX_CAPTURES];
+	int captureCount;
+	Match& best;
+
+	void candidate(size_t id)
+	{
+		if (id >= best.id)
+			return;
+
+		best.id = id;
+		best.captureCount = captureCount;
+		std::copy(captures, captures + captureCount, best.captures);
+	}
+};
+
+RouteTable::Node* RouteTable::Node::literal(std::string_view segment) const
+{
+	auto it = std::lower_bound(literals.begin(), literals.end(), segment, [](const auto& child, std::string_view segment) {
+		return std::string_view(child.first) < segment;
+	});
+
+	if (it != literals.end() && it->first == segment)
+		return it->second.get();
+	return nullptr;
+}
+
+RouteTable::Node* RouteTable::Node::addLiteral(std::string_view segment)
+{
+	auto it = std::lower_bound(literals.begin(), literals.end(), segment, [](const auto& child, std::string_view segment) {
+		return std::string_view(child.first) < segment;
+	});
+
+	if (it == literals.end() || it->first != segment)
+		it = literals.emplace(it, std::string(segment), std::make_unique<Node>());
+	return it->second.get();
+}
+
+static bool isTail(std::string_view segment)
+{
+	return segment == "(.*)" || segment == "(.+)" || segment == ".*" || segment == ".+";
+}
+
+static bool isLiteral(std::string_view segment)
+{
+	return segment.find_first_of(".[]{}()\\*+?|^$") == std::string_view::npos;
+}
+
+bool RouteTable::compile(std::string_view pattern, std::vector<std::string_view>& segments)
+{
+	int captures = 0;
+
+	while (true)
+	{
+		// The capture segment has a slash of its own
+		const bool isCapture = pattern.substr(0, CAPTURE_SEGMENT.length()) == CAPTURE_SEGMENT;
+		const size_t slash = pattern.find('/', isCapture ? CAPTURE_SEGMENT.length() : 0);
+		const std::string_view segment = pattern.substr(0, slash);
+
+		if (segment == CAPTURE_SEGMENT)
+			captures++;
+		else if (isTail(segment))
+		{
+			// Can only be the last one
+			if (slash != std::string_view::npos)
+				return false;
+			if (segment[0] == '(')
+				captures++;
+		}
+		else if (!isLiteral(segment))
+			return false;
+
+		segments.push_back(segment);
+
+		if (slash == std::string_view::npos)
+			break;
+		pattern.remove_prefix(slash + 1);
+	}
+
+	return captures < MAX_CAPTURES;
+}
+
+size_t RouteTable::add(std::string_view pattern, method_t method)
+{
+	const size_t id = m_nextId++;
+	std::vector<std::string_view> segments;
+
+	if (!compile(pattern, segments))
+	{
+		m_regexRoutes.push_back(RegexRoute{ boost::regex(pattern.begin(), pattern.end()), method, id });
+		return id;
+	}
+
+	Node* node = &m_root;
+
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		const std::string_view segment = segments[i];
+
+		if (isTail(segment))
+		{
+			node->tails.push_back(Tail{ { method, id }, segment[0] == '(', segment.find('+') != std::string_view::npos });
+			return id;
+		}
+
+		if (segment == CAPTURE_SEGMENT)
+		{
+			if (!node->capture)
+				node->capture = std::make_unique<Node>();
+			node = node->capture.get();
+		}
+		else
+			node = node->addLiteral(segment);
+	}
+
+	node->routes.push_back(Route{ method, id });
+	return id;
+}
+
+size_t RouteTable::addPrefix(std::string_view prefix)
+{
+	const size_t id = m_nextPrefixId++;
+	const size_t lastSlash = prefix.rfind('/');
+	Node* node = &m_root;
+
+	if (lastSlash != std::string_view::npos)
+	{
+		std::string_view head = prefix.substr(0, lastSlash);
+
+		while (true)
+		{
+			const size_t slash = head.find('/');
+
+			node = node->addLiteral(head.substr(0, slash));
+			if (slash == std::string_view::npos)
+				break;
+			head.remove_prefix(slash + 1);
+		}
+
+		prefix.remove_prefix(lastSlash + 1);
+	}
+
+	node->prefixes.push_back(Prefix{ std::string(prefix), id });
+	return id;
+}
+
+// rest is what follows the segments leading to node, without the separating slash.
+// It's null once the whole URL has been used up.
+void RouteTable::match(const Node* node, std::string_view rest, Walk& walk) const
+{
+	if (rest.data() == nullptr)
+	{
+		for (const Route& route : node->routes)
+		{
+			if (route.method == walk.method)
+				walk.candidate(route.id);
+		}
+		return;
+	}
+
+	for (const Tail& tail : node->tails)
+	{
+		if (tail.method != walk.method || (tail.nonEmpty && rest.empty()))
+			continue;
+
+		if (tail.capture)
+		{
+			walk.captures[walk.captureCount++] = rest;
+			walk.candidate(tail.id);
+			walk.captureCount--;
+		}
+		else
+			walk.candidate(tail.id);
+	}
+
+	const size_t slash = rest.find('/');
+	const std::string_view segment = rest.substr(0, slash);
+	std::string_view next;
+
+	if (slash != std::string_view::npos)
+		next = rest.substr(slash + 1);
+
+	if (const Node* child = node->literal(segment))
+		match(child, next, walk);
+
+	if (node->capture && !segment.empty())
+	{
+		walk.captures[walk.captureCount++] = segment;
+		match(node->capture.get(), next, walk);
+		walk.captureCount--;
+	}
+}
+
+bool RouteTable::find(std::string_view url, method_t method, Match& match) const
+{
+	match.id = NO_ROUTE;
+
+	// A null rest means the URL has ended
+	if (url.data() == nullptr)
+		url = std::string_view("", 0);
+
+	Walk walk{ method, {}, 1, match };
+	walk.captures[0] = url;
+
+	this->match(&m_root, url, walk);
+
+	// Only patterns added before the trie's best match can still win
+	for (const RegexRoute& route : m_regexRoutes)
+	{
+		if (route.id >= match.id)
+			break;
+		if (route.method != method)
+			continue;
+
+		boost::cmatch m;
+		if (boost::regex_match(url.begin(), url.end(), m, route.re))
+		{
+			match.id = route.id;
+			match.captureCount = std::min<int>(m.size(), MAX_CAPTURES);
+
+			for (int i = 0; i < match.captureCount; i++)
+			{
+				if (m[i].matched)
+					match.captures[i] = std::string_view(m[i].first, m[i].length());
+				else
+					match.captures[i] = std::string_view();
+			}
+			break;
+		}
+	}
+
+	return match.id != NO_ROUTE;
+}
+
+bool RouteTable::findPrefix(std::string_view url, size_t& id) const
+{
+	const Node* node = &m_root;
+
+	id = NO_ROUTE;
+
+	while (true)
+	{
+		for (const Prefix& prefix : node->prefixes)
+		{
+			if (prefix.id < id && url.substr(0, prefix.rest.length()) == prefix.rest)
+				id = prefix.id;
+		}
+
+		const size_t slash = url.find('/');
+		if (slash == std::string_view::npos)
+			break;
+
+		node = node->literal(url.substr(0, slash));
+		if (!node)
+			break;
+		url.remove_prefix(slash + 1);
+	}
+
+	return id != NO_ROUTE;
+}
@@ -0,0 +1,83 @@
+#ifndef _ROUTETABLE_H
+#define _ROUTETABLE_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <boost/regex.hpp>
+#include <boost/beast/http/verb.hpp>
+#include <stddef.h>
+
+// URL patterns of a WebRouter compiled into a trie of path segments.
+// Patterns are regular expressions matched against the whole URL. Those made of literal segments
+// and ([^/]+) captures, optionally ending with a (.*), (.+), .* or .+ tail segment, go into the trie,
+// which is walked one segment at a time. Anything else is matched with boost::regex.
+// Either way, of all the patterns matching a URL the one added first wins,
+// as if they were tried in order.
+class RouteTable
+{
+public:
+	typedef boost::beast::http::verb method_t;
+	static constexpr int MAX_CAPTURES = 8;
+
+	struct Match
+	{
+		size_t id = 0;
+		// The whole URL first, like with regex matches. Point into the URL.
+		std::string_view captures[MAX_CAPTURES];
+		int captureCount = 0;
+	};
+
+	// Routes get ids in the order they're added, starting at 0
+	size_t add(std::string_view pattern, method_t method);
+	// Plain string prefixes, such as those of sub-routers
+	size_t addPrefix(std::string_view prefix);
+
+	bool find(std::string_view url, method_t method, Match& match) const;
+	bool findPrefix(std::string_view url, size_t& id) const;
+private:
+	struct Route
+	{
+		method_t method;
+		size_t id;
+	};
+	struct Tail : Route
+	{
+		bool capture, nonEmpty;
+	};
+	struct Prefix
+	{
+		std::string rest; // After the last '/'
+		size_t id;
+	};
+	struct Node
+	{
+		// Sorted by segment
+		std::vector<std::pair<std::string, std::unique_ptr<Node>>> literals;
+		std::unique_ptr<Node> capture;
+		// Patterns ending with this node's segment
+		std::vector<Route> routes;
+		// Patterns ending with a tail right after this node's segment
+		std::vector<Tail> tails;
+		std::vector<Prefix> prefixes;
+
+		Node* literal(std::string_view segment) const;
+		Node* addLiteral(std::string_view segment);
+	};
+	struct RegexRoute
+	{
+		boost::regex re;
+		method_t method;
+		size_t id;
+	};
+	struct Walk;
+
+	static bool compile(std::string_view pattern, std::vector<std::string_view>& segments);
+	void match(const Node* node, std::string_view rest, Walk& walk) const;
+private:
+	Node m_root;
+	std::vector<RegexRoute> m_regexRoutes;
+	size_t m_nextId = 0, m_nextPrefixId = 0;
+};
+
+#endif
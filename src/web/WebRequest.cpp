@@ -2,6 +2,7 @@
 #include "WebSession.h"
 #include "WebServer.h"
 #include "MultipartFormData.h"
+#include "MultipartUpload.h"
 #include <charconv>
 
 WebRequest::WebRequest(const boost::beast::http::request<boost::beast::http::string_body>& request,
@@ -19,11 +20,20 @@ std::shared_ptr<WebSession> webSession)
 	}
 }
 
+WebRequest::~WebRequest()
+{
+}
+
 boost::asio::ip::tcp::socket&& WebRequest::socket()
 {
 	return m_webSession->moveSocket();
 }
 
+void WebRequest::await(const std::function<void(std::function<void()> resume)>& work)
+{
+	m_webSession->await(work);
+}
+
 nlohmann::json WebRequest::jsonRequest() const
 {
 	if (header(boost::beast::http::field::content_type) != "application/json")
@@ -43,22 +53,62 @@ std::string WebRequest::baseUrl() const
 
 MultipartFormData* WebRequest::multipartBody()
 {
-	std::string_view contentType = header(boost::beast::http::field::content_type);
+	std::string boundary = multipartBoundary(header(boost::beast::http::field::content_type));
+
+	if (boundary.empty() || (m_webSession && m_webSession->m_upload))
+		return nullptr;
+	
+	if (hasRequestFile())
+		return new MultipartFormData(m_requestFile.c_str(), boundary.c_str());
+	else
+		return new MultipartFormData(&m_request.body(), boundary.c_str());
+}
+
+MultipartUpload* WebRequest::multipartUpload()
+{
+	if (m_webSession && m_webSession->m_upload)
+		return m_webSession->m_upload.get();
+
+	if (!m_upload)
+	{
+		std::string boundary = multipartBoundary(header(boost::beast::http::field::content_type));
+
+		if (boundary.empty() || !m_webSession)
+			return nullptr;
+
+		try
+		{
+			auto upload = std::make_unique<MultipartUpload>(boundary, m_webSession->spoolDirectory());
+
+			upload->feed(m_request.body().data(), m_request.body().length());
+			upload->finish();
+
+			m_upload = std::move(upload);
+		}
+		catch (const std::runtime_error& e)
+		{
+			throw WebErrors::bad_request(e.what());
+		}
+	}
+
+	return m_upload.get();
+}
+
+std::string WebRequest::multipartBoundary(std::string_view contentType)
+{
 	std::string value;
 	MultipartFormData::Headers_t params;
 
 	MultipartFormData::parseKV(contentType, value, params);
 
 	if (value != "multipart/form-data")
-		return nullptr;
-	
-	if (params.find("boundary") == params.end())
-		return nullptr;
-	
-	if (hasRequestFile())
-		return new MultipartFormData(m_requestFile.c_str(), params["boundary"].c_str());
-	else
-		return new MultipartFormData(&m_request.body(), params["boundary"].c_str());
+		return std::string();
+
+	auto it = params.find("boundary");
+	if (it == params.end())
+		return std::string();
+
+	return it->second;
 }
 
 void WebRequest::parseQueryString(const std::string& qs)
@@ -69,7 +119,7 @@ void WebRequest::parseQueryString(const std::string& qs)
 
 	while (pos < qs.length())
 	{
-		ssize_t newPos = qs.find(pos, '&');
+		ssize_t newPos = qs.find('&', pos);
 		if (newPos == std::string::npos)
 		{
 			parseQueryStringKV(std::string_view(qs).substr(pos));
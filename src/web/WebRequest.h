@@ -1,10 +1,12 @@
 #ifndef _WEBREQUEST_H
 #define _WEBREQUEST_H
 #include <boost/beast.hpp>
-#include <boost/regex.hpp>
+#include <functional>
 #include "nlohmann/json.hpp"
+#include "RouteTable.h"
 
 class MultipartFormData;
+class MultipartUpload;
 class WebSession;
 
 class WebRequest
@@ -13,6 +15,7 @@ public:
 	WebRequest(const boost::beast::http::request<boost::beast::http::string_body>& request,
 		const std::string& requestFile,
 		std::shared_ptr<WebSession> webSession);
+	~WebRequest();
 
 	const boost::beast::http::request<boost::beast::http::string_body>& request() const { return m_request; }
 
@@ -30,11 +33,18 @@ public:
 
 	std::string_view header(boost::beast::http::field hdr) const { return m_request[hdr]; }
 
-	// Returns the MIME multi-part body or nullptr
+	// Returns the MIME multi-part body or nullptr. Large bodies are only available through multipartUpload().
 	MultipartFormData* multipartBody();
+	// The multipart/form-data body with file parts spooled to disk, or nullptr if the body is something else.
+	// Large bodies have been parsed while they were received, smaller ones get parsed on the first call.
+	MultipartUpload* multipartUpload();
+	// Empty unless contentType is multipart/form-data
+	static std::string multipartBoundary(std::string_view contentType);
 
-	std::string pathParam(unsigned int sub) const { return m_matches.str(sub); }
-	std::string pathParam(const char* sub) const { return m_matches.str(sub); }
+	std::string pathParam(unsigned int sub) const
+	{
+		return (int(sub) < m_route.captureCount) ? std::string(m_route.captures[sub]) : std::string();
+	}
 
 	std::map<std::string, std::string>& privateData() { return m_privateData; }
 	std::map<std::string, std::string>& queryParams() { return m_queryParams; }
@@ -44,18 +54,23 @@ public:
 
 	const char* queryParam(const char* name);
 
+	// Hands work over to another thread, which calls resume once it's done. Until then this suspends
+	// the request's coroutine rather than the server's thread, the handler goes on on the session's strand.
+	void await(const std::function<void(std::function<void()> resume)>& work);
+
 	static std::string urlDecode(std::string_view in);
 protected:
 	boost::asio::ip::tcp::socket&& socket();
-	boost::cmatch& matches() { return m_matches; }
+	RouteTable::Match& route() { return m_route; }
 private:
 	void parseQueryString(const std::string& qs);
 	void parseQueryStringKV(std::string_view sv);
 private:
 	const boost::beast::http::request<boost::beast::http::string_body>& m_request;
 	const std::string& m_requestFile;
-	boost::cmatch m_matches;
+	RouteTable::Match m_route;
 	std::shared_ptr<WebSession> m_webSession;
+	std::unique_ptr<MultipartUpload> m_upload;
 	std::map<std::string, std::string> m_privateData;
 	std::string m_target, m_queryString;
 	std::map<std::string, std::string> m_queryParams;
@@ -7,9 +7,8 @@
 
 template<> void WebRouter::handle(method_t method, const char* regexp, handler_t handler)
 {
-	m_mappings.emplace_back(url_mapping{
-		boost::regex(regexp), method, handler
-	});
+	m_routes.add(regexp, method);
+	m_handlers.push_back(handler);
 }
 
 WebRouter* WebRouter::router(const char* route)
@@ -18,7 +17,8 @@ WebRouter* WebRouter::router(const char* route)
 		throw std::logic_error("Invalid subroute");
 	
 	std::shared_ptr<WebRouter> sub = std::make_shared<WebRouter>();
-	m_subroutes.emplace_back(subroute { route, sub });
+	m_routes.addPrefix(route);
+	m_subroutes.push_back(sub);
 	sub->m_prefix = m_prefix + route;
 	return sub.get();
 }
@@ -36,60 +36,44 @@ void WebRouter::ws(const char* regexp, wshandler_t handler)
 	});
 }
 
-bool WebRouter::findHandler(std::string_view url, method_t method, handler_t& handler, boost::cmatch& m)
+const WebRouter::handler_t* WebRouter::findHandler(std::string_view url, method_t method, RouteTable::Match& m) const
 {
 	url = url.substr(m_prefix.length());
 
-	auto itHandler = std::find_if(m_mappings.begin(), m_mappings.end(),
-		[&](const auto& mapping) {
-			if (method == mapping.method)
-			{
-				if (boost::regex_match(url.begin(), url.end(), m, mapping.re))
-					return true;
-			}
-			return false;
-		}
-	);
-
-	if (itHandler != m_mappings.end())
-	{
-		handler = itHandler->handler;
-		return true;
-	}
+	if (!m_routes.find(url, method, m))
+		return nullptr;
 
-	return false;
+	return &m_handlers[m.id];
 }
 
 void WebRouter::runHandler(WebRequest& req, WebResponse& res)
 {
-	auto it = m_filters.begin();
-	handler_t fnNext = [&](WebRequest& req, WebResponse& res) {
-		if (it == m_filters.end())
-			runHandlerNoFilters(req, res);
-		else
-		{
-			const filter_t& f = *it;
-			it++;
-			f(req, res, fnNext);
-		}
+	runFilters(0, req, res);
+}
+
+void WebRouter::runFilters(size_t index, WebRequest& req, WebResponse& res)
+{
+	if (index == m_filters.size())
+		return runHandlerNoFilters(req, res);
+
+	auto next = [this, index](WebRequest& req, WebResponse& res) {
+		runFilters(index + 1, req, res);
 	};
 
-	fnNext(req, res);
+	m_filters[index](req, res, next);
 }
 
 void WebRouter::runHandlerNoFilters(WebRequest& req, WebResponse& res)
 {
-	handler_t handler;
 	const std::string& target = req.target();
+	size_t subroute;
 
-	for (const subroute& sr : m_subroutes)
-	{
-		if (target.compare(m_prefix.length(), sr.prefix.length(), sr.prefix) == 0)
-			return sr.router->runHandler(req, res);
-	}
+	if (m_routes.findPrefix(std::string_view(target).substr(m_prefix.length()), subroute))
+		return m_subroutes[subroute]->runHandler(req, res);
 
-	if (!findHandler(target.c_str(), req.request().method(), handler, req.matches()))
+	const handler_t* handler = findHandler(target, req.request().method(), req.route());
+	if (!handler)
 		throw WebErrors::not_found("Not found");
 	
-	handler(req, res);
+	(*handler)(req, res);
 }
@@ -1,12 +1,13 @@
 #ifndef _WEBROUTER_H
 #define _WEBROUTER_H
-#include <list>
-#include <boost/regex.hpp>
+#include <vector>
 #include <boost/beast.hpp>
 #include <map>
 #include <memory>
 #include <string_view>
+#include <type_traits>
 #include "WebSocketHandler.h"
+#include "RouteTable.h"
 
 class WebRequest;
 class WebResponse;
@@ -15,7 +16,26 @@ class WebRouter
 {
 public:
 	typedef std::function<void(WebRequest&,WebResponse&)> handler_t;
-	typedef std::function<void(WebRequest&,WebResponse&,handler_t)> filter_t;
+
+	// The rest of a filter chain. Only refers to a callable living on the caller's stack,
+	// so passing it to filters doesn't allocate.
+	class next_t
+	{
+	public:
+		template <typename Callable, typename = std::enable_if_t<!std::is_same_v<Callable, next_t>>>
+		next_t(const Callable& c)
+		: m_callable(&c), m_invoke([](const void* c, WebRequest& req, WebResponse& res) {
+			(*static_cast<const Callable*>(c))(req, res);
+		})
+		{
+		}
+
+		void operator()(WebRequest& req, WebResponse& res) const { m_invoke(m_callable, req, res); }
+	private:
+		const void* m_callable;
+		void (*m_invoke)(const void*, WebRequest&, WebResponse&);
+	};
+	typedef std::function<void(WebRequest&,WebResponse&,const next_t&)> filter_t;
 	typedef std::function<bool(WebSocketHandler&,WebRequest&,WebResponse&)> wshandler_t;
 	typedef boost::beast::http::verb method_t;
 
@@ -49,38 +69,31 @@ public:
 	void ws(const char* regexp, wshandler_t handler);
 	WebRouter* router(const char* route);
 
-	bool findHandler(std::string_view url, method_t method, handler_t& handler, boost::cmatch& m);
+	// nullptr if there's no matching route
+	const handler_t* findHandler(std::string_view url, method_t method, RouteTable::Match& m) const;
 	void runHandler(WebRequest& req, WebResponse& res);
 
 	WebRouter* addFilter(filter_t filter) { m_filters.push_back(filter); return this; }
 
+	// Composed once here, running the result allocates nothing more
 	template <typename Callable, typename... Args>
 	static WebRouter::handler_t inlineFilter(filter_t filter, Callable c, Args... args)
 	{
 		return [=](WebRequest& req, WebResponse& resp) {
-			filter(req, resp, [=](WebRequest& req, WebResponse& resp) {
+			filter(req, resp, [&](WebRequest& req, WebResponse& resp) {
 				c(req, resp, args...);
 			});
 		};
 	}
 protected:
+	void runFilters(size_t index, WebRequest& req, WebResponse& res);
 	void runHandlerNoFilters(WebRequest& req, WebResponse& res);
 private:
-	struct url_mapping
-	{
-		boost::regex re;
-		method_t method;
-		handler_t handler;
-	};
-	std::list<url_mapping> m_mappings;
-
-	struct subroute
-	{
-		std::string prefix;
-		std::shared_ptr<WebRouter> router;
-	};
-	std::list<subroute> m_subroutes;
-	std::list<filter_t> m_filters;
+	RouteTable m_routes;
+	// Indexed by route and prefix ids of m_routes
+	std::vector<handler_t> m_handlers;
+	std::vector<std::shared_ptr<WebRouter>> m_subroutes;
+	std::vector<filter_t> m_filters;
 	std::string m_prefix;
 };
 
@@ -28,8 +28,13 @@ public:
 	~WebServer();
 	
 	void start(int port);
+	// The port listened on, such as the one picked when started on port 0
+	int port() const { return m_acceptor.local_endpoint().port(); }
 
-	
+	// Request bodies over 1 MB are spooled into files in this directory, the cache directory by default.
+	// Handlers can then rename them into place if it's on the same filesystem as their destination.
+	void setUploadDirectory(std::string path) { m_uploadDirectory = std::move(path); }
+	const std::string& uploadDirectory() const { return m_uploadDirectory; }
 private:
 	void doAccept();
 	void connectionAccepted(boost::system::error_code ec);
@@ -38,6 +43,7 @@ private:
 
 	boost::asio::ip::tcp::acceptor m_acceptor;
 	boost::asio::ip::tcp::socket m_socket;
+	std::string m_uploadDirectory;
 protected:
 
 	friend class WebSession;
@@ -21,7 +21,9 @@
 #include "nlohmann/json.hpp"
 #include "WebRequest.h"
 #include "WebResponse.h"
+#include "MultipartUpload.h"
 #include <cstdlib>
+#include <cerrno>
 #include <unistd.h>
 
 WebSession::WebSession(WebServer* ws, boost::asio::ip::tcp::socket socket)
@@ -60,34 +62,83 @@ private:
 	std::string m_path;
 };
 
-std::string WebSession::processLargeBody(uint64_t length)
+void WebSession::readBody(uint64_t length, const std::function<void(const char*, size_t)>& sink)
 {
-	std::unique_ptr<char[]> path;
-	std::string dir = cachePath();
+	// Large reads keep the number of write() calls and coroutine switches per upload low
+	static constexpr size_t READ_SIZE = 256*1024;
+
+	uint64_t done = 0;
+	while (done < length)
+	{
+		// Whatever was read along with the headers goes first
+		if (m_buffer.size() == 0)
+			m_buffer.commit(m_socket.async_read_some(m_buffer.prepare(READ_SIZE), *m_yield));
 
-	path.reset(new char[dir.length() + 13]);
-	std::strcpy(path.get(), dir.c_str());
-	std::strcat(path.get(), "uploadXXXXXX");
+		const size_t num = std::min<uint64_t>(m_buffer.size(), length - done);
+
+		sink(static_cast<const char*>(m_buffer.data().data()), num);
+
+		done += num;
+		m_buffer.consume(num);
+	}
+}
+
+std::string WebSession::processLargeBody(uint64_t length)
+{
+	std::string path = spoolDirectory() + "uploadXXXXXX";
 
-	int fd = ::mkstemp(path.get());
+	int fd = ::mkstemp(&path[0]);
 	if (fd == -1)
 		throw std::runtime_error("Unable to create temporary file");
 
-	uint64_t read = 0;
-	while (read < length)
+	deletefile df;
+	df.deleteLater(path);
+
+	try
+	{
+		readBody(length, [&](const char* data, size_t length) {
+			while (length > 0)
+			{
+				const ssize_t rv = ::write(fd, data, length);
+				if (rv < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw std::runtime_error("Unable to write temporary file");
+				}
+				data += rv;
+				length -= rv;
+			}
+		});
+	}
+	catch (...)
 	{
-		size_t num = std::min<size_t>(m_buffer.size(), length-read);
+		::close(fd);
+		throw;
+	}
 
-		::write(fd, m_buffer.data().data(), num);
+	::close(fd);
+	df.deleteLater(std::string());
+	return path;
+}
 
-		read += num;
-		m_buffer.consume(num);
+std::unique_ptr<MultipartUpload> WebSession::processMultipartBody(uint64_t length, std::string_view boundary)
+{
+	auto upload = std::make_unique<MultipartUpload>(boundary, spoolDirectory());
 
-		boost::asio::async_read(m_socket, m_buffer.prepare(10*1024), *m_yield);
-	}
+	readBody(length, [&](const char* data, size_t length) {
+		upload->feed(data, length);
+	});
+	upload->finish();
 
-	::close(fd);
-	return path.get();
+	return upload;
+}
+
+std::string WebSession::spoolDirectory() const
+{
+	if (m_server->uploadDirectory().empty())
+		return cachePath();
+	return m_server->uploadDirectory() + '/';
 }
 
 bool WebSession::handleExpect100Continue()
@@ -124,25 +175,38 @@ void WebSession::doRead()
 			if (!handleExpect100Continue())
 				continue;
 
-			boost::optional<uint64_t> length;
-			m_requestParser->get().content_length(length);
+			// Not the message's content_length(), which would set the header
+			boost::optional<uint64_t> length = m_requestParser->content_length();
+
+			m_bodyFile.clear();
+			m_upload.reset();
 
 			if (length && length.value() > 1024 * 1024)
 			{
-				// Save body to a temporary file
-				m_bodyFile = processLargeBody(length.value());
-				df.deleteLater(m_bodyFile);
+				std::string boundary = WebRequest::multipartBoundary(m_requestParser->get()[boost::beast::http::field::content_type]);
+
+				if (!boundary.empty())
+				{
+					// Parse the body on the fly rather than spooling it as a whole
+					m_upload = processMultipartBody(length.value(), boundary);
+				}
+				else
+				{
+					// Save body to a temporary file
+					m_bodyFile = processLargeBody(length.value());
+					df.deleteLater(m_bodyFile);
+				}
 			}
 			else
-			{
-				m_bodyFile.clear();
 				boost::beast::http::async_read(m_socket, m_buffer, *m_requestParser, *m_yield);
-			}
 
 			m_request = m_requestParser->release();
 
 			if (!handleRequest())
 				/*break*/;
+
+			// Deletes whatever parts the handler didn't keep
+			m_upload.reset();
 			break;
 		}
 		catch (const std::exception &e)
@@ -153,6 +217,23 @@ void WebSession::doRead()
 	}
 }
 
+void WebSession::await(const std::function<void(std::function<void()> resume)>& work)
+{
+	// Never expires, resume() cancels it
+	auto timer = std::make_shared<boost::asio::steady_timer>(m_strand, boost::asio::steady_timer::time_point::max());
+	auto self = shared_from_this();
+
+	// Posted to the strand, so the cancellation cannot come before the wait even if work resumes right away
+	work([this, self, timer]() {
+		boost::asio::post(m_strand, [timer]() {
+			timer->cancel();
+		});
+	});
+
+	boost::system::error_code ec;
+	timer->async_wait((*m_yield)[ec]);
+}
+
 std::string WebSession::cachePath()
 {
 	const char* home = ::getenv("HOME");
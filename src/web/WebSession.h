@@ -16,10 +16,13 @@
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 #include <memory>
+#include <functional>
+#include <string_view>
 #include <stdexcept>
 #include <boost/asio/spawn.hpp>
 
 class WebServer;
+class MultipartUpload;
 
 class WebSession : public std::enable_shared_from_this<WebSession>
 {
@@ -32,13 +35,20 @@ public:
 private:
 	void doRead();
 	void doClose();
+	// Passes the body on to sink in pieces as it's read from the socket
+	void readBody(uint64_t length, const std::function<void(const char*, size_t)>& sink);
 	std::string processLargeBody(uint64_t length);
+	std::unique_ptr<MultipartUpload> processMultipartBody(uint64_t length, std::string_view boundary);
 	bool handleRequest();
 	bool handleAuthentication();
 	bool handleExpect100Continue();
+	// See WebRequest::await()
+	void await(const std::function<void(std::function<void()> resume)>& work);
 	// void sendWWWAuthenticate();
 	
 	static std::string cachePath();
+	// Where large bodies are written, ends with a slash
+	std::string spoolDirectory() const;
 	// static void parseAuthenticationKV(std::string in, std::map<std::string,std::string>& out);
 
 	// Returns true if given HTTP request target doesn't use standard authentication
@@ -60,6 +70,8 @@ protected:
 	boost::optional<boost::asio::yield_context> m_yield;
 
 	std::string m_bodyFile;
+	// Large multipart/form-data bodies are parsed while they're received
+	std::unique_ptr<MultipartUpload> m_upload;
 	
 	friend class WebRequest;
 	friend class WebResponse;
@@ -3,3 +3,4 @@
 #include "WebResponse.h"
 #include "WebSocketHandler.h"
 #include "MultipartFormData.h"
+#include "MultipartUpload.h"
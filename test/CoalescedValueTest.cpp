@@ -0,0 +1,76 @@
+#define BOOST_TEST_MODULE CoalescedValueTest
+#include <boost/test/included/unit_test.hpp>
+#include "api/CoalescedValue.h"
+#include <thread>
+#include <vector>
+
+typedef CoalescedValue<size_t> Coalesced;
+
+BOOST_AUTO_TEST_CASE(TestLastValueWins)
+{
+	boost::asio::io_service io;
+	Coalesced::Strand strand(boost::asio::executor(io.get_executor()));
+	std::vector<size_t> values;
+
+	auto value = std::make_shared<Coalesced>(strand, 10, [&](size_t v) {
+		values.push_back(v);
+	});
+
+	value->set(1);
+	value->set(2);
+	value->set(3);
+	io.run_for(std::chrono::milliseconds(100));
+
+	BOOST_TEST(values == std::vector<size_t>({ 3 }), boost::test_tools::per_element());
+
+	// Set again once the call is done
+	value->set(4);
+	io.restart();
+	io.run_for(std::chrono::milliseconds(200));
+
+	BOOST_TEST(values == std::vector<size_t>({ 3, 4 }), boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(TestRateLimit)
+{
+	boost::asio::io_service io;
+	Coalesced::Strand strand(boost::asio::executor(io.get_executor()));
+	const double rate = 50;
+	const size_t count = 3000;
+	std::vector<std::pair<std::chrono::steady_clock::time_point, size_t>> calls;
+
+	auto value = std::make_shared<Coalesced>(strand, rate, [&](size_t v) {
+		calls.emplace_back(std::chrono::steady_clock::now(), v);
+	});
+
+	// From another thread, as the printer sets job progress
+	const auto start = std::chrono::steady_clock::now();
+	std::thread setter([&]() {
+		for (size_t i = 1; i <= count; i++)
+		{
+			value->set(i);
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	});
+
+	auto work = boost::asio::make_work_guard(io);
+	std::thread runner([&]() { io.run(); });
+
+	setter.join();
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+
+	// Enough for the last call
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	io.stop();
+	runner.join();
+
+	BOOST_REQUIRE(!calls.empty());
+	BOOST_TEST(calls.back().second == count);
+	BOOST_TEST(calls.size() <= std::chrono::duration<double>(elapsed).count() * rate + 2);
+
+	for (size_t i = 1; i < calls.size(); i++)
+	{
+		BOOST_TEST(std::chrono::duration<double>(calls[i].first - calls[i-1].first).count() >= 0.95 / rate);
+		BOOST_TEST(calls[i].second > calls[i-1].second);
+	}
+}
@@ -0,0 +1,217 @@
+#define BOOST_TEST_MODULE FileApiTest
+#include <boost/test/included/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include "web/WebServer.h"
+#include "api/FileApi.h"
+#include "FileManager.h"
+#include "web/WebRequest.h"
+#include "web/WebResponse.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <future>
+#include <chrono>
+
+// Removed once the file manager is done with it
+struct TempStorage
+{
+	TempStorage()
+	{
+		path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("FileApiTest%%%%%%");
+	}
+	~TempStorage()
+	{
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(path, ec);
+	}
+
+	boost::filesystem::path path;
+};
+
+// The file API served on a port of its own, backed by a storage directory of its own
+struct FileApiServer
+{
+	FileApiServer()
+	: fileManager(storage.path.string()), server(io)
+	{
+		server.setUploadDirectory(fileManager.uploadDirectory());
+		routeFile(server.router("/api/v1/"), fileManager);
+		server.start(0);
+
+		thread = std::thread([this]() { io.run(); });
+	}
+	~FileApiServer()
+	{
+		io.stop();
+		thread.join();
+	}
+
+	boost::beast::http::response<boost::beast::http::string_body> request(boost::beast::http::verb method,
+		const std::string& target, const std::string& contentType = std::string(), const std::string& body = std::string())
+	{
+		boost::asio::io_service clientIo;
+		boost::asio::ip::tcp::socket socket(clientIo);
+		socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.port()));
+
+		boost::beast::http::request<boost::beast::http::string_body> request(method, target, 11);
+		request.set(boost::beast::http::field::host, "localhost");
+		if (!contentType.empty())
+			request.set(boost::beast::http::field::content_type, contentType);
+		request.body() = body;
+		request.prepare_payload();
+		boost::beast::http::write(socket, request);
+
+		boost::beast::flat_buffer buffer;
+		boost::beast::http::response<boost::beast::http::string_body> response;
+		boost::beast::http::read(socket, buffer, response);
+
+		return response;
+	}
+
+	boost::beast::http::response<boost::beast::http::string_body> post(const std::string& target,
+		const std::string& contentType, const std::string& body)
+	{
+		return request(boost::beast::http::verb::post, target, contentType, body);
+	}
+
+	boost::beast::http::response<boost::beast::http::string_body> get(const std::string& target)
+	{
+		return request(boost::beast::http::verb::get, target);
+	}
+
+	std::string readFile(const std::string& name)
+	{
+		std::ifstream file(fileManager.getFilePath(name), std::ios_base::in | std::ios_base::binary);
+		std::stringstream ss;
+		ss << file.rdbuf();
+		return ss.str();
+	}
+
+	TempStorage storage;
+	boost::asio::io_service io;
+	FileManager fileManager;
+	WebServer server;
+	std::thread thread;
+};
+
+static std::string formBody(const std::string& boundary, const std::string& field, const std::string& contents)
+{
+	return "--" + boundary + "\r\n"
+		"Content-Disposition: form-data; name=\"" + field + "\"; filename=\"upload.gcode\"\r\n"
+		"Content-Type: application/octet-stream\r\n\r\n" + contents + "\r\n"
+		"--" + boundary + "--\r\n";
+}
+
+static std::string gcode(int lines)
+{
+	std::string rv;
+	for (int i = 0; i < lines; i++)
+		rv += "G1 X" + std::to_string(i % 200) + " Y" + std::to_string(i % 170) + " E0.0123\n";
+	return rv;
+}
+
+BOOST_AUTO_TEST_CASE(TestUploadForm)
+{
+	FileApiServer api;
+	const std::string boundary = "----dashprint1234";
+
+	// Streamed into a file part by the web server, and kept in memory
+	for (int lines : { 100000, 100 })
+	{
+		const std::string contents = gcode(lines);
+		const std::string name = "form" + std::to_string(lines) + ".gcode";
+
+		auto response = api.post("/api/v1/files/" + name, "multipart/form-data; boundary=" + boundary,
+			formBody(boundary, "file", contents));
+
+		BOOST_TEST(response.result_int() == 201);
+		BOOST_TEST(api.readFile(name) == contents);
+	}
+	BOOST_TEST(gcode(100000).length() > 1024*1024);
+}
+
+BOOST_AUTO_TEST_CASE(TestUploadFormWithoutFile)
+{
+	FileApiServer api;
+	const std::string boundary = "----dashprint1234";
+
+	auto response = api.post("/api/v1/files/none.gcode", "multipart/form-data; boundary=" + boundary,
+		formBody(boundary, "other", gcode(100000)));
+
+	BOOST_TEST(response.result_int() == 400);
+	BOOST_TEST(!boost::filesystem::exists(api.fileManager.getFilePath("none.gcode")));
+}
+
+BOOST_AUTO_TEST_CASE(TestUploadRawBody)
+{
+	FileApiServer api;
+
+	for (int lines : { 100000, 100 })
+	{
+		const std::string contents = gcode(lines);
+		const std::string name = "raw" + std::to_string(lines) + ".gcode";
+
+		auto response = api.post("/api/v1/files/" + name, "application/octet-stream", contents);
+
+		BOOST_TEST(response.result_int() == 201);
+		BOOST_TEST(api.readFile(name) == contents);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(TestAnalysisPending)
+{
+	FileApiServer api;
+	const std::string contents = gcode(200000);
+
+	// Keeps the analysis thread busy for a while
+	for (int i = 0; i < 4; i++)
+		api.fileManager.saveFile("queued" + std::to_string(i) + ".gcode", contents.data(), contents.length());
+
+	// Answered right away rather than once the queue is done
+	auto response = api.get("/api/v1/files/queued3.gcode/analysis");
+	BOOST_TEST(response.result_int() == 202);
+	BOOST_TEST(nlohmann::json::parse(response.body()) == (nlohmann::json { { "status", "pending" } }));
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (response.result_int() == 202 && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		response = api.get("/api/v1/files/queued3.gcode/analysis");
+	}
+
+	BOOST_TEST(response.result_int() == 200);
+	BOOST_TEST(nlohmann::json::parse(response.body())["lines"].get<size_t>() == 200000);
+	// Moved ahead of the ones queued before it
+	BOOST_TEST(!boost::filesystem::exists(FileManager::analysisPath(api.fileManager.getFilePath("queued2.gcode"))));
+
+	BOOST_TEST(api.get("/api/v1/files/missing.gcode/analysis").result_int() == 404);
+}
+
+BOOST_AUTO_TEST_CASE(TestAwaitKeepsServing)
+{
+	FileApiServer api;
+	std::promise<void> release;
+	std::shared_future<void> released = release.get_future().share();
+
+	api.server.router("/test/")->get("wait", [&](WebRequest& req, WebResponse& resp) {
+		req.await([&](std::function<void()> resume) {
+			std::thread([released, resume]() {
+				released.wait();
+				resume();
+			}).detach();
+		});
+		resp.send("done", "text/plain");
+	});
+
+	std::future<std::string> waiting = std::async(std::launch::async, [&]() {
+		return api.get("/test/wait").body();
+	});
+
+	// The server's only thread serves other requests meanwhile
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	BOOST_TEST(api.get("/api/v1/files").result_int() == 200);
+	BOOST_TEST((waiting.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout));
+
+	release.set_value();
+	BOOST_TEST(waiting.get() == "done");
+}
@@ -0,0 +1,288 @@
+#define BOOST_TEST_MODULE FileManagerTest
+#include <boost/test/included/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include "FileManager.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <sys/stat.h>
+
+// A storage directory of its own, removed again at the end
+struct TempStorage
+{
+	TempStorage()
+	{
+		path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("FileManagerTest%%%%%%");
+	}
+	~TempStorage()
+	{
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(path, ec);
+	}
+
+	boost::filesystem::path path;
+};
+
+static void writeFile(const std::string& path, const std::string& contents)
+{
+	std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	file << contents;
+}
+
+static std::string readFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	std::stringstream ss;
+	ss << file.rdbuf();
+	return ss.str();
+}
+
+static ino_t inode(const std::string& path)
+{
+	struct stat st;
+	BOOST_REQUIRE(::stat(path.c_str(), &st) == 0);
+	return st.st_ino;
+}
+
+// layers layers of a square each, preceded by a thumbnail when asked for
+static std::string gcode(int layers, bool thumbnail = false)
+{
+	std::string rv;
+
+	if (thumbnail)
+		rv += "; thumbnail begin 2x2 16\n; iVBORw0KGgowMDAw\n; thumbnail end\n";
+
+	rv += "G90\nM82\nG28\n";
+	for (int i = 1; i <= layers; i++)
+	{
+		rv += "G1 Z" + std::to_string(i * 0.2) + " F600\n";
+		rv += "G1 X10 Y0 E" + std::to_string(i * 4 - 3) + "\nG1 X10 Y10 E" + std::to_string(i * 4 - 2) + "\n";
+		rv += "G1 X0 Y10 E" + std::to_string(i * 4 - 1) + "\nG1 X0 Y0 E" + std::to_string(i * 4) + "\n";
+	}
+
+	return rv;
+}
+
+// What listFiles() has for the file once the analysis threads are done with it
+static nlohmann::json waitForMetadata(FileManager& fm, const std::string& name)
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		for (const FileManager::FileInfo& fi : fm.listFiles())
+		{
+			if (fi.name == name && !fi.metadata.is_null())
+				return fi.metadata;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	BOOST_FAIL("No metadata for " << name);
+	return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(TestSaveSpooledFile)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+
+	// As a request body spooled by the web server
+	const std::string spooled = fm.uploadDirectory() + "/body";
+	writeFile(spooled, "G28\nG1 X10\n");
+	const ino_t spooledInode = inode(spooled);
+
+	BOOST_TEST(fm.saveFile("a/b.gcode", spooled) == "a_b.gcode");
+
+	const std::string path = fm.getFilePath("a_b.gcode");
+	BOOST_TEST(readFile(path) == "G28\nG1 X10\n");
+	// Renamed, not copied
+	BOOST_TEST(!boost::filesystem::exists(spooled));
+	BOOST_TEST(inode(path) == spooledInode);
+	BOOST_TEST((boost::filesystem::status(path).permissions() & 0777) == 0644);
+	BOOST_TEST(boost::filesystem::is_empty(fm.uploadDirectory()));
+}
+
+BOOST_AUTO_TEST_CASE(TestSaveReplacesAtomically)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+	const std::string newContents = "G28\n";
+	std::string oldContents;
+	for (int i = 0; i < 10000; i++)
+		oldContents += "G1 X" + std::to_string(i) + "\n";
+
+	fm.saveFile("part.gcode", oldContents.data(), oldContents.length());
+	const std::string path = fm.getFilePath("part.gcode");
+
+	// A print reading the old file keeps reading all of it
+	std::ifstream printing(path, std::ios_base::in | std::ios_base::binary);
+	BOOST_REQUIRE(printing.is_open());
+
+	fm.saveFile("part.gcode", newContents.data(), newContents.length());
+
+	BOOST_TEST(readFile(path) == newContents);
+	std::stringstream ss;
+	ss << printing.rdbuf();
+	BOOST_TEST(ss.str() == oldContents);
+
+	// No temporary files left behind
+	BOOST_TEST(boost::filesystem::is_empty(fm.uploadDirectory()));
+	for (auto& entry : boost::filesystem::directory_iterator(storage.path))
+	{
+		const std::string name = entry.path().filename().string();
+		BOOST_TEST((name == ".uploads" || name.compare(0, 10, "part.gcode") == 0), name);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(TestSaveOutsideFile)
+{
+	TempStorage storage, outside;
+	boost::filesystem::create_directories(outside.path);
+	FileManager fm(storage.path.string());
+
+	const std::string source = (outside.path / "upload.gcode").string();
+	writeFile(source, "G28\n");
+
+	BOOST_TEST(fm.saveFile("copy.gcode", source) == "copy.gcode");
+
+	// Copied, the original stays where it is
+	const std::string path = fm.getFilePath("copy.gcode");
+	BOOST_TEST(readFile(path) == "G28\n");
+	BOOST_TEST(readFile(source) == "G28\n");
+	BOOST_TEST(inode(path) != inode(source));
+	BOOST_TEST(boost::filesystem::is_empty(fm.uploadDirectory()));
+}
+
+BOOST_AUTO_TEST_CASE(TestAnalyzeStoredFiles)
+{
+	TempStorage storage;
+	boost::filesystem::create_directories(storage.path);
+	writeFile((storage.path / "stored.gcode").string(), gcode(5, true));
+	writeFile((storage.path / "notes.txt").string(), "G28\n");
+
+	// Files put there before the start are queued by the constructor
+	FileManager fm(storage.path.string());
+	const nlohmann::json metadata = waitForMetadata(fm, "stored.gcode");
+
+	BOOST_TEST(metadata["layers"].get<size_t>() == 5);
+	BOOST_TEST(metadata["filament"].get<double>() == 20);
+	BOOST_TEST(metadata["max"][0].get<float>() == 10);
+	BOOST_TEST(metadata["hash"].get<std::string>().length() == 16);
+	BOOST_TEST(metadata["estimated_time"].is_number());
+	BOOST_TEST(metadata["thumbnail"] == (nlohmann::json { { "width", 2 }, { "height", 2 } }));
+
+	const std::string path = fm.getFilePath("stored.gcode");
+	BOOST_TEST(readFile(FileManager::thumbnailPath(path)) == "\x89PNG\r\n\x1a\n0000");
+	BOOST_TEST(boost::filesystem::exists(FileManager::analysisPath(path)));
+	BOOST_TEST(!boost::filesystem::exists(FileManager::analysisPath(fm.getFilePath("notes.txt"))));
+
+	// Served from the cache written by the analysis thread
+	const std::optional<nlohmann::json> analysis = fm.getAnalysis("stored.gcode");
+	BOOST_REQUIRE(analysis.has_value());
+	BOOST_TEST((*analysis)["layers"].size() == 5);
+	BOOST_TEST((*analysis)["hash"] == metadata["hash"]);
+
+	// A later start reuses the cache
+	const std::time_t analyzed = boost::filesystem::last_write_time(FileManager::analysisPath(path));
+	boost::filesystem::last_write_time(FileManager::analysisPath(path), analyzed - 100);
+	FileManager restarted(storage.path.string());
+	BOOST_TEST(waitForMetadata(restarted, "stored.gcode") == metadata);
+	BOOST_TEST(boost::filesystem::last_write_time(FileManager::analysisPath(path)) == analyzed - 100);
+}
+
+BOOST_AUTO_TEST_CASE(TestReanalyzeChangedFile)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+
+	const std::string contents = gcode(3);
+	fm.saveFile("part.gcode", contents.data(), contents.length());
+	BOOST_TEST(waitForMetadata(fm, "part.gcode")["layers"].get<size_t>() == 3);
+
+	// Changed by other means than an upload
+	const std::string path = fm.getFilePath("part.gcode");
+	const std::time_t mtime = boost::filesystem::last_write_time(path);
+	writeFile(path, gcode(7));
+	boost::filesystem::last_write_time(path, mtime + 10);
+
+	// The old summary isn't shown for the new contents
+	for (const FileManager::FileInfo& fi : fm.listFiles())
+		BOOST_TEST(fi.metadata.is_null());
+	BOOST_TEST(waitForMetadata(fm, "part.gcode")["layers"].get<size_t>() == 7);
+	BOOST_TEST(fm.getAnalysis("part.gcode").value()["layers"].size() == 7);
+}
+
+BOOST_AUTO_TEST_CASE(TestGetAnalysisPending)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+
+	// Keeps the analysis thread busy for a while
+	const std::string contents = gcode(20000);
+	for (int i = 0; i < 4; i++)
+		fm.saveFile("queued" + std::to_string(i) + ".gcode", contents.data(), contents.length());
+
+	// Doesn't wait, but moves the file ahead of the ones queued before it
+	BOOST_TEST(!fm.getAnalysis("queued3.gcode").has_value());
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	std::optional<nlohmann::json> analysis;
+	while (!(analysis = fm.getAnalysis("queued3.gcode")) && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	BOOST_REQUIRE(analysis.has_value());
+	BOOST_TEST((*analysis)["layers"].size() == 20000);
+	BOOST_TEST(!boost::filesystem::exists(FileManager::analysisPath(fm.getFilePath("queued2.gcode"))));
+
+	BOOST_CHECK_THROW(fm.getAnalysis("missing.gcode"), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(TestPostAheadOfQueue)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+
+	const std::string contents = gcode(20000);
+	for (int i = 0; i < 4; i++)
+		fm.saveFile("queued" + std::to_string(i) + ".gcode", contents.data(), contents.length());
+
+	// What print jobs starting mid-file do
+	std::promise<FileManager::StartPoint> promise;
+	fm.post([&]() {
+		promise.set_value(fm.layerStartPoint("queued3.gcode", 2));
+	});
+
+	const FileManager::StartPoint start = promise.get_future().get();
+	BOOST_TEST(start.offset == contents.find("G1 Z0.6"));
+	BOOST_TEST(start.state.position[2] == 0.4f);
+	BOOST_TEST(start.state.e == 8);
+	BOOST_TEST(!boost::filesystem::exists(FileManager::analysisPath(fm.getFilePath("queued2.gcode"))));
+
+	BOOST_CHECK_THROW(fm.layerStartPoint("queued3.gcode", 20000), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(TestOffsetStartPoint)
+{
+	TempStorage storage;
+	FileManager fm(storage.path.string());
+
+	const std::string contents = gcode(2) + "G91\nM83\nG1 X1 E1\n";
+	fm.saveFile("part.gcode", contents.data(), contents.length());
+
+	// Moved back to the start of the line
+	const size_t layer2 = contents.find("G1 Z0.4");
+	FileManager::StartPoint start = fm.offsetStartPoint("part.gcode", layer2 + 3);
+	BOOST_TEST(start.offset == layer2);
+	BOOST_TEST(start.state.position[2] == 0.2f);
+	BOOST_TEST(start.state.e == 4);
+	BOOST_TEST(!start.state.relative);
+
+	start = fm.offsetStartPoint("part.gcode", contents.find("G1 X1 E1"));
+	BOOST_TEST(start.state.relative);
+	BOOST_TEST(start.state.relativeE);
+
+	BOOST_CHECK_THROW(fm.offsetStartPoint("part.gcode", contents.length()), std::out_of_range);
+}
@@ -1,7 +1,13 @@
 #define BOOST_TEST_MODULE MultipartTest
 #include <boost/test/included/unit_test.hpp>
 #include "web/MultipartFormData.h"
+#include "web/MultipartParser.h"
+#include "web/MultipartUpload.h"
+#include "TempFile.h"
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
 
 BOOST_AUTO_TEST_CASE(TestKVParse)
 {
@@ -40,19 +46,15 @@ BOOST_AUTO_TEST_CASE(TestMultipartParse)
 		"\r\n"
 		"Contents of file1.txt--AaB03x--";
 		   
-	char tempfile[] = "/tmp/TestMultipartParseXXXXXX";
-	int fd = mkstemp(tempfile);
+	const std::string tempfile = makeTempFile("TestMultipartParse", std::string_view(multipart, sizeof(multipart)-1));
 
-	write(fd, multipart, sizeof(multipart)-1);
-	close(fd);
+	MultipartFormData mfd(tempfile.c_str());
 
-	MultipartFormData mfd(tempfile);
-
-	remove(tempfile);
+	remove(tempfile.c_str());
 
 	int callbacks = 0;
 
-	mfd.parse([&](const MultipartFormData::Headers_t& headers, const char* name, const void* data, uint64_t length) {
+	mfd.parse([&](const MultipartFormData::Headers_t&, const char* name, const void* data, uint64_t length) {
 		if (std::strcmp(name, "submit-name") == 0)
 		{
 			BOOST_TEST(length == 6);
@@ -72,3 +74,104 @@ BOOST_AUTO_TEST_CASE(TestMultipartParse)
 
 	BOOST_TEST(callbacks == 2);
 }
+
+static const char STREAMED_BODY[] = "preamble\r\n"
+	"--AaB03x\r\n"
+	"Content-Disposition: form-data; name=\"print\"\r\n"
+	"\r\n"
+	"true\r\n"
+	"--AaB03x  \r\n"
+	"Content-Disposition: form-data; name=\"file\"; filename=\"part.gcode\"\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"\r\n"
+	"G28\r\n--AaB03\r\r\n--AaB0\r\nG1 X10\r\n"
+	"--AaB03x--\r\n"
+	"epilogue";
+
+BOOST_AUTO_TEST_CASE(TestMultipartParserChunks)
+{
+	const std::string body = STREAMED_BODY;
+
+	// Delimiters split across pieces of every size must be found all the same
+	for (size_t chunk = 1; chunk <= body.length(); chunk++)
+	{
+		std::vector<std::string> names, contents;
+
+		MultipartParser parser("AaB03x", [&](const MultipartParser::Headers_t& headers) {
+			names.push_back(headers.at("content-disposition"));
+			contents.emplace_back();
+		}, [&](const char* data, size_t length) {
+			contents.back().append(data, length);
+		}, [&]() {
+		});
+
+		for (size_t pos = 0; pos < body.length(); pos += chunk)
+			parser.feed(body.data() + pos, std::min(chunk, body.length() - pos));
+
+		BOOST_TEST(parser.done());
+		BOOST_TEST_REQUIRE(contents.size() == 2);
+		BOOST_TEST(names[0] == "form-data; name=\"print\"");
+		BOOST_TEST(contents[0] == "true");
+		BOOST_TEST(contents[1] == "G28\r\n--AaB03\r\r\n--AaB0\r\nG1 X10");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(TestMultipartParserErrors)
+{
+	auto parse = [](const std::string& body) {
+		MultipartParser parser("AaB03x", [](const MultipartParser::Headers_t&) {}, [](const char*, size_t) {}, []() {});
+		parser.feed(body.data(), body.length());
+		return parser.done();
+	};
+
+	// Starting right with the delimiter, without a CRLF before it
+	BOOST_TEST(parse("--AaB03x\r\n\r\nvalue\r\n--AaB03x--"));
+	BOOST_TEST(!parse("--AaB03x\r\n\r\nvalue\r\n--AaB03x"));
+	BOOST_TEST(!parse("--AaB03x\r\n\r\nvalue--AaB03x--"));
+	BOOST_CHECK_THROW(parse("--AaB03x garbage\r\n\r\n"), std::runtime_error);
+	BOOST_CHECK_THROW(parse("--AaB03x\r\n" + std::string(20000, 'x')), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TestMultipartUpload)
+{
+	char dir[] = "/tmp/TestMultipartUploadXXXXXX";
+	BOOST_TEST_REQUIRE(mkdtemp(dir) != nullptr);
+
+	const std::string body = STREAMED_BODY;
+	std::string path;
+
+	{
+		MultipartUpload upload("AaB03x", std::string(dir) + "/");
+
+		for (size_t pos = 0; pos < body.length(); pos += 7)
+			upload.feed(body.data() + pos, std::min<size_t>(7, body.length() - pos));
+		upload.finish();
+
+		const MultipartUpload::Part* print = upload.part("print");
+		const MultipartUpload::Part* file = upload.part("file");
+
+		BOOST_TEST_REQUIRE(print != nullptr);
+		BOOST_TEST(print->value == "true");
+		BOOST_TEST(print->path.empty());
+
+		BOOST_TEST_REQUIRE(file != nullptr);
+		BOOST_TEST(file->filename == "part.gcode");
+		BOOST_TEST(file->value.empty());
+		BOOST_TEST(file->length == 29);
+
+		std::ifstream in(file->path, std::ios_base::binary);
+		std::stringstream ss;
+		ss << in.rdbuf();
+		BOOST_TEST(ss.str() == "G28\r\n--AaB03\r\r\n--AaB0\r\nG1 X10");
+
+		path = file->path;
+	}
+
+	// Deleted along with the upload
+	BOOST_TEST(::access(path.c_str(), F_OK) != 0);
+	::rmdir(dir);
+
+	MultipartUpload truncated("AaB03x", "/tmp/");
+	truncated.feed(body.data(), body.length() / 2);
+	BOOST_CHECK_THROW(truncated.finish(), std::runtime_error);
+}
@@ -4,7 +4,21 @@
 
 #define BOOST_TEST_MODULE PrinterTest
 #include <boost/test/included/unit_test.hpp>
+#include <boost/filesystem.hpp>
 #include "Printer.h"
+#include "GCodeSource.h"
+#include "PrintJob.h"
+#include "TemperatureParser.h"
+#include "LinkStats.h"
+#include "LineFramer.h"
+#include "ArcFitter.h"
+#include "PrintTimeEstimator.h"
+#include "JobJournal.h"
+#include "wasm/gcode-analyzer/GCodeAnalyzer.h"
+#include "wasm/gcode-analyzer/GCodeScanner.h"
+#include "TempFile.h"
+#include <fcntl.h>
+#include <sys/stat.h>
 
 BOOST_AUTO_TEST_CASE(TestKVParse)
 {
@@ -16,3 +30,1268 @@ BOOST_AUTO_TEST_CASE(TestKVParse)
 	BOOST_TEST(kv["FIRMWARE_NAME"] == "Marlin V1.0.2; Sprinter/grbl mashup for gen6");
 	BOOST_TEST(kv["FIRMWARE_URL"] == "https://github.com/prusa3d/Prusa-i3-Plus/");
 }
+
+// Minimal Marlin look-alike listening on a TCP port.
+// Replies are held back for a while so that pipelining becomes observable.
+class FakeFirmware
+{
+public:
+	FakeFirmware(boost::asio::io_service& io)
+	: m_acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), m_socket(io), m_timer(io)
+	{
+		m_acceptor.async_accept(m_socket, [this](const boost::system::error_code& ec) {
+			if (!ec)
+			{
+				doRead();
+				flushReplies();
+			}
+		});
+	}
+
+	std::string devicePath() const
+	{
+		return "tcp:127.0.0.1:" + std::to_string(m_acceptor.local_endpoint().port());
+	}
+
+	// Reply with a checksum error the first time this line arrives
+	int failLine = -1;
+	// Along with failLine, ask for this many lines before it again, as if they had been lost
+	int rewind = 0;
+	// Drop the connection without replying once this command arrives
+	std::string disconnectOn;
+	// Announce AUTOREPORT_TEMP and honor M155
+	bool autoReportTemp = false;
+
+	std::vector<std::string> commands; // Accepted commands in the order of execution
+	size_t maxUnconfirmed = 0; // Max count of accepted lines awaiting "ok"
+	size_t acknowledged = 0; // Leading commands whose "ok" has been sent
+	int resendRequests = 0;
+private:
+	void doRead()
+	{
+		m_socket.async_read_some(boost::asio::buffer(m_chunk), [this](const boost::system::error_code& ec, size_t length) {
+			if (ec)
+				return;
+
+			m_input.append(m_chunk, length);
+			processInput();
+			doRead();
+		});
+	}
+
+	void processInput()
+	{
+		size_t used;
+
+		while ((used = m_input.find('\n')) != std::string::npos)
+		{
+			processLine(m_input.substr(0, used++));
+			m_input.erase(0, used);
+		}
+	}
+
+	void processLine(const std::string& line)
+	{
+		if (line[0] != 'N')
+		{
+			if (line.compare(0, 4, "M110") == 0)
+				m_lastLine = 0;
+			m_replies.push_back("ok");
+			return;
+		}
+
+		int lineNo = std::stoi(line.substr(1));
+		auto star = line.rfind('*');
+		unsigned int cs = 0;
+
+		for (size_t i = 0; i < star; i++)
+			cs ^= unsigned(line[i]);
+		BOOST_TEST((cs & 0xff) == std::stoul(line.substr(star+1)));
+
+		std::string cmd = line.substr(line.find(' ') + 1);
+		cmd.resize(cmd.rfind(' '));
+
+		processCommand(lineNo, cmd);
+	}
+
+	void processCommand(int lineNo, const std::string& cmd)
+	{
+		if (lineNo != m_lastLine + 1)
+			requestResend("Line Number is not Last Line Number+1");
+		else if (lineNo == failLine)
+		{
+			failLine = -1;
+			m_lastLine -= rewind;
+			commands.resize(commands.size() - rewind);
+			requestResend("checksum mismatch");
+		}
+		else
+		{
+			m_lastLine = lineNo;
+			commands.push_back(cmd);
+
+			if (cmd == disconnectOn)
+			{
+				m_replies.clear();
+				m_socket.close();
+				return;
+			}
+
+			if (cmd == "M115")
+			{
+				m_replies.push_back("FIRMWARE_NAME:FakeFirmware PROTOCOL_VERSION:1.0");
+				if (autoReportTemp)
+					m_replies.push_back("Cap:AUTOREPORT_TEMP:1");
+			}
+			else if (cmd.compare(0, 4, "M155") == 0)
+				m_reportingTemp = true;
+			m_replies.push_back("ok");
+
+			maxUnconfirmed = std::max(maxUnconfirmed, ++m_unconfirmed);
+		}
+	}
+
+	void requestResend(const char* error)
+	{
+		resendRequests++;
+		m_replies.push_back(std::string("Error:") + error + ", Last Line: " + std::to_string(m_lastLine));
+		m_replies.push_back("Resend: " + std::to_string(m_lastLine + 1));
+		m_replies.push_back("ok");
+	}
+
+	void flushReplies()
+	{
+		std::string out;
+
+		if (!m_socket.is_open())
+			return;
+
+		// In between replies to commands
+		if (m_reportingTemp)
+			out += " T:200.00 /200.00 B:60.00 /60.00 @:0 B@:0\n";
+
+		for (const std::string& r : m_replies)
+			out += r + "\n";
+		m_replies.clear();
+		m_unconfirmed = 0;
+		acknowledged = commands.size();
+
+		if (!out.empty())
+			boost::asio::write(m_socket, boost::asio::buffer(out));
+
+		m_timer.expires_from_now(boost::posix_time::milliseconds(20));
+		m_timer.async_wait([this](const boost::system::error_code& ec) {
+			if (!ec)
+				flushReplies();
+		});
+	}
+private:
+	boost::asio::ip::tcp::acceptor m_acceptor;
+	boost::asio::ip::tcp::socket m_socket;
+	boost::asio::deadline_timer m_timer;
+	char m_chunk[512];
+	std::string m_input;
+	std::vector<std::string> m_replies;
+	int m_lastLine = 0;
+	size_t m_unconfirmed = 0;
+	bool m_reportingTemp = false;
+};
+
+// Connects to the firmware, sends `count` moves and waits for all of them to be confirmed
+// Runs until all moves are confirmed and done() returns true
+static int runMoves(FakeFirmware& fw, boost::asio::io_service& io, Printer& printer, int count,
+	std::function<bool()> done = []() { return true; })
+{
+	int confirmed = 0;
+	boost::asio::deadline_timer deadline(io), poll(io);
+
+	printer.setDevicePath(fw.devicePath().c_str());
+	printer.stateChangeSignal().connect([&](Printer::State state) {
+		if (state != Printer::State::Connected)
+			return;
+
+		for (int i = 0; i < count; i++)
+		{
+			std::string cmd = "G1 X" + std::to_string(i);
+			printer.sendCommand(cmd.c_str(), [&](const std::vector<std::string>& reply) {
+				if (!reply.empty())
+					confirmed++;
+			});
+		}
+	});
+
+	std::function<void()> checkDone = [&]() {
+		if (confirmed == count && done())
+		{
+			io.stop();
+			return;
+		}
+
+		poll.expires_from_now(boost::posix_time::milliseconds(5));
+		poll.async_wait([&](const boost::system::error_code& ec) {
+			if (!ec)
+				checkDone();
+		});
+	};
+	checkDone();
+
+	deadline.expires_from_now(boost::posix_time::seconds(10));
+	deadline.async_wait([&](const boost::system::error_code& ec) {
+		if (!ec)
+			io.stop();
+	});
+
+	printer.start();
+	io.run();
+	printer.stop();
+
+	return confirmed;
+}
+
+static std::vector<std::string> movesSent(const FakeFirmware& fw)
+{
+	std::vector<std::string> moves;
+	std::copy_if(fw.commands.begin(), fw.commands.end(), std::back_inserter(moves), [](const std::string& cmd) {
+		return cmd.compare(0, 2, "G1") == 0;
+	});
+	return moves;
+}
+
+BOOST_AUTO_TEST_CASE(TestOneInFlight)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+
+	BOOST_TEST(runMoves(fw, io, printer, 20) == 20);
+	BOOST_TEST(fw.maxUnconfirmed == 1);
+	BOOST_TEST(movesSent(fw).size() == 20);
+}
+
+BOOST_AUTO_TEST_CASE(TestAdvanceSend)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+
+	printer.setAdvanceSend(true);
+	printer.setMaxInflight(4);
+
+	BOOST_TEST(runMoves(fw, io, printer, 20) == 20);
+	BOOST_TEST(fw.maxUnconfirmed > 1);
+	BOOST_TEST(fw.maxUnconfirmed <= 4);
+	BOOST_TEST(movesSent(fw).size() == 20);
+}
+
+BOOST_AUTO_TEST_CASE(TestAdvanceSendResend)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+
+	printer.setAdvanceSend(true);
+	fw.failLine = 8;
+
+	BOOST_TEST(runMoves(fw, io, printer, 20) == 20);
+	BOOST_TEST(fw.resendRequests >= 1);
+
+	// Every move has been executed exactly once and in order
+	std::vector<std::string> moves = movesSent(fw);
+	BOOST_TEST(moves.size() == 20);
+	for (size_t i = 0; i < moves.size(); i++)
+		BOOST_TEST(moves[i] == "G1 X" + std::to_string(i));
+}
+
+BOOST_AUTO_TEST_CASE(TestResendHistoryDepth)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+
+	// The ring has wrapped around several times, the oldest line it keeps is asked for
+	printer.setResendHistoryDepth(4);
+	fw.failLine = 25;
+	fw.rewind = 3;
+
+	BOOST_TEST(runMoves(fw, io, printer, 30) == 30);
+	BOOST_TEST(fw.resendRequests == 1);
+	BOOST_TEST((printer.state() != Printer::State::Error));
+
+	std::vector<std::string> moves = movesSent(fw);
+	BOOST_TEST(moves.size() == 30);
+	for (size_t i = 0; i < moves.size(); i++)
+		BOOST_TEST(moves[i] == "G1 X" + std::to_string(i));
+}
+
+BOOST_AUTO_TEST_CASE(TestResendHistoryExceeded)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+
+	// One line further back than the ring reaches
+	printer.setResendHistoryDepth(4);
+	fw.failLine = 25;
+	fw.rewind = 4;
+
+	printer.stateChangeSignal().connect([&](Printer::State state) {
+		if (state == Printer::State::Error)
+			io.stop();
+	});
+
+	BOOST_TEST(runMoves(fw, io, printer, 30) < 30);
+	BOOST_TEST((printer.state() == Printer::State::Error));
+	BOOST_TEST(printer.errorMessage() == "Insufficient line history for resend");
+}
+
+BOOST_AUTO_TEST_CASE(TestPrinterStrands)
+{
+	// The firmwares get a thread of their own, the printers share a pool
+	boost::asio::io_service fwIo, io;
+	FakeFirmware fw1(fwIo), fw2(fwIo);
+	Printer printer1(io), printer2(io);
+	const int count = 100;
+
+	struct Checker
+	{
+		std::atomic<bool> busy { false };
+		std::atomic<int> confirmed { 0 }, overlaps { 0 }, offStrand { 0 };
+	} checkers[2];
+
+	auto setup = [&](Printer& printer, FakeFirmware& fw, Checker& checker) {
+		printer.setAdvanceSend(true);
+		printer.setDevicePath(fw.devicePath().c_str());
+		printer.stateChangeSignal().connect([&, count](Printer::State state) {
+			if (state != Printer::State::Connected)
+				return;
+
+			for (int i = 0; i < count; i++)
+			{
+				std::string cmd = "G1 X" + std::to_string(i);
+				printer.sendCommand(cmd.c_str(), [&](const std::vector<std::string>& reply) {
+					if (!printer.strand().running_in_this_thread())
+						checker.offStrand++;
+					if (checker.busy.exchange(true))
+						checker.overlaps++;
+
+					// Long enough for other pool threads to run into this printer's handlers
+					std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+					checker.busy = false;
+					if (!reply.empty() && ++checker.confirmed == count
+						&& checkers[0].confirmed == count && checkers[1].confirmed == count)
+					{
+						fwIo.stop();
+						io.stop();
+					}
+				});
+			}
+		});
+	};
+	setup(printer1, fw1, checkers[0]);
+	setup(printer2, fw2, checkers[1]);
+
+	boost::asio::deadline_timer deadline(fwIo);
+	deadline.expires_from_now(boost::posix_time::seconds(10));
+	deadline.async_wait([&](const boost::system::error_code& ec) {
+		if (!ec)
+		{
+			fwIo.stop();
+			io.stop();
+		}
+	});
+
+	printer1.start();
+	printer2.start();
+
+	auto work = boost::asio::make_work_guard(io);
+	std::vector<std::thread> pool;
+	for (int i = 0; i < 4; i++)
+		pool.emplace_back([&io]() { io.run(); });
+
+	fwIo.run();
+	io.stop();
+	for (std::thread& t : pool)
+		t.join();
+
+	for (const Checker& checker : checkers)
+	{
+		BOOST_TEST(checker.confirmed == count);
+		BOOST_TEST(checker.overlaps == 0);
+		BOOST_TEST(checker.offStrand == 0);
+	}
+	BOOST_TEST(movesSent(fw1).size() == count);
+	BOOST_TEST(movesSent(fw2).size() == count);
+}
+
+BOOST_AUTO_TEST_CASE(TestTemperatureAutoReport)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	Printer printer(io);
+	bool reported = false;
+
+	fw.autoReportTemp = true;
+	printer.setTemperatureInterval(1);
+	printer.temperatureChangeSignal().connect([&](std::map<std::string, float>) {
+		reported = true;
+	});
+
+	// Reports interleaved with replies don't get in the way
+	BOOST_TEST(runMoves(fw, io, printer, 40, [&]() { return reported; }) == 40);
+	BOOST_TEST(movesSent(fw).size() == 40);
+
+	BOOST_TEST(printer.hasCapability("AUTOREPORT_TEMP"));
+	BOOST_TEST(std::count(fw.commands.begin(), fw.commands.end(), "M155 S1") == 1);
+	BOOST_TEST(std::count(fw.commands.begin(), fw.commands.end(), "M105") == 0);
+	BOOST_TEST(printer.getTemperatures()["B"].current == 60);
+}
+
+BOOST_AUTO_TEST_CASE(TestPrintJobFeed)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	auto printer = std::make_shared<Printer>(io);
+	const int count = 600; // over twice the feed's capacity
+
+	std::string gcode;
+	for (int i = 0; i < count; i++)
+		gcode += "G1 X" + std::to_string(i) + "\n";
+
+	const std::string tempfile = makeTempFile("TestPrintJobFeed", gcode);
+
+	auto job = std::make_shared<PrintJob>(printer, "test.gcode", tempfile.c_str());
+	remove(tempfile.c_str());
+
+	printer->setAdvanceSend(true);
+	printer->setMaxInflight(16);
+	printer->setRxBufferSize(1024);
+	printer->setDevicePath(fw.devicePath().c_str());
+	fw.failLine = 300;
+
+	printer->stateChangeSignal().connect([&](Printer::State state) {
+		if (state == Printer::State::Connected)
+			job->start();
+	});
+	job->stateChangeSignal().connect([&](PrintJob::State state, std::string) {
+		if (state != PrintJob::State::Running)
+			io.stop();
+	});
+
+	boost::asio::deadline_timer deadline(io);
+	deadline.expires_from_now(boost::posix_time::seconds(10));
+	deadline.async_wait([&](const boost::system::error_code& ec) {
+		if (!ec)
+			io.stop();
+	});
+
+	printer->start();
+	io.run();
+	printer->stop();
+
+	BOOST_TEST(job->stateString() == std::string("Done"));
+
+	std::vector<std::string> moves = movesSent(fw);
+	BOOST_TEST(moves.size() == count);
+	for (size_t i = 0; i < moves.size(); i++)
+		BOOST_TEST(moves[i] == "G1 X" + std::to_string(i));
+}
+
+BOOST_AUTO_TEST_CASE(TestPrintJobStartPoint)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	auto printer = std::make_shared<Printer>(io);
+	const std::string gcode = "M140 S60\nM104 S215\nM106 S128\nG28\nM83\nG1 Z0.2 F1200\nG1 X10 Y5 E1\n"
+		"G1 Z0.4\nG1 X20 Y5 E1 ; layer 2\nG1 X20 Y15 E1\n";
+
+	const std::string tempfile = makeTempFile("TestPrintJobStartPoint", gcode);
+
+	GCodeAnalyzer analyzer;
+	analyzer.feed(gcode.data(), gcode.length());
+	const GCodeAnalysis& analysis = analyzer.finish();
+	BOOST_REQUIRE(analysis.layers.size() == 2);
+
+	auto job = std::make_shared<PrintJob>(printer, "test.gcode", tempfile.c_str());
+	remove(tempfile.c_str());
+
+	job->setStartPoint(analysis.layers[1].offset, analysis.layers[1].state);
+	printer->setDevicePath(fw.devicePath().c_str());
+
+	printer->stateChangeSignal().connect([&](Printer::State state) {
+		if (state == Printer::State::Connected)
+			job->start();
+	});
+	job->stateChangeSignal().connect([&](PrintJob::State state, std::string) {
+		if (state != PrintJob::State::Running)
+			io.stop();
+	});
+
+	boost::asio::deadline_timer deadline(io);
+	deadline.expires_from_now(boost::posix_time::seconds(10));
+	deadline.async_wait([&](const boost::system::error_code& ec) {
+		if (!ec)
+			io.stop();
+	});
+
+	printer->start();
+	io.run();
+	printer->stop();
+
+	BOOST_TEST(job->stateString() == std::string("Done"));
+
+	// The preamble, then the file from the second layer on
+	const std::vector<std::string> expected = {
+		"M140 S60", "M104 S215", "G90", "G92 Z0.200", "G0 Z2.200 F600",
+		"M190 S60", "M109 S215", "G28 X Y", "G0 X10.000 Y5.000 F3000", "G0 Z0.200 F600",
+		"G92 E1.00000", "M83", "G1 F1200", "M106 S128",
+		"G1 Z0.4", "G1 X20 Y5 E1", "G1 X20 Y15 E1"
+	};
+	std::vector<std::string> commands;
+	auto first = std::find(fw.commands.begin(), fw.commands.end(), expected[0]);
+
+	// Without what the printer sends on its own after connecting
+	std::copy_if(first, fw.commands.end(), std::back_inserter(commands), [](const std::string& cmd) {
+		return cmd.compare(0, 4, "M117") != 0 && cmd != "M105";
+	});
+	BOOST_TEST(commands == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(TestPrintJobDisconnectJournal)
+{
+	boost::asio::io_service io;
+	FakeFirmware fw(io);
+	auto printer = std::make_shared<Printer>(io);
+	const int count = 400;
+	std::vector<size_t> lineEnds;
+	std::string gcode;
+
+	// Absolute positioning until a G91 that's still in flight when the connection drops
+	for (int i = 0; i < count; i++)
+	{
+		gcode += (i == 199) ? "G91\n" : "G1 X" + std::to_string(i) + "\n";
+		lineEnds.push_back(gcode.length());
+	}
+
+	const std::string tempfile = makeTempFile("TestPrintJobDisconnect", gcode);
+
+	const std::string journalfile = makeTempFile("TestPrintJobDisconnectJournal");
+
+	auto job = std::make_shared<PrintJob>(printer, "test.gcode", tempfile.c_str());
+	remove(tempfile.c_str());
+
+	printer->setAdvanceSend(true);
+	printer->setMaxInflight(8);
+	printer->setRxBufferSize(1024);
+	printer->setJournalPath(journalfile);
+	printer->setJournalInterval(1);
+	printer->setDevicePath(fw.devicePath().c_str());
+	fw.disconnectOn = "G1 X201";
+
+	printer->stateChangeSignal().connect([&](Printer::State state) {
+		if (state == Printer::State::Connected)
+			job->start();
+	});
+	job->stateChangeSignal().connect([&](PrintJob::State state, std::string) {
+		if (state != PrintJob::State::Running)
+			io.stop();
+	});
+
+	boost::asio::deadline_timer deadline(io);
+	deadline.expires_from_now(boost::posix_time::seconds(10));
+	deadline.async_wait([&](const boost::system::error_code& ec) {
+		if (!ec)
+			io.stop();
+	});
+
+	printer->start();
+	io.run();
+	printer->stop();
+
+	BOOST_TEST(job->stateString() == std::string("Error"));
+
+	// Lines the firmware has taken in without confirming them
+	const auto isJobLine = [](const std::string& cmd) { return cmd.compare(0, 2, "G1") == 0 || cmd == "G91"; };
+	const size_t accepted = std::count_if(fw.commands.begin(), fw.commands.end(), isJobLine);
+	const size_t confirmed = std::count_if(fw.commands.begin(), fw.commands.begin() + fw.acknowledged, isJobLine);
+	BOOST_REQUIRE(confirmed > 0);
+	BOOST_TEST(accepted > confirmed + 1);
+	BOOST_TEST(confirmed <= 199);
+
+	size_t pos, total;
+	job->progress(pos, total);
+	BOOST_TEST(pos == lineEnds[confirmed - 1]);
+
+	// The journal gets written out as the job goes away
+	job.reset();
+
+	std::optional<JobJournal::Contents> contents = JobJournal::read(journalfile);
+	remove(journalfile.c_str());
+
+	BOOST_REQUIRE(contents.has_value());
+	BOOST_TEST(contents->last.offset == lineEnds[confirmed - 1]);
+	BOOST_TEST(!contents->last.relative);
+	BOOST_TEST(!contents->last.relativeE);
+}
+
+BOOST_AUTO_TEST_CASE(TestJobJournal)
+{
+	const std::string tempfile = makeTempFile("TestJobJournal");
+	remove(tempfile.c_str());
+
+	JobJournal::Entry entry;
+	entry.hotend = 215;
+	entry.bed = 60;
+	entry.relativeE = true;
+
+	{
+		JobJournal journal(tempfile, "benchy.gcode", 12345, std::chrono::milliseconds(10));
+
+		// Only the last entry of an interval gets written
+		for (entry.offset = 100; entry.offset <= 1000; entry.offset += 100)
+			journal.record(entry);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		entry.offset = 2000;
+		journal.record(entry);
+	}
+
+	std::optional<JobJournal::Contents> contents = JobJournal::read(tempfile);
+	BOOST_REQUIRE(contents.has_value());
+	BOOST_TEST(contents->name == "benchy.gcode");
+	BOOST_TEST(contents->size == 12345);
+	BOOST_TEST(contents->last.offset == 2000);
+	BOOST_TEST(contents->last.hotend == 215);
+	BOOST_TEST(contents->last.bed == 60);
+	BOOST_TEST(!contents->last.relative);
+	BOOST_TEST(contents->last.relativeE);
+
+	// The previous record counts if the last one is torn
+	BOOST_REQUIRE(truncate(tempfile.c_str(), boost::filesystem::file_size(tempfile) - 1) == 0);
+	contents = JobJournal::read(tempfile);
+	BOOST_REQUIRE(contents.has_value());
+	BOOST_TEST(contents->last.offset == 1000);
+
+	{
+		JobJournal journal(tempfile, "benchy.gcode", 12345, std::chrono::milliseconds(10));
+		journal.record(entry);
+		journal.discard();
+	}
+	BOOST_TEST(!boost::filesystem::exists(tempfile));
+	BOOST_TEST(!JobJournal::read(tempfile).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(TestMappedGCodeSource)
+{
+	const char gcode[] = "; generated by a slicer\n"
+		"G28 ; home\r\n"
+		"\n"
+		"   G1 X10 Y10  \n"
+		"M104 S200";
+
+	const std::string tempfile = makeTempFile("TestMappedGCodeSource", std::string_view(gcode, sizeof(gcode)-1));
+
+	MappedGCodeSource source(tempfile.c_str());
+	std::string_view line;
+
+	remove(tempfile.c_str());
+
+	BOOST_TEST(source.size() == sizeof(gcode)-1);
+	BOOST_TEST(source.nextLine(line));
+	BOOST_TEST(line == "G28");
+	BOOST_TEST(source.position() == 36);
+	BOOST_TEST(source.nextLine(line));
+	BOOST_TEST(line == "G1 X10 Y10");
+	BOOST_TEST(source.nextLine(line));
+	BOOST_TEST(line == "M104 S200");
+	BOOST_TEST(source.position() == source.size());
+	BOOST_TEST(!source.nextLine(line));
+
+	source.seek(24);
+	BOOST_TEST(source.nextLine(line));
+	BOOST_TEST(line == "G28");
+}
+
+BOOST_AUTO_TEST_CASE(TestSlicedGCodeSource)
+{
+	std::string gcode = "; generated by a slicer\nG28 ; home\n";
+	for (int i = 0; i < 1000; i++)
+		gcode += "G1 X" + std::to_string(i) + " Y10 ; move\n";
+
+	const std::string tempfile = makeTempFile("TestSlicedGCodeSource", gcode);
+
+	SlicedGCodeSource::build(tempfile.c_str());
+
+	std::shared_ptr<GCodeSource> source = GCodeSource::open(tempfile.c_str());
+	MappedGCodeSource mapped(tempfile.c_str());
+	std::string_view line, mappedLine;
+
+	remove(SlicedGCodeSource::sidecarPath(tempfile).c_str());
+	remove(tempfile.c_str());
+
+	BOOST_TEST((dynamic_cast<SlicedGCodeSource*>(source.get()) != nullptr));
+	BOOST_TEST(static_cast<SlicedGCodeSource*>(source.get())->lineCount() == 1001);
+	BOOST_TEST(source->size() == gcode.length());
+
+	// Same lines and positions as the plain file
+	while (mapped.nextLine(mappedLine))
+	{
+		BOOST_TEST(source->nextLine(line));
+		BOOST_TEST(line == mappedLine);
+		BOOST_TEST(source->position() == mapped.position());
+
+		unsigned int cs = 0;
+		for (char c : line)
+			cs ^= unsigned(c);
+		BOOST_TEST(source->lineChecksum() == int(cs));
+	}
+	BOOST_TEST(!source->nextLine(line));
+
+	// Seek into the middle of a line, continue with that line
+	size_t offset = gcode.find("G1 X500 ") + 3;
+	source->seek(offset);
+	BOOST_TEST(source->nextLine(line));
+	BOOST_TEST(line == "G1 X500 Y10");
+
+	static_cast<SlicedGCodeSource*>(source.get())->seekLine(1);
+	BOOST_TEST(source->nextLine(line));
+	BOOST_TEST(line == "G1 X0 Y10");
+}
+
+BOOST_AUTO_TEST_CASE(TestSlicedGCodeSourceOutdated)
+{
+	const std::string gcode = "G28\nG1 X10 Y10\n";
+	const std::string tempfile = makeTempFile("TestSlicedGCodeSourceOutdated", gcode);
+	const std::string sidecar = SlicedGCodeSource::sidecarPath(tempfile);
+
+	auto isSliced = [&]() {
+		std::shared_ptr<GCodeSource> source = GCodeSource::open(tempfile.c_str());
+		return dynamic_cast<SlicedGCodeSource*>(source.get()) != nullptr;
+	};
+	auto setMtime = [&](time_t sec, long nsec) {
+		struct timespec times[2] = { { sec, nsec }, { sec, nsec } };
+		BOOST_REQUIRE(utimensat(AT_FDCWD, tempfile.c_str(), times, 0) == 0);
+	};
+
+	setMtime(1000000000, 100);
+	SlicedGCodeSource::build(tempfile.c_str());
+	BOOST_TEST(isSliced());
+
+	// Rewritten in place within the same second
+	setMtime(1000000000, 200);
+	BOOST_TEST(!isSliced());
+
+	// Replaced by another file with the same size and timestamp
+	const std::string other = makeTempFile("TestSlicedGCodeSourceOther", "G28\nG1 X20 Y20\n");
+	BOOST_REQUIRE(rename(other.c_str(), tempfile.c_str()) == 0);
+	setMtime(1000000000, 100);
+	BOOST_TEST(!isSliced());
+
+	remove(sidecar.c_str());
+	remove(tempfile.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(TestTemperatureHistory)
+{
+	typedef TemperatureHistory::Clock Clock;
+	const Clock::time_point t0 = Clock::now();
+	TemperatureHistory history(8, std::chrono::minutes(30));
+
+	const int hotend = history.sensorId("T");
+	BOOST_TEST(history.sensorId("T") == hotend);
+
+	for (int i = 0; i < 12; i++)
+	{
+		history.beginSample(t0 + std::chrono::seconds(i));
+		history.set(hotend, 20 + i, 200);
+
+		// The bed shows up later
+		if (i >= 6)
+			history.set(history.sensorId("B"), 60, 60);
+	}
+
+	// Only the last 8 samples are kept
+	BOOST_TEST(history.size() == 8);
+
+	float current, target;
+	BOOST_TEST(history.latest(hotend, current, target));
+	BOOST_TEST(current == 31);
+
+	TemperatureHistory::Slice all = history.query(Clock::time_point(), Clock::duration::zero());
+	BOOST_TEST(all.when.size() == 8);
+	BOOST_TEST(all.sensors.size() == 2);
+	BOOST_TEST(all.current[0] == 24);
+	BOOST_TEST(std::isnan(all.current[1])); // no bed value at t0+4s
+
+	TemperatureHistory::Slice slice = history.query(t0 + std::chrono::milliseconds(5500), std::chrono::seconds(2));
+	BOOST_TEST(slice.when.size() == 3);
+	BOOST_TEST(slice.current[0] == 26);
+	BOOST_TEST(slice.current[2] == 28);
+	BOOST_TEST(slice.current[4] == 30);
+
+	// Samples older than the max age are dropped as well
+	history.beginSample(t0 + std::chrono::hours(1));
+	BOOST_TEST(history.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestTemperatureParser)
+{
+	TemperatureReading r[16];
+
+	// Prusa MK3
+	size_t count = parseTemperatureReport("ok T:210.3 /215.0 B:60.1 /60.0 T0:210.3 /215.0 @:127 B@:0 P:35.1 A:36.2", r, 16);
+	BOOST_TEST(count == 6);
+	BOOST_TEST(r[0].sensor() == "T");
+	BOOST_TEST(r[0].current == 210.3f);
+	BOOST_TEST(r[0].target == 215.0f);
+	BOOST_TEST(r[2].sensor() == "T0");
+	BOOST_TEST((r[3].kind == TemperatureReading::Kind::Power));
+	BOOST_TEST(r[3].sensor() == "T");
+	BOOST_TEST(r[3].current == 127);
+	BOOST_TEST(r[4].sensor() == "B");
+	BOOST_TEST(r[5].sensor() == "P");
+	BOOST_TEST(std::isnan(r[5].target));
+
+	// Marlin with 2 hotends, a chamber and raw ADC values
+	count = parseTemperatureReport("T0:24.2 /0.0 (4061.0) T1:-14.0 /0.0 B:23.0/50 C:30.5 /0.0 @0:0 @1:12", r, 16);
+	BOOST_TEST(count == 6);
+	BOOST_TEST(r[1].sensor() == "T1");
+	BOOST_TEST(r[1].current == -14.0f);
+	BOOST_TEST(r[2].target == 50);
+	BOOST_TEST(r[3].sensor() == "C");
+	BOOST_TEST(r[5].sensor() == "T1");
+	BOOST_TEST(r[5].current == 12);
+
+	// M109 progress report
+	count = parseTemperatureReport(" T:180.52 E:0 W:?", r, 16);
+	BOOST_TEST(count == 1);
+	BOOST_TEST(r[0].current == 180.52f);
+	BOOST_TEST(std::isnan(r[0].target));
+
+	BOOST_TEST(parseTemperatureReport("ok", r, 16) == 0);
+	BOOST_TEST(parseTemperatureReport("ok T:20 /0 B:20 /0", r, 1) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestLinkStats)
+{
+	// Every value falls into the bucket whose range it is in
+	for (uint64_t v : { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 4095, 4096, 123456789 })
+	{
+		const int i = LinkStats::bucketIndex(v);
+		BOOST_TEST(LinkStats::bucketLowerBound(i) <= v);
+		BOOST_TEST(LinkStats::bucketLowerBound(i + 1) > v);
+	}
+	BOOST_TEST(LinkStats::bucketIndex(uint64_t(1) << 40) == LinkStats::BUCKETS - 1);
+
+	LinkStats stats;
+	for (int i = 0; i < 90; i++)
+		stats.okReceived(std::chrono::milliseconds(2));
+	for (int i = 0; i < 10; i++)
+		stats.okReceived(std::chrono::milliseconds(50));
+	stats.lineSent(10);
+	stats.lineSent(20);
+	stats.resendRequested();
+
+	LinkStats::Report previous, report;
+	previous.when = std::chrono::system_clock::now() - std::chrono::seconds(2);
+	stats.fillReport(report, previous);
+
+	BOOST_TEST(report.oks == 100);
+	BOOST_TEST(report.resends == 1);
+	BOOST_TEST(report.bytesSent == 30);
+	BOOST_TEST(report.linesSentPerSec == 1, boost::test_tools::tolerance(0.01));
+
+	// Within the 12.5% bucket resolution
+	const uint64_t p50 = LinkStats::percentile(report.latency, 0.5);
+	const uint64_t p99 = LinkStats::percentile(report.latency, 0.99);
+	BOOST_TEST((p50 > 2000 && p50 <= 2250));
+	BOOST_TEST((p99 > 50000 && p99 <= 56250));
+}
+
+BOOST_AUTO_TEST_CASE(TestLineFramer)
+{
+	LineFramer framer;
+
+	BOOST_TEST(framer.frame(1, "G28", -1));
+	BOOST_TEST(framer.line() == "N1 G28 *50\n");
+	BOOST_TEST(framer.text() == "N1 G28 *50");
+
+	// A precomputed body checksum gives the same result
+	BOOST_TEST(framer.frame(1, "G28", 'G' ^ '2' ^ '8'));
+	BOOST_TEST(framer.line() == "N1 G28 *50\n");
+
+	BOOST_TEST(framer.frame("M110 N0"));
+	BOOST_TEST(framer.line() == "M110 N0\n");
+
+	BOOST_TEST(!framer.frame(1, std::string(LineFramer::CAPACITY, 'G'), -1));
+}
+
+BOOST_AUTO_TEST_CASE(TestArcFitting)
+{
+	// A circle of radius 10 around (50, 50) in 72 segments, then a straight line
+	std::string gcode = "G90\nM82\nG92 E0\nG0 X60 Y50\n";
+	char buf[100];
+	double e = 0;
+
+	for (int i = 1; i <= 72; i++)
+	{
+		const double a = 2 * M_PI * i / 72;
+		e += 0.0436;
+		snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f E%.4f%s\n", 50 + 10*cos(a), 50 + 10*sin(a), e, (i == 1) ? " F1800" : "");
+		gcode += buf;
+	}
+	for (int i = 1; i <= 10; i++)
+		gcode += "G1 X" + std::to_string(60 + i) + " Y50\n";
+
+	const std::string tempfile = makeTempFile("TestArcFitting", gcode);
+
+	std::vector<std::unique_ptr<GCodeStage>> stages;
+	stages.push_back(std::make_unique<ArcFitStage>(0.05));
+
+	PipelineGCodeSource source(std::make_shared<MappedGCodeSource>(tempfile.c_str()), std::move(stages));
+	std::vector<std::string> lines;
+	std::string_view line;
+
+	remove(tempfile.c_str());
+
+	while (source.nextLine(line))
+		lines.push_back(std::string(line));
+
+	BOOST_TEST(source.position() == gcode.length());
+
+	// Counter-clockwise, the last segment is left out as the arc would become a full circle
+	BOOST_TEST(lines.size() == 16);
+	BOOST_TEST(lines[4].compare(0, 3, "G3 ") == 0);
+	BOOST_TEST(lines[4].find(" I-10.000 ") != std::string::npos);
+	BOOST_TEST(lines[4].find(" E3.09560 F1800") != std::string::npos);
+	BOOST_TEST(lines[5] == "G1 X60.000 Y50.000 E3.1392");
+
+	// Straight lines are left alone
+	BOOST_TEST(lines.back() == "G1 X70 Y50");
+	BOOST_TEST(lines[lines.size() - 10] == "G1 X61 Y50");
+}
+
+BOOST_AUTO_TEST_CASE(TestGCodePipeline)
+{
+	std::string gcode = "N1 G28 *50\nG1 Z0.2 F1200 (first layer)\nG91\nG1 Z1\nG90\n";
+	for (int i = 0; i < 1000; i++)
+		gcode += "G1 X1 E" + std::to_string(i) + "\n";
+
+	const std::string tempfile = makeTempFile("TestGCodePipeline", gcode);
+
+	std::vector<std::unique_ptr<GCodeStage>> stages;
+	stages.push_back(std::make_unique<StripLineNumbersStage>());
+	stages.push_back(std::make_unique<StripCommentsStage>());
+	stages.push_back(std::make_unique<ScaleParamStage>('F', 1.5));
+	stages.push_back(std::make_unique<ScaleParamStage>('E', 0.5));
+	stages.push_back(std::make_unique<ZOffsetStage>(-0.05));
+	stages.push_back(std::make_unique<ProgressStage>());
+
+	PipelineGCodeSource source(std::make_shared<MappedGCodeSource>(tempfile.c_str()), std::move(stages));
+	remove(tempfile.c_str());
+
+	for (int run = 0; run < 2; run++)
+	{
+		std::vector<std::string> lines;
+		std::string_view line;
+
+		source.seek(0);
+		while (source.nextLine(line))
+		{
+			lines.push_back(std::string(line));
+			// Changed lines need a new checksum
+			if (line.find(" E") != std::string_view::npos)
+				BOOST_TEST(source.lineChecksum() == -1);
+		}
+
+		BOOST_TEST(source.position() == gcode.length());
+
+		// 1005 lines and M73 P0 to P99, the last line starts below 100 %
+		BOOST_REQUIRE(lines.size() == 1105);
+		BOOST_TEST(lines[0] == "M73 P0");
+		BOOST_TEST(lines[1] == "G28");
+		BOOST_TEST(lines[2] == "G1 Z0.15 F1800");
+		// Relative moves aren't offset
+		BOOST_TEST(lines[4] == "G1 Z1");
+		BOOST_TEST(lines.back() == "G1 X1 E499.5");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(TestTextArenaReuse)
+{
+	TextArena arena;
+	std::deque<std::pair<std::string_view, std::string>> retained;
+	size_t peak = 0;
+
+	// A line per batch, the consumer keeps the last 3000
+	for (size_t line = 0; line < 100000; line++)
+	{
+		const std::string text = std::to_string(line) + std::string(100, 'x');
+
+		arena.release(line, 3000);
+		retained.push_back({ arena.store(text), text });
+		arena.emitted(line + 1);
+
+		if (retained.size() > 3000)
+			retained.pop_front();
+		if (line % 100 == 0)
+		{
+			for (const auto& [stored, text] : retained)
+				BOOST_REQUIRE(stored == text);
+		}
+		peak = std::max(peak, arena.allocated());
+	}
+
+	// 3000 lines and a block being filled, rather than 10 MB
+	BOOST_TEST(peak <= 8 * 64 * 1024);
+
+	// Nothing is reused unless the consumer is far enough
+	TextArena kept;
+	for (size_t line = 0; line < 10000; line++)
+	{
+		kept.release(line, PipelineGCodeSource::RETAIN_ALL);
+		kept.store(std::string(100, 'x'));
+		kept.emitted(line + 1);
+	}
+	BOOST_TEST(kept.allocated() >= 10000 * 100);
+}
+
+BOOST_AUTO_TEST_CASE(TestGCodePipelineRetainsLines)
+{
+	// Runs longer than a batch are held back by the arc fitter, along with the feedrate
+	// its first line got from an earlier stage. Other lines are all changed too.
+	std::string gcode = "G90\nM82\nG1 X60 Y50\n";
+	double e = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		for (int j = 1; j <= 300; j++)
+		{
+			const double angle = (i % 2 ? -1 : 1) * 2 * M_PI * j / 400;
+			char buf[80];
+			e += 0.1;
+			std::snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f E%.4f", 50 + 10 * std::cos(angle), 50 + 10 * std::sin(angle), e);
+			gcode += buf;
+			gcode += (j == 1) ? " F" + std::to_string(1000 + i) + "\n" : "\n";
+		}
+		for (int j = 0; j < 100; j++)
+			gcode += "G1 Z" + std::to_string(i * 100 + j) + " E" + std::to_string(e) + "\n";
+		gcode += "G1 X60 Y50\n";
+	}
+
+	const std::string tempfile = makeTempFile("TestGCodePipelineRetains", gcode);
+
+	auto read = [&](size_t retainLines) {
+		std::vector<std::unique_ptr<GCodeStage>> stages;
+		stages.push_back(std::make_unique<ScaleParamStage>('E', 0.5));
+		stages.push_back(std::make_unique<ScaleParamStage>('F', 2));
+		stages.push_back(std::make_unique<ArcFitStage>(0.05));
+
+		PipelineGCodeSource source(std::make_shared<MappedGCodeSource>(tempfile.c_str()), std::move(stages), retainLines);
+		std::deque<std::pair<std::string_view, std::string>> retained;
+		std::vector<std::string> lines;
+		std::string_view line;
+
+		while (source.nextLine(line))
+		{
+			lines.push_back(std::string(line));
+			if (retainLines == PipelineGCodeSource::RETAIN_ALL)
+				continue;
+
+			// Intact until retainLines more lines have been read
+			retained.push_back({ line, lines.back() });
+			if (retained.size() > retainLines)
+				retained.pop_front();
+			if (lines.size() % 100 == 0)
+			{
+				for (const auto& [stored, text] : retained)
+					BOOST_REQUIRE(stored == text);
+			}
+		}
+		return lines;
+	};
+
+	const std::vector<std::string> lines = read(10000);
+	BOOST_TEST(lines == read(PipelineGCodeSource::RETAIN_ALL), boost::test_tools::per_element());
+	remove(tempfile.c_str());
+
+	BOOST_REQUIRE(lines.size() == 3 + 200 * 102);
+	BOOST_TEST(lines[3].compare(0, 3, "G3 ") == 0);
+	BOOST_TEST(lines[3].find(" F2000") != std::string::npos);
+	BOOST_TEST(lines.back() == "G1 X60 Y50");
+}
+
+static double estimateFile(const std::string& gcode, PrintTimeEstimator& estimator)
+{
+	const std::string tempfile = makeTempFile("TestPrintTime", gcode);
+
+	MappedGCodeSource source(tempfile.c_str());
+	remove(tempfile.c_str());
+
+	BOOST_REQUIRE(estimator.build(source));
+	BOOST_REQUIRE(estimator.ready());
+	return estimator.totalTime();
+}
+
+BOOST_AUTO_TEST_CASE(TestPrintTimeEstimator)
+{
+	MotionLimits limits;
+	BOOST_TEST(limits.parse("echo:  M203 X500.00 Y500.00 Z12.00 E120.00"));
+	BOOST_TEST(limits.parse("echo:  M204 P1000.00 R1000.00 T1000.00 ; accelerations"));
+	BOOST_TEST(!limits.parse("echo:Maximum feedrates (units/s):"));
+	BOOST_TEST(limits.maxFeedrate[2] == 12);
+	BOOST_TEST(limits.travelAcceleration == 1000);
+
+	// From the X jerk of 10 mm/s to 100 mm/s and down to a stop: 0.09 + 0.9005 + 0.1 s, then a dwell
+	{
+		PrintTimeEstimator estimator(limits);
+		const std::string gcode = "G90\nG1 X100 F6000\nG4 S10\n";
+
+		BOOST_TEST(estimateFile(gcode, estimator) == 11.0905, boost::test_tools::tolerance(1e-6));
+		BOOST_TEST(estimator.remainingAt(gcode.length()) == 0, boost::test_tools::tolerance(1e-6));
+	}
+
+	// The slicer's M73 remaining time overrides the model
+	{
+		PrintTimeEstimator estimator(limits);
+		std::string gcode = "M73 P0 R5\nG90\n";
+		for (int i = 0; i < 100; i++)
+			gcode += "G1 X100 F6000\nG1 X0\n";
+
+		estimateFile(gcode, estimator);
+
+		const double model = estimator.timeAt(gcode.length());
+		BOOST_TEST(model > 50);
+		BOOST_TEST(estimator.totalTime() == 300, boost::test_tools::tolerance(0.01));
+		BOOST_TEST(estimator.remainingAt(gcode.length() / 2) == 300 - estimator.timeAt(gcode.length() / 2), boost::test_tools::tolerance(0.01));
+	}
+}
+
+// Waits for the job's estimate, which is computed in the background
+static int jobEstimate(PrintJob& job)
+{
+	for (int i = 0; i < 500 && job.timeEstimated() == -1; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return job.timeEstimated();
+}
+
+BOOST_AUTO_TEST_CASE(TestPrintJobEstimateStages)
+{
+	boost::asio::io_service io;
+	auto printer = std::make_shared<Printer>(io);
+
+	auto estimate = [&](const std::string& gcode, double feedFactor) {
+		const std::string tempfile = makeTempFile("TestPrintJobEstimate", gcode);
+
+		std::vector<std::unique_ptr<GCodeStage>> stages;
+		if (feedFactor != 1)
+			stages.push_back(std::make_unique<ScaleParamStage>('F', feedFactor));
+
+		// The estimator opens the file on its own
+		PrintJob job(printer, "test.gcode", tempfile.c_str(), std::move(stages));
+		const int rv = jobEstimate(job);
+		remove(tempfile.c_str());
+		return rv;
+	};
+
+	std::string gcode = "G90\n";
+	for (int i = 0; i < 100; i++)
+		gcode += "G1 X100 F3000\nG1 X0\n";
+
+	const int plain = estimate(gcode, 1);
+	BOOST_TEST(plain > 20);
+	BOOST_TEST(estimate(gcode, 2) < plain * 0.6);
+
+	// The slicer's time is for the original feedrates
+	BOOST_TEST(std::abs(estimate("M73 P0 R6\n" + gcode, 2) - 180) <= 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestGCodeAnalyzer)
+{
+	const std::string gcode = "G28\nG1 Z0.2 F3000\nG92 E0\nG1 X10 Y10\nG1 X20 Y10 E1\nG1 E0.2\n"
+		"G1 Z0.4\nG1 E1\nG1 X20 Y20 E2 ; perimeter\nN5 G1 X10 Y20 E3*99\nG1 Z10";
+	GCodeAnalyzer analyzer;
+
+	// Lines split across chunks
+	for (size_t i = 0; i < gcode.length(); i += 7)
+		analyzer.feed(gcode.data() + i, std::min<size_t>(7, gcode.length() - i));
+
+	const GCodeAnalysis& analysis = analyzer.finish();
+
+	BOOST_TEST(analysis.lines == 11);
+	BOOST_REQUIRE(analysis.layers.size() == 2);
+	BOOST_TEST(analysis.layers[0].z == 0.2f);
+	BOOST_TEST(analysis.layers[0].offset == gcode.find("G1 Z0.2"));
+	BOOST_TEST(analysis.layers[0].moves == 1);
+	// Retraction and unretraction happen before the next layer starts
+	BOOST_TEST(analysis.layers[0].filament == 1, boost::test_tools::tolerance(1e-5f));
+	BOOST_TEST(analysis.layers[1].offset == gcode.find("G1 Z0.4"));
+	BOOST_TEST(analysis.layers[1].moves == 2);
+	BOOST_TEST(analysis.layers[1].filament == 2, boost::test_tools::tolerance(1e-5f));
+
+	// What starting at a layer has to restore
+	const GCodeAnalysis::State& state = analysis.layers[1].state;
+	BOOST_TEST(state.position[0] == 20);
+	BOOST_TEST(state.position[1] == 10);
+	BOOST_TEST(state.position[2] == 0.2f);
+	BOOST_TEST(state.e == 0.2, boost::test_tools::tolerance(1e-9));
+	BOOST_TEST(state.feedrate == 3000);
+	BOOST_TEST(analysis.layers[0].state.position[2] == 0);
+
+	BOOST_TEST(analysis.filament == 3, boost::test_tools::tolerance(1e-9));
+	BOOST_TEST(analysis.extrusionMoves == 3);
+	BOOST_TEST(analysis.travelMoves == 4);
+	BOOST_TEST(analysis.min[0] == 10);
+	BOOST_TEST(analysis.min[2] == 0.2f);
+	BOOST_TEST(analysis.max[1] == 20);
+	BOOST_TEST(analysis.max[2] == 0.4f);
+}
+
+BOOST_AUTO_TEST_CASE(TestGCodeScanner)
+{
+	// Matches inside the vectorised blocks and in the tail
+	const std::string text = std::string(40, 'x') + ";" + std::string(10, 'x') + "\n";
+	BOOST_TEST(gcodescan::findEither(text.data(), text.data() + text.length(), '\n', ';') - text.data() == 40);
+	BOOST_TEST(gcodescan::findEither(text.data(), text.data() + text.length(), '\n', '\n') - text.data() == 51);
+	BOOST_TEST(gcodescan::findEither(text.data(), text.data() + 40, '\n', ';') - text.data() == 40);
+
+	// Short lines take the bit mask path, long ones don't
+	for (const std::string& line : { std::string("G1  X10.5\tY-3 E.25"), "G1 X10.5 Y-3 E.25 " + std::string(60, ' ') + "; " + std::string(10, 'x') })
+	{
+		gcodescan::Words words(line);
+		std::vector<std::string> result;
+		std::string_view word;
+
+		while (words.next(word))
+			result.push_back(std::string(word));
+
+		BOOST_REQUIRE(result.size() >= 4);
+		BOOST_TEST(result[0] == "G1");
+		BOOST_TEST(result[1] == "X10.5");
+		BOOST_TEST(result[2] == "Y-3");
+		BOOST_TEST(result[3] == "E.25");
+	}
+
+	// Short lines take the vectorised path, long ones don't, a stray '\r' is blank on both
+	auto split = [](const std::string& line) {
+		gcodescan::Words words(line);
+		std::vector<std::string> result;
+		std::string_view word;
+
+		while (words.next(word))
+			result.push_back(std::string(word));
+		return result;
+	};
+	const std::string crLine = "G1 X10.5 Y-3 E.25\rF1200\r";
+	const std::vector<std::string> crWords = { "G1", "X10.5", "Y-3", "E.25", "F1200" };
+	BOOST_TEST(split(crLine) == crWords, boost::test_tools::per_element());
+	BOOST_TEST(split(crLine + std::string(60, ' ')) == crWords, boost::test_tools::per_element());
+
+	double value;
+	for (const char* number : { "0", "-0.8", ".25", "12.", "123.45678", "-1234567.891", "0.1", "99999.9999999999" })
+	{
+		BOOST_TEST(gcodescan::parseNumber(number, value));
+		BOOST_TEST(value == std::strtod(number, nullptr));
+	}
+	for (const char* number : { "", "-", ".", "1.2.3", "1e5", "X1" })
+		BOOST_TEST(!gcodescan::parseNumber(number, value));
+}
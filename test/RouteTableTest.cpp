@@ -0,0 +1,101 @@
+#define BOOST_TEST_MODULE RouteTableTest
+#include <boost/test/included/unit_test.hpp>
+#include "web/RouteTable.h"
+
+typedef boost::beast::http::verb verb;
+
+BOOST_AUTO_TEST_CASE(TestSegments)
+{
+	RouteTable table;
+	RouteTable::Match m;
+
+	const size_t printers = table.add("printers", verb::get);
+	const size_t discover = table.add("printers/discover", verb::post);
+	const size_t printer = table.add("printers/([^/]+)", verb::get);
+	const size_t job = table.add("printers/([^/]+)/job", verb::get);
+	const size_t user = table.add("auth/user/(.+)", verb::get);
+
+	BOOST_TEST(table.find("printers", verb::get, m));
+	BOOST_TEST(m.id == printers);
+	BOOST_TEST(m.captureCount == 1);
+
+	BOOST_TEST(table.find("printers/discover", verb::post, m));
+	BOOST_TEST(m.id == discover);
+
+	// The literal segment only exists for POST
+	BOOST_TEST(table.find("printers/discover", verb::get, m));
+	BOOST_TEST(m.id == printer);
+	BOOST_TEST(m.captures[1] == "discover");
+
+	BOOST_TEST(table.find("printers/mk3/job", verb::get, m));
+	BOOST_TEST(m.id == job);
+	BOOST_TEST(m.captureCount == 2);
+	BOOST_TEST(m.captures[0] == "printers/mk3/job");
+	BOOST_TEST(m.captures[1] == "mk3");
+
+	BOOST_TEST(table.find("auth/user/a/b", verb::get, m));
+	BOOST_TEST(m.id == user);
+	BOOST_TEST(m.captures[1] == "a/b");
+
+	BOOST_TEST(!table.find("auth/user/", verb::get, m));
+	BOOST_TEST(!table.find("printers//job", verb::get, m));
+	BOOST_TEST(!table.find("printers/mk3/job/", verb::get, m));
+	BOOST_TEST(!table.find("printers/mk3/job", verb::put, m));
+	BOOST_TEST(!table.find("printer", verb::get, m));
+}
+
+BOOST_AUTO_TEST_CASE(TestOrder)
+{
+	RouteTable table;
+	RouteTable::Match m;
+
+	// Like regexes tried in order, the route added first wins
+	const size_t capture = table.add("files/([^/]+)", verb::get);
+	table.add("files/local", verb::get);
+	table.add("files/[a-z]+\\.gcode", verb::get);
+	const size_t all = table.add(".*", verb::get);
+
+	BOOST_TEST(table.find("files/benchy.gcode", verb::get, m));
+	BOOST_TEST(m.id == capture);
+
+	BOOST_TEST(table.find("files/local", verb::get, m));
+	BOOST_TEST(m.id == capture);
+
+	BOOST_TEST(table.find("files/a/b", verb::get, m));
+	BOOST_TEST(m.id == all);
+
+	RouteTable fallback;
+	const size_t first = fallback.add("files/[a-z]+\\.gcode", verb::get);
+	fallback.add("files/([^/]+)", verb::get);
+
+	BOOST_TEST(fallback.find("files/benchy.gcode", verb::get, m));
+	BOOST_TEST(m.id == first);
+	BOOST_TEST(m.captureCount == 1);
+
+	BOOST_TEST(fallback.find("files/Benchy.gcode", verb::get, m));
+	BOOST_TEST(m.id != first);
+	BOOST_TEST(m.captures[1] == "Benchy.gcode");
+}
+
+BOOST_AUTO_TEST_CASE(TestPrefixes)
+{
+	RouteTable table;
+	size_t id;
+
+	const size_t apiv1 = table.addPrefix("/api/v1/");
+	const size_t api = table.addPrefix("/api/");
+	const size_t websocket = table.addPrefix("/websocket");
+
+	BOOST_TEST(table.findPrefix("/api/v1/printers", id));
+	BOOST_TEST(id == apiv1);
+	BOOST_TEST(table.findPrefix("/api/version", id));
+	BOOST_TEST(id == api);
+	BOOST_TEST(table.findPrefix("/websocket", id));
+	BOOST_TEST(id == websocket);
+	BOOST_TEST(table.findPrefix("/websockets/x", id));
+	BOOST_TEST(id == websocket);
+
+	BOOST_TEST(!table.findPrefix("/api", id));
+	BOOST_TEST(!table.findPrefix("/index.html", id));
+	BOOST_TEST(!table.findPrefix("", id));
+}
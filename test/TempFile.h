@@ -0,0 +1,24 @@
+#ifndef _TEMPFILE_H
+#define _TEMPFILE_H
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <string_view>
+#include <cstdlib>
+#include <unistd.h>
+
+// Creates a file named /tmp/<prefix>XXXXXX holding contents, returns its path
+inline std::string makeTempFile(const char* prefix, std::string_view contents = {})
+{
+	std::string path = std::string("/tmp/") + prefix + "XXXXXX";
+
+	const int fd = mkstemp(path.data());
+	BOOST_REQUIRE(fd != -1);
+
+	const ssize_t written = write(fd, contents.data(), contents.length());
+	close(fd);
+	BOOST_REQUIRE(written == ssize_t(contents.length()));
+
+	return path;
+}
+
+#endif
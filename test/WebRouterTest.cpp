@@ -0,0 +1,107 @@
+#define BOOST_TEST_MODULE WebRouterTest
+#include <boost/test/included/unit_test.hpp>
+#include "web/WebServer.h"
+#include "web/WebRequest.h"
+#include "web/WebResponse.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<bool> g_countAllocations { false };
+static std::atomic<int> g_allocations { 0 };
+
+void* operator new(size_t size)
+{
+	if (g_countAllocations)
+		g_allocations++;
+
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+typedef boost::beast::http::request<boost::beast::http::string_body> request_t;
+
+static void countCall(WebRequest&, WebResponse&, int* calls, int*)
+{
+	(*calls)++;
+}
+
+static WebRouter::filter_t countingFilter(int* calls)
+{
+	return [=](WebRequest& req, WebResponse& res, const WebRouter::next_t& next) {
+		(*calls)++;
+		next(req, res);
+	};
+}
+
+BOOST_AUTO_TEST_CASE(TestDispatchDoesNotAllocate)
+{
+	boost::asio::io_service io;
+	WebServer server(io);
+	int calls = 0, filterCalls = 0, inlineCalls = 0;
+
+	WebRouter* api = server.router("/api/v1/");
+	api->addFilter(countingFilter(&filterCalls));
+	api->addFilter(countingFilter(&filterCalls));
+
+	// Big enough captures to defeat std::function's small object buffer
+	api->get("printers/([^/]+)/job", countCall, &calls, &filterCalls);
+	api->get("files", WebRouter::inlineFilter(countingFilter(&inlineCalls), countCall, &calls, &filterCalls));
+
+	const std::string requestFile;
+	request_t jobRequest(boost::beast::http::verb::get, "/api/v1/printers/mk3/job", 11);
+	request_t filesRequest(boost::beast::http::verb::get, "/api/v1/files", 11);
+	WebRequest jobReq(jobRequest, requestFile, nullptr), filesReq(filesRequest, requestFile, nullptr);
+	WebResponse res(nullptr);
+
+	g_allocations = 0;
+	g_countAllocations = true;
+
+	server.runHandler(jobReq, res);
+	server.runHandler(filesReq, res);
+
+	g_countAllocations = false;
+
+	BOOST_TEST(g_allocations == 0);
+	BOOST_TEST(calls == 2);
+	BOOST_TEST(filterCalls == 4);
+	BOOST_TEST(inlineCalls == 1);
+	BOOST_TEST(jobReq.pathParam(1) == "mk3");
+}
+
+BOOST_AUTO_TEST_CASE(TestFilterStopsChain)
+{
+	boost::asio::io_service io;
+	WebServer server(io);
+	int calls = 0, filterCalls = 0;
+
+	server.router("/api/")->addFilter([&](WebRequest&, WebResponse&, const WebRouter::next_t&) {
+		filterCalls++;
+	})->get("version", countCall, &calls, &filterCalls);
+
+	const std::string requestFile;
+	request_t request(boost::beast::http::verb::get, "/api/version", 11);
+	WebRequest req(request, requestFile, nullptr);
+	WebResponse res(nullptr);
+
+	server.runHandler(req, res);
+
+	BOOST_TEST(filterCalls == 1);
+	BOOST_TEST(calls == 0);
+
+	request_t missing(boost::beast::http::verb::get, "/missing", 11);
+	WebRequest missingReq(missing, requestFile, nullptr);
+
+	BOOST_CHECK_THROW(server.runHandler(missingReq, res), WebErrors::not_found);
+}